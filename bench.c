@@ -0,0 +1,365 @@
+/* Benchmark harness for the registration core.
+ *
+ *   crs-bench gen --dir DIR [--rows N] [--courses N] [--sems N] [--seed N]
+ *   crs-bench run --dir DIR [--ops N] [--scans N] [--seed N]
+ *   crs-bench io --dir DIR [--threads N] [--appends N] [--files N]
+ *
+ * `gen` writes a synthetic data set into DIR: N registrations spread
+ * round-robin over the courses, plus one attendance and one grade row per
+ * registration and semester. `run` loads DIR the same way `crs` does and
+ * times each operation behind the menus, printing throughput and latency
+ * percentiles. Operations change the data (through the journal, with
+ * compaction when it fills up), so run against a generated copy. Set
+ * CRS_STORAGE=binary or CRS_STORAGE=sharded to benchmark the binary
+ * snapshot or the per-course shards instead, and CRS_AIO=uring|threads to
+ * run either on an async I/O backend. `io` compares the blocking path
+ * with both async backends on journal commits from concurrent threads and
+ * on a batch of fsync'd file rewrites, in a scratch directory under DIR. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "crs_internal.h"
+
+/* xorshift64*: fast and reproducible for a given seed */
+typedef struct { uint64_t s; } Rng;
+
+uint64_t rng_next(Rng *r) {
+    r->s ^= r->s >> 12;
+    r->s ^= r->s << 25;
+    r->s ^= r->s >> 27;
+    return r->s * 2685821657736338717ull;
+}
+
+const char *grade_labels[] = { "O", "A+", "A", "B+", "B", "C", "P", "F" };
+
+/* ---------- Synthetic data ---------- */
+
+int enter_dir(const char *dir) {
+    mkdir(dir, 0755);
+    if (chdir(dir) != 0) { printf("Could not enter %s.\n", dir); return -1; }
+    return 0;
+}
+
+int generate_dataset(const char *dir, long rows, int ncourses, int sems, unsigned seed) {
+    if (rows <= 0 || ncourses <= 0 || sems < 0) {
+        printf("--rows and --courses must be positive.\n");
+        return -1;
+    }
+    if (enter_dir(dir) != 0) return -1;
+    Rng rng = { seed * 0x9e3779b97f4a7c15ull + 1 };
+    double start = now_seconds();
+    FILE *fc = fopen("courses.txt", "w");
+    FILE *fr = fopen("registrations.csv", "w");
+    FILE *fa = fopen("attendance.csv", "w");
+    FILE *fg = fopen("grades.csv", "w");
+    FILE *fw = fopen("waitlist.csv", "w");
+    if (!fc || !fr || !fa || !fg || !fw) { printf("Could not create the data files.\n"); return -1; }
+    for (int i = 0; i < ncourses; i++) fprintf(fc, "Course%03d\n", i);
+    for (long i = 0; i < rows; i++) {
+        int course = (int)(i % ncourses);
+        long student = i / ncourses;
+        fprintf(fr, "Course%03d,R%08ld,Student %ld,r%08ld@example.edu,year%ld\n",
+                course, student, student, student, student % 4 + 1);
+        for (int s = 1; s <= sems; s++) {
+            fprintf(fa, "Course%03d,R%08ld,sem%d,%d\n", course, student, s,
+                    40 + (int)(rng_next(&rng) % 61));
+            fprintf(fg, "Course%03d,R%08ld,sem%d,%s\n", course, student, s,
+                    grade_labels[rng_next(&rng) % 8]);
+        }
+    }
+    int rc = 0;
+    if (fclose(fc) | fclose(fr) | fclose(fa) | fclose(fg) | fclose(fw)) rc = -1;
+    remove("journal.log");
+    remove(DATA_BIN);
+    remove(SHARD_MANIFEST);   /* stale shards are swept at the next load */
+    if (rc == 0 && storage_mode != STORAGE_CSV) {
+        int mode = storage_mode;
+        storage_mode = STORAGE_CSV;
+        rc = load_registry() == 0 && (mode == STORAGE_BINARY ? save_binary_snapshot(DATA_BIN)
+                                                             : save_sharded_snapshot()) == 0 ? 0 : -1;
+        storage_mode = mode;
+    }
+    if (rc != 0) { printf("Could not write the data set.\n"); return -1; }
+    printf("Generated %ld registrations, %ld attendance and %ld grade rows over %d courses in %.3fs\n",
+           rows, rows * sems, rows * sems, ncourses, now_seconds() - start);
+    return 0;
+}
+
+/* ---------- Timing ---------- */
+
+typedef struct {
+    Course *course;
+    char roll[MAX_FIELD];
+    char name[MAX_FIELD];
+} Sample;
+
+/* Sort the latencies and print one result line */
+void report(const char *op, double *lat, size_t n) {
+    if (n == 0) return;
+    double total = 0;
+    for (size_t i = 0; i < n; i++) total += lat[i];
+    qsort(lat, n, sizeof *lat, cmp_double);
+    printf("%-24s %9zu %10.3f %12.0f %9.1f %9.1f %9.1f %10.1f\n", op, n, total, n / total,
+           lat[n / 2] * 1e6, lat[n * 9 / 10] * 1e6, lat[n * 99 / 100] * 1e6, lat[n - 1] * 1e6);
+}
+
+/* Formats each row as the aggregate view would, without the terminal */
+void format_row(const Registration *r, size_t waitpos, void *arg) {
+    char line[4 * MAX_FIELD + 64];
+    int n = snprintf(line, sizeof line, "Roll: %s | Name: %s | Email: %s | Year: %s | %zu",
+                     str_of(r->roll), str_of(r->name), str_of(r->email), str_of(r->year), waitpos);
+    *(size_t *)arg += (size_t)n;
+}
+
+int run_benchmark(const char *dir, long ops, long scans, unsigned seed) {
+    if (ops <= 0 || scans <= 0) { printf("--ops and --scans must be positive.\n"); return -1; }
+    if (chdir(dir) != 0) { printf("Could not enter %s.\n", dir); return -1; }
+    double t0 = now_seconds();
+    ensure_base_files();
+    if (load_registry() != 0) return -1;
+    replay_journal();
+    sync_seat_counters();
+    size_t total = 0;
+    for (size_t i = 0; i < registry.count; i++) total += registry.courses[i]->regs.count;
+    printf("Loaded %zu registrations in %zu courses in %.3fs\n", total, registry.count, now_seconds() - t0);
+    if (total == 0) { printf("No registrations to benchmark; run `crs-bench gen` first.\n"); return -1; }
+    verify_report(stdout);
+    printf("\n");
+    memory_report(stdout);
+    printf("\n");
+
+    /* Pick the students up front so lookups are not part of the timings */
+    Rng rng = { seed * 0x9e3779b97f4a7c15ull + 1 };
+    Sample *sample = xrealloc(NULL, ops * sizeof *sample);
+    for (long i = 0; i < ops; i++) {
+        Course *c;
+        do c = registry.courses[rng_next(&rng) % registry.count]; while (c->regs.count == 0);
+        Registration *r = &c->regs.rows[rng_next(&rng) % c->regs.count];
+        sample[i].course = c;
+        copy_field(sample[i].roll, str_of(r->roll));
+        copy_field(sample[i].name, str_of(r->name));
+    }
+    double *lat = xrealloc(NULL, (ops > scans ? ops : scans) * sizeof *lat);
+    char att[MAX_FIELD], grade[MAX_FIELD], value[16];
+    size_t sink = 0;
+
+    printf("%-24s %9s %10s %12s %9s %9s %9s %10s\n", "operation", "count", "total s", "ops/s",
+           "p50 us", "p90 us", "p99 us", "max us");
+    for (long i = 0; i < ops; i++) {
+        double t = now_seconds();
+        CourseCount *cc;
+        sink += course_counts(&cc);
+        free(cc);
+        lat[i] = now_seconds() - t;
+    }
+    report("list courses", lat, ops);
+
+    for (long i = 0; i < ops; i++) {
+        double t = now_seconds();
+        /* an existing roll: exercises the duplicate check, writes nothing */
+        sink += enroll_student(sample[i].course, sample[i].roll, sample[i].name, "", "") == -1;
+        lat[i] = now_seconds() - t;
+    }
+    report("opt-for duplicate check", lat, ops);
+
+    for (long i = 0; i < scans; i++) {
+        double t = now_seconds();
+        for (size_t j = 0; j < registry.count; j++)
+            if (registry.courses[j]->listed) course_roster(registry.courses[j], format_row, &sink);
+        lat[i] = now_seconds() - t;
+    }
+    report("view aggregate", lat, scans);
+
+    for (long i = 0; i < ops; i++) {
+        snprintf(value, sizeof value, "%d", 40 + (int)(rng_next(&rng) % 61));
+        double t = now_seconds();
+        set_sem_value(sample[i].course, 0, sample[i].roll, "sem1", value);
+        lat[i] = now_seconds() - t;
+    }
+    report("attendance upsert", lat, ops);
+
+    for (long i = 0; i < ops; i++) {
+        const char *g = grade_labels[rng_next(&rng) % 8];
+        double t = now_seconds();
+        set_sem_value(sample[i].course, 1, sample[i].roll, "sem1", g);
+        lat[i] = now_seconds() - t;
+    }
+    report("grade upsert", lat, ops);
+
+    for (long i = 0; i < ops; i++) {
+        double t = now_seconds();
+        sink += query_student(sample[i].course, sample[i].roll, "sem1", att, grade);
+        lat[i] = now_seconds() - t;
+    }
+    report("semester view", lat, ops);
+
+    /* an unlisted course with a timetable, credits and a prerequisite:
+       times the validator alone, nobody is enrolled */
+    Course *rules = add_course("bench-rules", 0);
+    set_course_rules(rules, "4", "Mon9-11;Thu14", registry.courses[0]->name);
+    for (long i = 0; i < ops; i++) {
+        int id = intern_find(&strings, sample[i].roll);
+        double t = now_seconds();
+        sink += check_enrollment(rules, id, NULL, 0);
+        lat[i] = now_seconds() - t;
+    }
+    report("enrollment check", lat, ops);
+
+    /* last, since it removes the sampled students (repeats are misses) */
+    for (long i = 0; i < ops; i++) {
+        double t = now_seconds();
+        drop_student(sample[i].course, sample[i].roll);
+        lat[i] = now_seconds() - t;
+    }
+    report("opt-out cascade", lat, ops);
+
+    if (sink == 0) printf("\n");   /* keep the results live */
+    free(sample);
+    free(lat);
+    return compact_journal() == 0 ? 0 : -1;
+}
+
+/* ---------- I/O backends ---------- */
+
+#define IO_ROUNDS 20
+#define IO_FILE_BYTES (64 * 1024)
+
+typedef struct {
+    int id;
+    long appends;
+    double *append_lat, *commit_lat;
+} IoWorker;
+
+/* Journal attendance records and wait for each to be durable, as the
+   server's request threads do */
+void *io_worker(void *arg) {
+    IoWorker *w = arg;
+    for (long i = 0; i < w->appends; i++) {
+        double t = now_seconds();
+        long lsn = journal_append("A,Bench%03d,R%08ld,sem1,%ld\n", w->id, i, 40 + i % 61);
+        w->append_lat[i] = now_seconds() - t;
+        journal_sync(lsn);
+        w->commit_lat[i] = now_seconds() - t;
+    }
+    return NULL;
+}
+
+/* Stage `files` temp files and make them durable together, the way a
+   snapshot save does; returns the elapsed time */
+double io_rewrite_round(int files, const char *block) {
+    FILE **f = xrealloc(NULL, files * sizeof *f);
+    AioOp *ops = xrealloc(NULL, files * sizeof *ops);
+    char name[32];
+    double t = now_seconds();
+    for (int i = 0; i < files; i++) {
+        snprintf(name, sizeof name, "rewrite-%d.tmp", i);
+        f[i] = fopen(name, "w");
+        if (!f[i]) { printf("Could not create %s.\n", name); exit(1); }
+        fwrite(block, 1, IO_FILE_BYTES, f[i]);
+        fflush(f[i]);
+        ops[i] = (AioOp){ .type = AIO_FSYNC, .fd = fileno(f[i]) };
+    }
+    if (aio_run(ops, files) != 0) printf("An fsync failed.\n");
+    for (int i = 0; i < files; i++) fclose(f[i]);
+    t = now_seconds() - t;
+    free(f);
+    free(ops);
+    return t;
+}
+
+int run_io_benchmark(const char *dir, int threads, long appends, int files) {
+    if (threads <= 0 || appends <= 0 || files <= 0) {
+        printf("--threads, --appends and --files must be positive.\n");
+        return -1;
+    }
+    if (enter_dir(dir) != 0 || enter_dir("io-bench") != 0) return -1;
+    size_t total = (size_t)threads * appends;
+    double *append_lat = xrealloc(NULL, total * sizeof *append_lat);
+    double *commit_lat = xrealloc(NULL, total * sizeof *commit_lat);
+    IoWorker *w = xrealloc(NULL, threads * sizeof *w);
+    pthread_t *tid = xrealloc(NULL, threads * sizeof *tid);
+    char *block = xrealloc(NULL, IO_FILE_BYTES);
+    for (int i = 0; i < IO_FILE_BYTES; i++) block[i] = i % 64 == 63 ? '\n' : 'x';
+    double lat[IO_ROUNDS];
+    char label[64];
+    printf("%d threads x %ld journal commits, %d rounds of %d x %d KiB rewrites%s\n\n", threads, appends, IO_ROUNDS,
+           files, IO_FILE_BYTES / 1024, journal_fsync ? "" : " (CRS_FSYNC=off)");
+    printf("%-24s %9s %10s %12s %9s %9s %9s %10s\n", "operation", "count", "total s", "ops/s",
+           "p50 us", "p90 us", "p99 us", "max us");
+    const int backends[] = { AIO_OFF, AIO_THREADS, AIO_URING };
+    for (size_t b = 0; b < sizeof backends / sizeof *backends; b++) {
+        const char *name = aio_backend_name(backends[b]);
+        if (aio_init(name) != backends[b]) { printf("%-24s skipped\n", name); continue; }
+        remove("journal.log");
+        long fsyncs = journal_fsyncs;
+        double t = now_seconds();
+        for (int i = 0; i < threads; i++) {
+            w[i] = (IoWorker){ i, appends, append_lat + (size_t)i * appends, commit_lat + (size_t)i * appends };
+            pthread_create(&tid[i], NULL, io_worker, &w[i]);
+        }
+        for (int i = 0; i < threads; i++) pthread_join(tid[i], NULL);
+        t = now_seconds() - t;
+        snprintf(label, sizeof label, "%s append", name);
+        report(label, append_lat, total);
+        snprintf(label, sizeof label, "%s commit", name);
+        report(label, commit_lat, total);
+        snprintf(label, sizeof label, "%s wall, %ld fsyncs", name, journal_fsyncs - fsyncs);
+        printf("%-24s %9zu %10.3f %12.0f\n", label, total, t, total / t);
+        for (int r = 0; r < IO_ROUNDS; r++) lat[r] = io_rewrite_round(files, block);
+        snprintf(label, sizeof label, "%s rewrite %d", name, files);
+        report(label, lat, IO_ROUNDS);
+    }
+    aio_init("off");
+    remove("journal.log");
+    for (int i = 0; i < files; i++) {
+        snprintf(label, sizeof label, "rewrite-%d.tmp", i);
+        remove(label);
+    }
+    if (chdir("..") == 0) rmdir("io-bench");
+    free(append_lat);
+    free(commit_lat);
+    free(w);
+    free(tid);
+    free(block);
+    return 0;
+}
+
+void usage() {
+    printf("Usage:\n");
+    printf("  crs-bench gen --dir DIR [--rows N] [--courses N] [--sems N] [--seed N]\n");
+    printf("  crs-bench run --dir DIR [--ops N] [--scans N] [--seed N]\n");
+    printf("  crs-bench io --dir DIR [--threads N] [--appends N] [--files N]\n");
+    printf("Set CRS_STORAGE=binary to generate and load %s instead of the CSV files,\n", DATA_BIN);
+    printf("or CRS_STORAGE=sharded for the per-course shards under %s/.\n", SHARD_DIR);
+    printf("Set CRS_AIO=uring or CRS_AIO=threads to run on an async I/O backend.\n");
+}
+
+int main(int argc, char **argv) {
+    const char *mode = getenv("CRS_STORAGE");
+    if (mode && strcmp(mode, "binary") == 0) storage_mode = STORAGE_BINARY;
+    else if (mode && strcmp(mode, "sharded") == 0) storage_mode = STORAGE_SHARDED;
+    const char *sync = getenv("CRS_FSYNC");
+    if (sync && strcmp(sync, "off") == 0) journal_fsync = 0;
+    aio_init(getenv("CRS_AIO"));
+    if (argc < 2) { usage(); return 2; }
+    const char *dir = opt_value(argc, argv, "--dir", "bench-data");
+    unsigned seed = (unsigned)atoi(opt_value(argc, argv, "--seed", "1"));
+    if (strcmp(argv[1], "gen") == 0)
+        return generate_dataset(dir, atol(opt_value(argc, argv, "--rows", "100000")),
+                                atoi(opt_value(argc, argv, "--courses", "50")),
+                                atoi(opt_value(argc, argv, "--sems", "2")), seed) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "run") == 0)
+        return run_benchmark(dir, atol(opt_value(argc, argv, "--ops", "10000")),
+                             atol(opt_value(argc, argv, "--scans", "20")), seed) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "io") == 0)
+        return run_io_benchmark(dir, atoi(opt_value(argc, argv, "--threads", "8")),
+                                atol(opt_value(argc, argv, "--appends", "2000")),
+                                atoi(opt_value(argc, argv, "--files", "16"))) == 0 ? 0 : 1;
+    usage();
+    return 2;
+}
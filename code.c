@@ -1,116 +1,795 @@
-
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "crs_internal.h"
+
+/* ---------- Registration server ----------
+ * `crs serve` keeps the registry in memory and answers a line protocol on
+ * a Unix domain socket. Fields are tab-separated, one request per line:
+ *   LIST                                 OK n, then n lines
+ *                                        course<TAB>enrolled<TAB>capacity<TAB>waitlist
+ *   ENROLL course roll name email year   OK | OK waitlisted | ERR duplicate |
+ *                                        ERR slot-clash | ERR credit-cap | ERR prerequisite |
+ *                                        ERR bad-value
+ *   DROP course roll                     OK | ERR not-enrolled
+ *   ATTEND course roll sem percent       OK | ERR not-enrolled | ERR bad-value
+ *   GRADE course roll sem grade          OK | ERR not-enrolled | ERR bad-value
+ *   QUERY course roll sem                OK enrolled<TAB>attendance<TAB>grade
+ *   FIND roll|email|name-prefix          OK n, then n lines (at most 100)
+ *                                        roll<TAB>name<TAB>email<TAB>course,course*,...
+ *                                        (* = waitlisted)
+ *   STATS [prom]                         OK n, then n lines: a summary table, or
+ *                                        the Prometheus text with "prom"
+ *   BACKUP snapshot|delta dir            OK n | ERR backup n, then n message lines
+ *   COURSE name capacity credits slots prerequisites
+ *                                        OK | ERR exists | ERR bad-value
+ *   ROSTER course                        OK n, then n lines
+ *                                        roll<TAB>name<TAB>email<TAB>year<TAB>waitpos
+ *                                        (waitpos 0 = enrolled)
+ *   TAIL [seq]                           OK, then the change feed from line seq
+ *                                        (default 1) and each new line as it
+ *                                        is written: seq<TAB>unix-ms<TAB>record.
+ *                                        Runs until the client sends anything
+ *                                        or hangs up. ERR busy once
+ *                                        MAX_SUBSCRIBERS are following.
+ *   QUIT
+ * Any request naming an unknown course gets ERR no-such-course, a field
+ * holding a comma (the data files' separator) gets ERR bad-value, and any
+ * ERR token is crs_strerror() of the library call behind the request.
+ * Connections are handed to a fixed pool of worker threads. Changes go
+ * through the per-course locks, so requests for different courses run in
+ * parallel. The metrics are also dumped to a Prometheus text file
+ * (metrics.prom by default) every --metrics-interval seconds. */
+
+#define DEFAULT_SOCKET "crs.sock"
+#define DEFAULT_METRICS "metrics.prom"
+#define FIND_LIMIT 100
+#define DEFAULT_THREADS 8
+#define CONN_QUEUE 256
+#define MAX_SUBSCRIBERS 64   /* TAIL connections, one thread each */
+#define REQUEST_MAX 4096
+
+typedef struct {
+    int fd;
+    char buf[REQUEST_MAX];
+    size_t start, len;
+} LineReader;
+
+/* Read one line into out. Returns 1 on a line, 0 at EOF, -1 on error or
+   a line longer than REQUEST_MAX. */
+int read_line(LineReader *r, char *out, size_t outsz) {
+    for (;;) {
+        char *nl = memchr(r->buf + r->start, '\n', r->len - r->start);
+        if (nl) {
+            size_t n = (size_t)(nl - (r->buf + r->start));
+            if (n >= outsz) return -1;
+            memcpy(out, r->buf + r->start, n);
+            out[n] = '\0';
+            r->start += n + 1;
+            return 1;
+        }
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->len - r->start);
+            r->len -= r->start;
+            r->start = 0;
+        }
+        if (r->len == sizeof r->buf) return -1;
+        ssize_t got = recv(r->fd, r->buf + r->len, sizeof r->buf - r->len, 0);
+        if (got <= 0) return got == 0 ? 0 : -1;
+        r->len += (size_t)got;
+    }
+}
+
+int send_all(int fd, const char *buf, size_t n) {
+    for (size_t off = 0; off < n; ) {
+        ssize_t w = send(fd, buf + off, n - off, MSG_NOSIGNAL);
+        /* the scripted CLI replies on stdout */
+        if (w < 0 && errno == ENOTSOCK) w = write(fd, buf + off, n - off);
+        if (w <= 0) return -1;
+        off += (size_t)w;
+    }
+    return 0;
+}
+
+int send_fmt(int fd, const char *fmt, ...) {
+    char out[REQUEST_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out, sizeof out, fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if ((size_t)n >= sizeof out) n = sizeof out - 1;
+    return send_all(fd, out, (size_t)n);
+}
+
+void serve_list(int fd) {
+    CourseCount *cc;
+    size_t n = course_counts(&cc);
+    send_fmt(fd, "OK %zu\n", n);
+    for (size_t i = 0; i < n; i++)
+        send_fmt(fd, "%s\t%zu\t%d\t%zu\n", cc[i].course->name, cc[i].enrolled,
+                 cc[i].capacity, cc[i].waiting);
+    free(cc);
+}
+
+int serve_query(int fd, const char *course, const char *roll, const char *sem) {
+    char att[MAX_FIELD], grade[MAX_FIELD];
+    int enrolled = crs_query(course, roll, sem, att, grade);
+    if (enrolled < 0) { send_fmt(fd, "ERR %s\n", crs_strerror(enrolled)); return enrolled; }
+    send_fmt(fd, "OK %s\t%s\t%s\n", enrolled ? "enrolled" : "not-enrolled",
+             att[0] ? att : "-", grade[0] ? grade : "-");
+    return CRS_OK;
+}
+
+void serve_stats(int fd, int prom) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    if (!out) { send_fmt(fd, "ERR io\n"); return; }
+    if (prom) metrics_write(out);
+    else metrics_print_summary(out);
+    fclose(out);
+    size_t lines = 0;
+    for (size_t i = 0; i < len; i++) lines += text[i] == '\n';
+    send_fmt(fd, "OK %zu\n", lines);
+    send_all(fd, text, len);
+    free(text);
+}
+
+/* One FIND result line; written to a buffer since the visitor runs
+   under the index lock */
+void format_student(const Student *s, void *arg) {
+    FILE *out = arg;
+    fprintf(out, "%s\t%s\t%s\t", str_of(s->roll), str_of(s->name), str_of(s->email));
+    for (size_t i = 0; i < s->count; i++)
+        fprintf(out, "%s%s%s", i ? "," : "", s->courses[i].course->name, s->courses[i].waiting ? "*" : "");
+    fprintf(out, "\n");
+}
+
+void serve_find(int fd, const char *text) {
+    char *buf = NULL;
+    size_t len = 0, n;
+    FILE *out = open_memstream(&buf, &len);
+    if (!out) { send_fmt(fd, "ERR io\n"); return; }
+    if (strchr(text, '@')) n = find_students_by_email(text, format_student, out);
+    else if ((n = find_student(text, format_student, out)) == 0)
+        n = find_students_by_name(text, FIND_LIMIT, format_student, out);
+    fclose(out);
+    for (size_t i = n = 0; i < len; i++) n += buf[i] == '\n';
+    send_fmt(fd, "OK %zu\n", n);
+    send_all(fd, buf, len);
+    free(buf);
+}
+
+/* Backups run inside the server so they see its live state */
+void serve_backup(int fd, const char *kind, const char *dir) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    if (!out) { send_fmt(fd, "ERR io\n"); return; }
+    int rc = strcmp(kind, "delta") == 0 ? backup_delta(dir, out) : backup_snapshot(dir, out);
+    fclose(out);
+    size_t lines = 0;
+    for (size_t i = 0; i < len; i++) lines += text[i] == '\n';
+    send_fmt(fd, rc == 0 ? "OK %zu\n" : "ERR backup %zu\n", lines);
+    send_all(fd, text, len);
+    free(text);
+}
+
+void format_roster_line(const char *roll, const char *name, const char *email, const char *year,
+                        size_t waitpos, void *arg) {
+    fprintf(arg, "%s\t%s\t%s\t%s\t%zu\n", roll, name, email, year, waitpos);
+}
+
+int serve_roster(int fd, const char *course) {
+    char *buf = NULL;
+    size_t len = 0, n = 0;
+    FILE *out = open_memstream(&buf, &len);
+    if (!out) { send_fmt(fd, "ERR io\n"); return CRS_EIO; }
+    int rc = crs_students(course, format_roster_line, out);
+    fclose(out);
+    if (rc < 0) send_fmt(fd, "ERR %s\n", crs_strerror(rc));
+    else {
+        for (size_t i = 0; i < len; i++) n += buf[i] == '\n';
+        send_fmt(fd, "OK %zu\n", n);
+        send_all(fd, buf, len);
+    }
+    free(buf);
+    return rc < 0 ? rc : CRS_OK;
+}
 
-#define MAX_LINE 512
-#define MAX_FIELD 128
+/* Run one listing, course or change request and send its reply. Returns
+   the CRS_* result. The scripted CLI runs its requests through here as
+   well when no server is up. */
+int serve_op(int fd, char **f, int n) {
+    const char *cmd = f[0];
+    if (strcmp(cmd, "LIST") == 0) { serve_list(fd); return CRS_OK; }
+    if (strcmp(cmd, "ROSTER") == 0 && n > 1) return serve_roster(fd, f[1]);
+    int rc;
+    if (strcmp(cmd, "COURSE") == 0 && n > 5) {
+        rc = crs_add_course(f[1], atoi(f[2]), atoi(f[3]), f[4], f[5]);
+        send_fmt(fd, rc == CRS_OK ? "OK\n" : "ERR %s\n", crs_strerror(rc));
+        return rc;
+    }
+
+    int need = strcmp(cmd, "ENROLL") == 0 ? 6 : strcmp(cmd, "DROP") == 0 ? 3
+             : strcmp(cmd, "QUERY") == 0 ? 4
+             : strcmp(cmd, "ATTEND") == 0 || strcmp(cmd, "GRADE") == 0 ? 5 : 0;
+    if (need == 0 || n < need || strlen(f[2]) == 0) { send_fmt(fd, "ERR bad-request\n"); return CRS_EBADVALUE; }
+
+    if (strcmp(cmd, "QUERY") == 0) return serve_query(fd, f[1], f[2], f[3]);
+    if (strcmp(cmd, "ENROLL") == 0) rc = strlen(f[3]) == 0 ? CRS_EBADVALUE : crs_enroll(f[1], f[2], f[3], f[4], f[5]);
+    else if (strcmp(cmd, "DROP") == 0) rc = crs_drop(f[1], f[2]);
+    else rc = crs_upsert(f[1], strcmp(cmd, "GRADE") == 0, f[2], f[3], f[4]);
+    if (rc == CRS_OK) send_fmt(fd, "OK\n");
+    else if (rc == CRS_WAITLISTED) send_fmt(fd, "OK waitlisted\n");
+    else send_fmt(fd, "ERR %s\n", crs_strerror(rc));
+    return rc;
+}
+
+typedef struct {
+    int fd;
+    long from;
+    size_t len;
+    char buf[65536];   /* lines not yet sent */
+} Subscriber;
 
-/* Utility functions */
-void trim_newline(char *s) {
-    if (!s) return;
-    size_t len = strlen(s);
-    while (len > 0 && (s[len-1] == '\n' || s[len-1] == '\r')) {
-        s[len-1] = '\0'; len--;
+/* feed_fn for TAIL: lines go out in one send per catch-up */
+int send_feed_line(long seq, const char *line, size_t len, void *arg) {
+    Subscriber *s = arg;
+    (void)seq;
+    if (line && s->len + len <= sizeof s->buf) {
+        memcpy(s->buf + s->len, line, len);
+        s->len += len;
+        return 0;
     }
+    if (s->len > 0 && send_all(s->fd, s->buf, s->len) != 0) return 1;
+    s->len = 0;
+    if (line) return send_feed_line(seq, line, len, arg);
+    /* caught up: stop once the subscriber sends anything or hangs up */
+    struct pollfd pfd = { s->fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) != 0;
 }
 
-int file_exists(const char *fname) {
-    FILE *f = fopen(fname, "r");
-    if (!f) return 0;
-    fclose(f);
+atomic_int subscribers;
+
+void *tail_worker(void *arg) {
+    Subscriber *s = arg;
+    if (send_fmt(s->fd, "OK\n") == 0) feed_tail(s->from, 1, send_feed_line, s);
+    close(s->fd);
+    free(s);
+    atomic_fetch_sub(&subscribers, 1);
+    return NULL;
+}
+
+/* A subscriber gets a thread of its own for as long as it stays, so it
+   never holds a pool worker; at most MAX_SUBSCRIBERS at a time. Returns 0
+   once the connection is handed off. */
+int serve_tail(int fd, long from) {
+    if (!feed_active) { send_fmt(fd, "ERR feed-off\n"); return -1; }
+    if (atomic_fetch_add(&subscribers, 1) >= MAX_SUBSCRIBERS) {
+        atomic_fetch_sub(&subscribers, 1);
+        send_fmt(fd, "ERR busy\n");
+        return -1;
+    }
+    Subscriber *s = xrealloc(NULL, sizeof *s);
+    s->fd = fd;
+    s->from = from > 0 ? from : 1;
+    s->len = 0;
+    pthread_t t;
+    if (pthread_create(&t, NULL, tail_worker, s) != 0) {
+        free(s);
+        atomic_fetch_sub(&subscribers, 1);
+        send_fmt(fd, "ERR busy\n");
+        return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+/* Handle one request line. Returns 0 to close the connection, -1 if it
+   has been handed to another thread. */
+int serve_request(int fd, char *line) {
+    char *f[6];
+    int n = split_line(line, f, 6, '\t');
+    const char *cmd = f[0];
+    if (strcmp(cmd, "QUIT") == 0) return 0;
+    if (strcmp(cmd, "STATS") == 0) { serve_stats(fd, n > 1 && strcmp(f[1], "prom") == 0); return 1; }
+    if (strcmp(cmd, "FIND") == 0 && n > 1 && f[1][0]) { serve_find(fd, f[1]); return 1; }
+    if (strcmp(cmd, "BACKUP") == 0 && n > 2 && f[2][0]
+        && (strcmp(f[1], "snapshot") == 0 || strcmp(f[1], "delta") == 0)) {
+        serve_backup(fd, f[1], f[2]);
+        return 1;
+    }
+    if (strcmp(cmd, "TAIL") == 0) return serve_tail(fd, n > 1 ? atol(f[1]) : 1) == 0 ? -1 : 1;
+
+    serve_op(fd, f, n);
     return 1;
 }
 
-void ensure_base_files() {
-    if (!file_exists("courses.txt")) {
-        FILE *f = fopen("courses.txt", "w");
-        if (f) {
-            fprintf(f, "Btech\nBFM\nBBA\nB.com\nBsc\n");
-            fclose(f);
+/* Accepted connections waiting for a worker */
+typedef struct {
+    int fds[CONN_QUEUE];
+    size_t head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty, nonfull;
+} ConnQueue;
+
+ConnQueue conn_queue = { { 0 }, 0, 0, PTHREAD_MUTEX_INITIALIZER,
+                         PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+volatile sig_atomic_t server_stop;
+
+void conn_push(int fd) {
+    pthread_mutex_lock(&conn_queue.lock);
+    while (conn_queue.count == CONN_QUEUE) pthread_cond_wait(&conn_queue.nonfull, &conn_queue.lock);
+    conn_queue.fds[(conn_queue.head + conn_queue.count++) % CONN_QUEUE] = fd;
+    pthread_cond_signal(&conn_queue.nonempty);
+    pthread_mutex_unlock(&conn_queue.lock);
+}
+
+int conn_pop() {
+    pthread_mutex_lock(&conn_queue.lock);
+    while (conn_queue.count == 0) pthread_cond_wait(&conn_queue.nonempty, &conn_queue.lock);
+    int fd = conn_queue.fds[conn_queue.head];
+    conn_queue.head = (conn_queue.head + 1) % CONN_QUEUE;
+    conn_queue.count--;
+    pthread_cond_signal(&conn_queue.nonfull);
+    pthread_mutex_unlock(&conn_queue.lock);
+    return fd;
+}
+
+void *server_worker(void *arg) {
+    (void)arg;
+    LineReader *r = xrealloc(NULL, sizeof *r);
+    char line[REQUEST_MAX];
+    for (;;) {
+        r->fd = conn_pop();
+        r->start = r->len = 0;
+        int got, rc = 1;
+        while ((got = read_line(r, line, sizeof line)) == 1 && (rc = serve_request(r->fd, line)) > 0)
+            ;
+        if (rc < 0) continue;
+        if (got < 0) send_fmt(r->fd, "ERR bad-request\n");
+        close(r->fd);
+    }
+    return NULL;
+}
+
+void on_stop_signal(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+int unix_address(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr->sun_path) {
+        printf("Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+typedef struct {
+    const char *path;
+    int interval;
+} MetricsDumper;
+
+/* Rewrites the metrics file every interval seconds until the server stops */
+void *metrics_dumper(void *arg) {
+    MetricsDumper *d = arg;
+    while (!server_stop) {
+        for (int i = 0; i < d->interval * 5 && !server_stop; i++) poll(NULL, 0, 200);
+        if (metrics_dump(d->path) != 0) printf("Could not write %s.\n", d->path);
+    }
+    return NULL;
+}
+
+int run_server(const char *path, int threads, const char *metrics, int interval) {
+    struct sockaddr_un addr;
+    if (unix_address(&addr, path) != 0) return -1;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0) { printf("Could not create socket.\n"); return -1; }
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof addr) != 0 || listen(lfd, 128) != 0) {
+        printf("Could not listen on %s.\n", path);
+        close(lfd);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    for (int i = 0; i < threads; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, server_worker, NULL) != 0) { printf("Could not start workers.\n"); return -1; }
+        pthread_detach(t);
+    }
+    MetricsDumper dumper = { metrics, interval > 0 ? interval : 10 };
+    pthread_t dumper_tid;
+    pthread_create(&dumper_tid, NULL, metrics_dumper, &dumper);
+    printf("Serving on %s with %d worker threads (Ctrl-C to stop).\n", path, threads);
+    fflush(stdout);
+
+    while (!server_stop) {
+        struct pollfd pfd = { lfd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int cfd = accept(lfd, NULL, NULL);
+        if (cfd >= 0) conn_push(cfd);
+    }
+    close(lfd);
+    unlink(path);
+    pthread_join(dumper_tid, NULL);
+    printf("Stopping after %ld journal fsyncs; compacting journal.\n", journal_fsyncs);
+    int rc = compact_journal();
+    metrics_dump(metrics);
+    return rc;
+}
+
+/* ---------- Load generator ----------
+ * `crs loadgen` opens one connection per client thread against a running
+ * server and issues a mix of enroll (70%), query (20%) and drop (10%)
+ * requests over the listed courses, then reports throughput and latency
+ * percentiles. Rolls are prefixed LG<client>- so runs are easy to spot. */
+
+typedef struct {
+    const char *path;
+    int id, requests;
+    char (*courses)[MAX_FIELD];
+    int ncourses;
+    double *latency;   /* seconds per request */
+    long ok, rejected, errors;   /* OK replies, ERR replies, transport failures */
+} LoadClient;
+
+int connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    if (unix_address(&addr, path) != 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0) { close(fd); return -1; }
+    return fd;
+}
+
+/* Whether a server answers on path */
+int server_running(const char *path) {
+    int fd = connect_unix(path);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+
+void *load_client(void *arg) {
+    LoadClient *lc = arg;
+    int fd = connect_unix(lc->path);
+    if (fd < 0) { lc->errors = lc->requests; return NULL; }
+    LineReader *r = xrealloc(NULL, sizeof *r);
+    r->fd = fd;
+    r->start = r->len = 0;
+    char line[REQUEST_MAX];
+    unsigned seed = (unsigned)lc->id * 7919u + 17u;
+    int enrolled = 0;
+    for (int i = 0; i < lc->requests; i++) {
+        const char *course = lc->courses[rand_r(&seed) % lc->ncourses];
+        int pick = rand_r(&seed) % 10;
+        double t0 = now_seconds();
+        if (pick < 7 || enrolled == 0) {
+            send_fmt(fd, "ENROLL\t%s\tLG%d-%d\tLoad Client %d\tlg%d@example.com\t\n",
+                     course, lc->id, enrolled, lc->id, lc->id);
+            enrolled++;
+        } else if (pick < 9) {
+            send_fmt(fd, "QUERY\t%s\tLG%d-%d\tsem1\n", course, lc->id, rand_r(&seed) % enrolled);
+        } else {
+            send_fmt(fd, "DROP\t%s\tLG%d-%d\n", course, lc->id, rand_r(&seed) % enrolled);
         }
+        if (read_line(r, line, sizeof line) != 1) { lc->errors += lc->requests - i; break; }
+        lc->latency[i] = now_seconds() - t0;
+        if (strncmp(line, "OK", 2) == 0) lc->ok++; else lc->rejected++;
     }
-    if (!file_exists("registrations.csv")) {
-        FILE *f = fopen("registrations.csv", "w");
-        if (f) fclose(f);
+    send_fmt(fd, "QUIT\n");
+    close(fd);
+    free(r);
+    return NULL;
+}
+
+int run_loadgen(const char *path, int clients, int requests) {
+    if (clients <= 0 || requests <= 0) { printf("--clients and --requests must be positive.\n"); return -1; }
+    /* Course names come from the server so the client needs no data files */
+    int fd = connect_unix(path);
+    if (fd < 0) { printf("Could not connect to %s.\n", path); return -1; }
+    LineReader *r = xrealloc(NULL, sizeof *r);
+    r->fd = fd;
+    r->start = r->len = 0;
+    char line[REQUEST_MAX];
+    int ncourses = 0;
+    send_fmt(fd, "LIST\n");
+    if (read_line(r, line, sizeof line) == 1) ncourses = atoi(line + 3);
+    char (*courses)[MAX_FIELD] = xrealloc(NULL, (ncourses + 1) * sizeof *courses);
+    for (int i = 0; i < ncourses && read_line(r, line, sizeof line) == 1; i++) {
+        char *tab = strchr(line, '\t');
+        if (tab) *tab = '\0';
+        snprintf(courses[i], MAX_FIELD, "%.*s", MAX_FIELD - 1, line);
     }
-    if (!file_exists("attendance.csv")) {
-        FILE *f = fopen("attendance.csv", "w");
-        if (f) fclose(f);
+    send_fmt(fd, "QUIT\n");
+    close(fd);
+    free(r);
+    if (ncourses == 0) { printf("Server lists no courses.\n"); free(courses); return -1; }
+
+    LoadClient *lc = xrealloc(NULL, clients * sizeof *lc);
+    pthread_t *tids = xrealloc(NULL, clients * sizeof *tids);
+    double *lat = xrealloc(NULL, (size_t)clients * requests * sizeof *lat);
+    double start = now_seconds();
+    for (int i = 0; i < clients; i++) {
+        lc[i] = (LoadClient){ path, i, requests, courses, ncourses, lat + (size_t)i * requests, 0, 0, 0 };
+        pthread_create(&tids[i], NULL, load_client, &lc[i]);
+    }
+    long ok = 0, rejected = 0, errors = 0;
+    size_t total = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(tids[i], NULL);
+        ok += lc[i].ok;
+        rejected += lc[i].rejected;
+        errors += lc[i].errors;
+        /* only answered requests have a latency; gather them at the front */
+        size_t answered = (size_t)(lc[i].ok + lc[i].rejected);
+        memmove(lat + total, lc[i].latency, answered * sizeof *lat);
+        total += answered;
+    }
+    double elapsed = now_seconds() - start;
+    qsort(lat, total, sizeof *lat, cmp_double);
+    /* duplicates and drops of unknown rolls come back as ERR by design */
+    printf("%d clients x %d requests: %zu in %.3fs = %.0f req/s (%ld ok, %ld rejected, %ld failed)\n",
+           clients, requests, total, elapsed, total / elapsed, ok, rejected, errors);
+    if (total > 0)
+        printf("latency p50 %.1fus  p90 %.1fus  p99 %.1fus  max %.1fus\n",
+               lat[total / 2] * 1e6, lat[total * 9 / 10] * 1e6, lat[total * 99 / 100] * 1e6, lat[total - 1] * 1e6);
+    free(lc); free(tids); free(lat); free(courses);
+    return errors == 0 ? 0 : -1;
+}
+
+/* Have a running server take the backup. Returns -2 if no server is up,
+   so the caller can take it from the files instead. */
+int run_backup_remote(const char *path, const char *kind, const char *dir) {
+    int fd = connect_unix(path);
+    if (fd < 0) return -2;
+    LineReader *r = xrealloc(NULL, sizeof *r);
+    r->fd = fd;
+    r->start = r->len = 0;
+    char line[REQUEST_MAX];
+    send_fmt(fd, "BACKUP\t%s\t%s\n", kind, dir);
+    int got = read_line(r, line, sizeof line) == 1;
+    int ok = got && strncmp(line, "OK ", 3) == 0;
+    long lines = ok ? atol(line + 3) : got && strncmp(line, "ERR backup ", 11) == 0 ? atol(line + 11) : 0;
+    for (long i = 0; i < lines && read_line(r, line, sizeof line) == 1; i++) printf("%s\n", line);
+    send_fmt(fd, "QUIT\n");
+    close(fd);
+    free(r);
+    if (!got) printf("Server did not answer BACKUP.\n");
+    return ok ? 0 : -1;
+}
+
+/* `crs stats`: ask a running server for its metrics. Without a server,
+   print the last metrics file instead. */
+int run_stats(const char *path, const char *metrics, int prom) {
+    int fd = connect_unix(path);
+    if (fd < 0) {
+        FILE *f = fopen(metrics, "r");
+        if (!f) { printf("No server on %s and no %s.\n", path, metrics); return -1; }
+        printf("No server on %s; showing %s.\n", path, metrics);
+        char line[MAX_LINE];
+        while (fgets(line, sizeof line, f)) fputs(line, stdout);
+        fclose(f);
+        return 0;
     }
-    if (!file_exists("grades.csv")) {
-        FILE *f = fopen("grades.csv", "w");
-        if (f) fclose(f);
+    LineReader *r = xrealloc(NULL, sizeof *r);
+    r->fd = fd;
+    r->start = r->len = 0;
+    char line[REQUEST_MAX];
+    send_fmt(fd, prom ? "STATS\tprom\n" : "STATS\n");
+    long lines = read_line(r, line, sizeof line) == 1 && strncmp(line, "OK ", 3) == 0 ? atol(line + 3) : -1;
+    for (long i = 0; i < lines && read_line(r, line, sizeof line) == 1; i++) printf("%s\n", line);
+    send_fmt(fd, "QUIT\n");
+    close(fd);
+    free(r);
+    if (lines < 0) { printf("Server did not answer STATS.\n"); return -1; }
+    return 0;
+}
+
+/* `crs feed`: print the change feed from line `from` on. With follow, keep
+   printing new lines: through a running server's TAIL, which wakes on
+   every batch it writes, or else by polling feed.log. */
+int print_feed_line(long seq, const char *line, size_t len, void *arg) {
+    (void)seq;
+    (void)arg;
+    if (line) fwrite(line, 1, len, stdout);
+    else fflush(stdout);
+    return ferror(stdout) != 0;
+}
+
+int run_feed(const char *path, long from, int follow) {
+    int fd = follow ? connect_unix(path) : -1;
+    if (fd < 0) return feed_tail(from, follow, print_feed_line, NULL);
+    char buf[REQUEST_MAX], c;
+    size_t n = 0;
+    send_fmt(fd, "TAIL\t%ld\n", from);
+    /* byte by byte, so the stream after the reply stays in the socket */
+    while (n < sizeof buf - 1 && read(fd, &c, 1) == 1 && c != '\n') buf[n++] = c;
+    buf[n] = '\0';
+    if (strcmp(buf, "OK") != 0) {
+        printf("Server did not answer TAIL%s%s.\n", n ? ": " : "", buf);
+        close(fd);
+        return -1;
     }
+    ssize_t got;
+    while ((got = read(fd, buf, sizeof buf)) > 0 && fwrite(buf, 1, (size_t)got, stdout) == (size_t)got)
+        fflush(stdout);
+    close(fd);
+    return 0;
+}
+
+/* ---------- Seat reservation benchmark ----------
+ * `crs bench-seats` hammers one synthetic course from many threads, once
+ * with the lock-free reserve_seat() and once with a mutex around a plain
+ * counter, and checks that neither ever holds more seats than capacity.
+ * Each thread alternates between claiming a seat and giving it back, so
+ * with fewer seats than threads the course keeps flipping between full
+ * and not full, which is the contended case. */
+
+typedef struct {
+    Course *course;
+    pthread_mutex_t *lock;   /* NULL: use the lock-free path */
+    int *held;               /* mutex baseline counter */
+    long attempts, granted, oversold;
+} SeatWorker;
+
+void *seat_worker(void *arg) {
+    SeatWorker *w = arg;
+    Course *c = w->course;
+    int holding = 0;
+    for (long i = 0; i < w->attempts; i++) {
+        if (holding) {
+            if (w->lock) {
+                pthread_mutex_lock(w->lock);
+                (*w->held)--;
+                pthread_mutex_unlock(w->lock);
+            } else {
+                release_seat(c);
+            }
+            holding = 0;
+            continue;
+        }
+        int now;
+        if (w->lock) {
+            pthread_mutex_lock(w->lock);
+            if (*w->held < c->capacity) { (*w->held)++; holding = 1; }
+            now = *w->held;
+            pthread_mutex_unlock(w->lock);
+        } else {
+            holding = reserve_seat(c);
+            now = atomic_load(&c->seats);
+        }
+        if (!holding) continue;
+        w->granted++;
+        if (now > c->capacity) w->oversold++;
+    }
+    if (holding) {
+        if (w->lock) {
+            pthread_mutex_lock(w->lock);
+            (*w->held)--;
+            pthread_mutex_unlock(w->lock);
+        } else {
+            release_seat(c);
+        }
+    }
+    return NULL;
+}
+
+/* Runs one pass and prints its line. Returns 0 if the seat count held. */
+int bench_seat_pass(const char *label, int threads, long attempts, int capacity, int use_mutex) {
+    Course course;
+    memset(&course, 0, sizeof course);
+    course.capacity = capacity;
+    atomic_init(&course.seats, 0);
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    int held = 0;
+    SeatWorker *w = xrealloc(NULL, threads * sizeof *w);
+    pthread_t *tids = xrealloc(NULL, threads * sizeof *tids);
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++) {
+        w[i] = (SeatWorker){ &course, use_mutex ? &lock : NULL, &held, attempts, 0, 0 };
+        pthread_create(&tids[i], NULL, seat_worker, &w[i]);
+    }
+    long granted = 0, oversold = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        granted += w[i].granted;
+        oversold += w[i].oversold;
+    }
+    double elapsed = now_seconds() - start;
+    /* every claim was handed back, so the course must end empty */
+    int left = use_mutex ? held : atomic_load(&course.seats);
+    long ops = (long)threads * attempts;
+    printf("%-9s %d threads x %ld ops on %d seats: %.3fs = %.0f ops/s, %ld claims granted%s\n",
+           label, threads, attempts, capacity, elapsed, ops / elapsed, granted,
+           oversold ? ", OVERSOLD" : "");
+    free(w); free(tids);
+    return oversold == 0 && left == 0 ? 0 : -1;
+}
+
+int run_bench_seats(int threads, long attempts, int capacity) {
+    if (threads <= 0 || attempts <= 0 || capacity <= 0) {
+        printf("--threads, --attempts and --capacity must be positive.\n");
+        return -1;
+    }
+    int rc = bench_seat_pass("lock-free", threads, attempts, capacity, 0);
+    rc |= bench_seat_pass("mutex", threads, attempts, capacity, 1);
+    if (rc != 0) printf("Seat count check failed.\n");
+    return rc;
+}
+
+/* Simple function to prompt and get a line */
+void get_input(const char *prompt, char *out, int sz) {
+    printf("%s", prompt);
+    if (!fgets(out, sz, stdin)) { out[0] = '\0'; return; }
+    trim_newline(out);
 }
 
 /* Read and print courses with enrollment counts */
 void list_courses() {
-    FILE *fc = fopen("courses.txt", "r");
-    if (!fc) {
-        printf("No courses found.\n");
-        return;
-    }
-    char line[MAX_LINE];
-    int index = 1;
+    CourseCount *cc;
+    size_t n = course_counts(&cc);
     printf("\nAvailable courses and enrollment counts:\n");
-    while (fgets(line, sizeof line, fc)) {
-        trim_newline(line);
-        if (strlen(line) == 0) continue;
-        /* count enrollment */
-        FILE *fr = fopen("registrations.csv", "r");
-        int count = 0;
-        char rline[MAX_LINE];
-        while (fr && fgets(rline, sizeof rline, fr)) {
-            char *c = strtok(rline, ",");
-            if (c && strcmp(c, line) == 0) count++;
-        }
-        if (fr) fclose(fr);
-        printf("%d. %s  (Enrolled: %d)\n", index++, line, count);
+    for (size_t i = 0; i < n; i++) {
+        Course *c = cc[i].course;
+        if (cc[i].capacity > 0)
+            printf("%d. %s  (Enrolled: %d/%d, Waitlist: %d)", (int)i + 1, c->name,
+                   (int)cc[i].enrolled, cc[i].capacity, (int)cc[i].waiting);
+        else
+            printf("%d. %s  (Enrolled: %d)", (int)i + 1, c->name, (int)cc[i].enrolled);
+        char slots[MAX_LINE];
+        if (c->credits > 0) printf("  %d credits", c->credits);
+        if (format_slots(c->slots, slots, sizeof slots)[0]) printf("  %s", slots);
+        for (size_t p = 0; p < c->nprereqs; p++)
+            printf("%s%s", p == 0 ? "  requires " : ", ", c->prereqs[p]->name);
+        printf("\n");
     }
-    fclose(fc);
+    if (n == 0) printf("No courses found.\n");
+    free(cc);
 }
 
-/* Append registration */
-void opt_for_course() {
-    list_courses();
-    char course[MAX_FIELD], name[MAX_FIELD], roll[MAX_FIELD], email[MAX_FIELD], year[MAX_FIELD];
+/* Prompt for a course number and resolve it against the listing */
+Course *choose_course(const char *prompt) {
     char choiceStr[16];
-    int choice = 0, index = 0;
-
-    /* Let student choose course by NUMBER (easier than typing exact name) */
-    printf("\nEnter course number to opt for: ");
-    if (!fgets(choiceStr, sizeof choiceStr, stdin)) return;
-    choice = atoi(choiceStr);
+    printf("%s", prompt);
+    if (!fgets(choiceStr, sizeof choiceStr, stdin)) return NULL;
+    int choice = atoi(choiceStr);
     if (choice <= 0) {
         printf("Invalid course number.\n");
-        return;
+        return NULL;
     }
+    Course *c = course_by_number(choice);
+    if (!c) printf("No course at that number.\n");
+    return c;
+}
 
-    /* Read courses.txt again and pick the chosen course line */
-    FILE *fc = fopen("courses.txt", "r");
-    if (!fc) {
-        printf("Could not open courses file.\n");
-        return;
-    }
-    char tmp[MAX_LINE];
-    while (fgets(tmp, sizeof tmp, fc)) {
-        trim_newline(tmp);
-        if (strlen(tmp) == 0) continue;
-        index++;
-        if (index == choice) {
-            strncpy(course, tmp, sizeof(course));
-            course[sizeof(course) - 1] = '\0';
-            break;
-        }
-    }
-    fclose(fc);
-    if (index != choice) {
-        printf("No course at that number.\n");
-        return;
-    }
+/* Append registration */
+void opt_for_course() {
+    list_courses();
+    char name[MAX_FIELD], roll[MAX_FIELD], email[MAX_FIELD], year[MAX_FIELD];
+
+    /* Let student choose course by NUMBER (easier than typing exact name) */
+    Course *c = choose_course("\nEnter course number to opt for: ");
+    if (!c) return;
 
     printf("Student full name: ");
     if (!fgets(name, sizeof name, stdin)) return; trim_newline(name);
@@ -127,254 +806,196 @@ void opt_for_course() {
     if (!fgets(year, sizeof year, stdin)) return; trim_newline(year);
 
     /* check duplicate in registrations for this course by roll */
-    FILE *fr = fopen("registrations.csv", "r");
-    char rline[MAX_LINE];
-    while (fr && fgets(rline, sizeof rline, fr)) {
-        char rcourse[MAX_FIELD], rroll[MAX_FIELD];
-        char *p = strtok(rline, ","); if (!p) continue; strncpy(rcourse, p, MAX_FIELD);
-        p = strtok(NULL, ","); if (!p) continue; strncpy(rroll, p, MAX_FIELD);
-        trim_newline(rcourse); trim_newline(rroll);
-        if (strcmp(rcourse, course) == 0 && strcmp(rroll, roll) == 0) {
-            printf("Student with this roll already enrolled in this course.\n");
-            if (fr) fclose(fr);
-            return;
-        }
+    int rc = enroll_student(c, roll, name, email, year);
+    if (rc == -1) {
+        printf("Student with this roll already enrolled or waitlisted in this course.\n");
+        return;
     }
-    if (fr) fclose(fr);
+    if (rc <= -3) {
+        char why[MAX_LINE];
+        check_enrollment(c, intern_find(&strings, roll), why, sizeof why);
+        printf("Cannot enroll: %s.\n", why[0] ? why : rule_name(-2 - rc));
+        return;
+    }
+    if (rc == 1) {
+        printf("%s is full. Student '%s' is #%d on the waitlist.\n", c->name, name,
+               (int)c->waitlist.count);
+        return;
+    }
+    if (rc != 0) { printf("Could not write to journal.\n"); return; }
+    printf("Student '%s' added to %s\n", name, c->name);
+}
 
-    FILE *fw = fopen("registrations.csv", "a");
-    if (!fw) { printf("Could not open registrations file to write.\n"); return; }
-    /* CSV: course,roll,name,email,year */
-    fprintf(fw, "%s,%s,%s,%s,%s\n", course, roll, name, email, year);
-    fclose(fw);
-    printf("Student '%s' added to %s\n", name, course);
+void print_roster_row(const Registration *r, size_t waitpos, void *arg) {
+    (void)arg;
+    if (waitpos == 0)
+        printf("Roll: %s | Name: %s | Email: %s | Year: %s\n", str_of(r->roll), str_of(r->name),
+               str_of(r->email), str_of(r->year));
+    else
+        printf("Waitlist #%zu: Roll: %s | Name: %s\n", waitpos, str_of(r->roll), str_of(r->name));
 }
 
-/* Aggregate and view students by course */
+/* Aggregate and view students by course, sorted and a page at a time */
 void view_students_aggregate() {
-    FILE *fr = fopen("registrations.csv", "r");
-    if (!fr) { printf("No registrations.\n"); return; }
-    char line[MAX_LINE];
-    /* We'll load courses into an array then print students by course */
-    FILE *fc = fopen("courses.txt", "r");
-    if (!fc) { printf("No courses.\n"); fclose(fr); return; }
-    char course[MAX_FIELD];
-    while (fc && fgets(course, sizeof course, fc)) {
-        trim_newline(course);
-        if (strlen(course) == 0) continue;
-        printf("\n--- %s ---\n", course);
-        rewind(fr);
-        int count = 0;
-        while (fgets(line, sizeof line, fr)) {
-            char lcourse[MAX_FIELD], lroll[MAX_FIELD], lname[MAX_FIELD], lemail[MAX_FIELD], lyear[MAX_FIELD];
-            char *p = strtok(line, ","); if (!p) continue; strncpy(lcourse, p, MAX_FIELD);
-            p = strtok(NULL, ","); if (!p) continue; strncpy(lroll, p, MAX_FIELD);
-            p = strtok(NULL, ","); if (!p) continue; strncpy(lname, p, MAX_FIELD);
-            p = strtok(NULL, ","); if (!p) continue; strncpy(lemail, p, MAX_FIELD);
-            p = strtok(NULL, ","); if (!p) continue; strncpy(lyear, p, MAX_FIELD);
-            trim_newline(lcourse); trim_newline(lroll); trim_newline(lname); trim_newline(lemail); trim_newline(lyear);
-            if (strcmp(lcourse, course) == 0) {
-                count++;
-                printf("Roll: %s | Name: %s | Email: %s | Year: %s\n", lroll, lname, lemail, lyear);
-            }
+    if (registry.count == 0) { printf("No courses.\n"); return; }
+    char choice[8], size[16];
+    get_input("Sort students by 1) enrollment order 2) roll 3) name [1]: ", choice, sizeof choice);
+    int order = strcmp(choice, "2") == 0 ? ROSTER_BY_ROLL
+              : strcmp(choice, "3") == 0 ? ROSTER_BY_NAME : ROSTER_ENROLLED;
+    get_input("Students per page (blank for all): ", size, sizeof size);
+    size_t page = atoi(size) > 0 ? (size_t)atoi(size) : 0;
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        if (!c->listed) continue;
+        printf("\n--- %s ---\n", c->name);
+        if (c->regs.count == 0) printf("No students enrolled.\n");
+        size_t offset = 0;
+        for (;;) {
+            size_t total = course_roster_page(c, order, offset, page, print_roster_row, NULL);
+            if (page == 0 || (offset += page) >= total) break;
+            get_input("-- Enter: next page, s: next course, q: stop -- ", choice, sizeof choice);
+            if (strcmp(choice, "s") == 0) break;
+            if (strcmp(choice, "q") == 0) return;
         }
-        if (count == 0) printf("No students enrolled.\n");
     }
-    fclose(fr); fclose(fc);
+}
+
+/* `crs roster`: the same listing, non-interactively */
+int run_roster(const char *course, const char *sort, int pageno, int pagesize) {
+    int order = strcmp(sort, "roll") == 0 ? ROSTER_BY_ROLL
+              : strcmp(sort, "name") == 0 ? ROSTER_BY_NAME : ROSTER_ENROLLED;
+    if (pageno < 1 || pagesize < 0) { printf("--page must be 1 or more.\n"); return -1; }
+    size_t offset = (size_t)(pageno - 1) * pagesize;
+    int shown = 0;
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        if (!c->listed || (course && strcmp(c->name, course) != 0)) continue;
+        printf("--- %s ---\n", c->name);
+        course_roster_page(c, order, offset, pagesize, print_roster_row, NULL);
+        shown++;
+    }
+    if (course && !shown) { printf("No course named '%s'.\n", course); return -1; }
+    return 0;
 }
 
 /* Opt out from a course (remove registration) */
 void opt_out_course() {
     list_courses();
-    char course[MAX_FIELD], roll[MAX_FIELD];
-    char choiceStr[16];
-    int choice = 0, index = 0;
+    char roll[MAX_FIELD];
 
     /* Use course NUMBER (same style as opt_for_course) */
-    printf("\nEnter course number to opt out from: ");
-    if (!fgets(choiceStr, sizeof choiceStr, stdin)) return;
-    choice = atoi(choiceStr);
-    if (choice <= 0) {
-        printf("Invalid course number.\n");
-        return;
-    }
-
-    /* Find that course in courses.txt */
-    FILE *fc = fopen("courses.txt", "r");
-    if (!fc) {
-        printf("Could not open courses file.\n");
-        return;
-    }
-    char tmp[MAX_LINE];
-    while (fgets(tmp, sizeof tmp, fc)) {
-        trim_newline(tmp);
-        if (strlen(tmp) == 0) continue;
-        index++;
-        if (index == choice) {
-            strncpy(course, tmp, sizeof(course));
-            course[sizeof(course) - 1] = '\0';
-            break;
-        }
-    }
-    fclose(fc);
-    if (index != choice) {
-        printf("No course at that number.\n");
-        return;
-    }
+    Course *c = choose_course("\nEnter course number to opt out from: ");
+    if (!c) return;
 
     printf("Enter roll number / ID of student to remove: ");
     if (!fgets(roll, sizeof roll, stdin)) return; trim_newline(roll);
     if (strlen(roll) == 0) { printf("No roll provided.\n"); return; }
 
-    FILE *fr = fopen("registrations.csv", "r");
-    if (!fr) { printf("No registrations file.\n"); return; }
-    FILE *fw = fopen("registrations.tmp", "w");
-    if (!fw) { printf("Could not create temp file.\n"); fclose(fr); return; }
-
-    char line[MAX_LINE];
-    int found = 0;
-    while (fgets(line, sizeof line, fr)) {
-        char lcopy[MAX_LINE]; strcpy(lcopy, line);
-        char *p = strtok(lcopy, ","); if (!p) continue;
-        char lcourse[MAX_FIELD]; strncpy(lcourse, p, MAX_FIELD);
-        p = strtok(NULL, ",");
-        char lroll[MAX_FIELD]; if (p) strncpy(lroll, p, MAX_FIELD); else lroll[0] = '\0';
-        trim_newline(lcourse); trim_newline(lroll);
-        if (strcmp(lcourse, course) == 0 && strcmp(lroll, roll) == 0) {
-            found = 1; /* skip this line (delete) */
-        } else {
-            fputs(line, fw); /* keep */
-        }
+    /* Also removes attendance & grades for that student-course */
+    int rc = drop_student(c, roll);
+    if (rc == -1) {
+        printf("Student not found in that course.\n");
+        return;
     }
-    fclose(fr); fclose(fw);
-    if (found) {
-        remove("registrations.csv");
-        rename("registrations.tmp", "registrations.csv");
-        printf("Student with roll %s removed from %s\n", roll, course);
-
-        /* Also optionally remove attendance & grades for that student-course */
-        /* attendance.csv */
-        FILE *fa = fopen("attendance.csv", "r");
-        FILE *fatmp = fopen("attendance.tmp", "w");
-        if (fa && fatmp) {
-            while (fgets(line, sizeof line, fa)) {
-                char lcopy[MAX_LINE]; strcpy(lcopy, line);
-                char *p = strtok(lcopy, ",");
-                char lcourse[MAX_FIELD]; if (p) strncpy(lcourse, p, MAX_FIELD); else lcourse[0] = '\0';
-                p = strtok(NULL, ",");
-                char lroll[MAX_FIELD]; if (p) strncpy(lroll, p, MAX_FIELD); else lroll[0] = '\0';
-                trim_newline(lcourse); trim_newline(lroll);
-                if (!(strcmp(lcourse, course) == 0 && strcmp(lroll, roll) == 0)) {
-                    fputs(line, fatmp);
-                }
-            }
-            fclose(fa); fclose(fatmp);
-            remove("attendance.csv"); rename("attendance.tmp", "attendance.csv");
-        } else {
-            if (fa) fclose(fa);
-            if (fatmp) fclose(fatmp);
-        }
-        /* grades.csv */
-        FILE *fg = fopen("grades.csv", "r");
-        FILE *fgtmp = fopen("grades.tmp", "w");
-        if (fg && fgtmp) {
-            while (fgets(line, sizeof line, fg)) {
-                char lcopy[MAX_LINE]; strcpy(lcopy, line);
-                char *p = strtok(lcopy, ",");
-                char lcourse[MAX_FIELD]; if (p) strncpy(lcourse, p, MAX_FIELD); else lcourse[0] = '\0';
-                p = strtok(NULL, ",");
-                char lroll[MAX_FIELD]; if (p) strncpy(lroll, p, MAX_FIELD); else lroll[0] = '\0';
-                trim_newline(lcourse); trim_newline(lroll);
-                if (!(strcmp(lcourse, course) == 0 && strcmp(lroll, roll) == 0)) {
-                    fputs(line, fgtmp);
-                }
-            }
-            fclose(fg); fclose(fgtmp);
-            remove("grades.csv"); rename("grades.tmp", "grades.csv");
-        } else {
-            if (fg) fclose(fg);
-            if (fgtmp) fclose(fgtmp);
-        }
+    if (rc < 0) { printf("Could not write to journal.\n"); return; }
+    printf("Student with roll %s removed from %s\n", roll, c->name);
+    if (rc == 1)
+        printf("Student %s moved from the waitlist into %s\n",
+               str_of(c->regs.rows[c->regs.count - 1].roll), c->name);
+}
 
-    } else {
-        remove("registrations.tmp");
-        printf("Student not found in that course.\n");
+#define LOOKUP_LIMIT 20
+
+void print_student(const Student *s, void *arg) {
+    printf("Roll: %s | Name: %s | Email: %s\n", str_of(s->roll), str_of(s->name), str_of(s->email));
+    for (size_t i = 0; i < s->count; i++)
+        printf("    %s%s\n", s->courses[i].course->name, s->courses[i].waiting ? " (waitlisted)" : "");
+}
+
+/* Helpdesk lookup: an email if the text has an '@', else an exact roll,
+   else the start of a name. Returns the number of students found. */
+size_t lookup_students(const char *text, size_t limit) {
+    if (strchr(text, '@')) return find_students_by_email(text, print_student, NULL);
+    if (find_student(text, print_student, NULL)) return 1;
+    size_t n = find_students_by_name(text, limit, print_student, NULL);
+    if (limit > 0 && n > limit) printf("(showing %zu of %zu matches)\n", limit, n);
+    return n;
+}
+
+void find_student_menu() {
+    char text[MAX_FIELD];
+    get_input("Roll number, email, or the start of a name: ", text, sizeof text);
+    if (strlen(text) == 0) { printf("Nothing to search for.\n"); return; }
+    if (lookup_students(text, LOOKUP_LIMIT) == 0) printf("No matching student.\n");
+}
+
+/* Save a sheet and report it; on rejection list every bad row */
+int save_sheet(Course *c, int grades, Sheet *sheet) {
+    const char *what = grades ? "grades" : "attendance values";
+    if (sheet->count == 0) { printf("The sheet is empty.\n"); return -1; }
+    long rc = apply_sheet(c, grades, sheet);
+    if (rc == -2) { printf("File error.\n"); return -1; }
+    if (rc < 0) {
+        for (size_t i = 0; i < sheet->count; i++) {
+            SheetRow *r = &sheet->rows[i];
+            if (r->status != SHEET_OK)
+                printf("Line %ld (%s): %s.\n", r->line, r->roll[0] ? r->roll : "-", sheet_status_text(r->status));
+        }
+        printf("No %s were saved; fix the rows above and enter the sheet again.\n", what);
+        return -1;
     }
+    printf("Saved %ld %s for %s.\n", rc, what, c->name);
+    return 0;
 }
 
-/* Simple function to prompt and get a line */
-void get_input(const char *prompt, char *out, int sz) {
-    printf("%s", prompt);
-    if (!fgets(out, sz, stdin)) { out[0] = '\0'; return; }
-    trim_newline(out);
+/* Attendance or grades for a whole section, from a file or typed in */
+void section_sheet_menu(Course *c) {
+    char kind[8], sem[MAX_FIELD], path[MAX_LINE];
+    get_input("Sheet of 1. attendance or 2. grades: ", kind, sizeof kind);
+    if (strcmp(kind, "1") != 0 && strcmp(kind, "2") != 0) { printf("Invalid option.\n"); return; }
+    get_input("Semester for rows that leave it out (e.g., sem1, blank for none): ", sem, sizeof sem);
+    get_input("Read the sheet from file (blank to type it in): ", path, sizeof path);
+    Sheet sheet = { 0 };
+    if (path[0]) {
+        if (sheet_load(&sheet, path, sem[0] ? sem : NULL) != 0) { printf("Could not open %s.\n", path); return; }
+    } else {
+        printf("Enter one row per line as roll,value or roll,semester,value; a blank line ends the sheet.\n");
+        char line[MAX_LINE];
+        for (long n = 1; fgets(line, sizeof line, stdin) && line[0] != '\n'; n++)
+            sheet_add(&sheet, line, sem[0] ? sem : NULL, n);
+    }
+    save_sheet(c, strcmp(kind, "2") == 0, &sheet);
+    sheet_free(&sheet);
 }
 
 /* Faculty: select course, select student, then update attendance/grades */
 void faculty_menu() {
     printf("\n-- Faculty Menu --\n");
     list_courses();
-    char course[MAX_FIELD];
-    char choiceStr[16];
-    int choice = 0, index = 0;
 
     /* Select course by NUMBER (same style as student options) */
-    printf("\nEnter course number to manage: ");
-    if (!fgets(choiceStr, sizeof choiceStr, stdin)) return;
-    choice = atoi(choiceStr);
-    if (choice <= 0) {
-        printf("Invalid course number.\n");
-        return;
-    }
-
-    /* Resolve course name from courses.txt */
-    FILE *fc = fopen("courses.txt", "r");
-    if (!fc) {
-        printf("Could not open courses file.\n");
-        return;
-    }
-    char tmp[MAX_LINE];
-    while (fgets(tmp, sizeof tmp, fc)) {
-        trim_newline(tmp);
-        if (strlen(tmp) == 0) continue;
-        index++;
-        if (index == choice) {
-            strncpy(course, tmp, sizeof(course));
-            course[sizeof(course) - 1] = '\0';
-            break;
-        }
-    }
-    fclose(fc);
-    if (index != choice) {
-        printf("No course at that number.\n");
-        return;
-    }
+    Course *c = choose_course("\nEnter course number to manage: ");
+    if (!c) return;
 
     /* Show students in course */
-    FILE *fr = fopen("registrations.csv", "r");
-    if (!fr) { printf("No registrations.\n"); return; }
-    char line[MAX_LINE];
-    int foundAny = 0;
-    printf("\nStudents in %s:\n", course);
-    while (fgets(line, sizeof line, fr)) {
-        char lcourse[MAX_FIELD], lroll[MAX_FIELD], lname[MAX_FIELD];
-        char *p = strtok(line, ","); if (!p) continue; strncpy(lcourse, p, MAX_FIELD);
-        p = strtok(NULL, ","); if (!p) continue; strncpy(lroll, p, MAX_FIELD);
-        p = strtok(NULL, ","); if (!p) continue; strncpy(lname, p, MAX_FIELD);
-        trim_newline(lcourse); trim_newline(lroll); trim_newline(lname);
-        if (strcmp(lcourse, course) == 0) {
-            foundAny = 1;
-            printf("Roll: %s | Name: %s\n", lroll, lname);
-        }
-    }
-    fclose(fr);
-    if (!foundAny) { printf("No students enrolled.\n"); return; }
+    printf("\nStudents in %s:\n", c->name);
+    for (size_t j = 0; j < c->regs.count; j++)
+        printf("Roll: %s | Name: %s\n", str_of(c->regs.rows[j].roll), str_of(c->regs.rows[j].name));
+    if (c->regs.count == 0) { printf("No students enrolled.\n"); return; }
+
+    printf("\n1. Manage one student\n");
+    printf("2. Enter a sheet for the whole section\n");
+    char mode[8];
+    get_input("Choice: ", mode, sizeof mode);
+    if (strcmp(mode, "2") == 0) { section_sheet_menu(c); return; }
+    if (strcmp(mode, "1") != 0) { printf("Invalid option.\n"); return; }
 
     char roll[MAX_FIELD];
     get_input("\nEnter roll number of student to manage: ", roll, sizeof roll);
     if (strlen(roll) == 0) { printf("No roll selected.\n"); return; }
 
     while (1) {
-        printf("\nFaculty actions for %s - student %s:\n", course, roll);
+        printf("\nFaculty actions for %s - student %s:\n", c->name, roll);
         printf("1. Update/Add attendance for a semester\n");
         printf("2. Update/Add grade for a semester\n");
         printf("3. View attendance & grades for this student\n");
@@ -385,68 +1006,20 @@ void faculty_menu() {
             char sem[MAX_FIELD], perc[MAX_FIELD];
             get_input("Enter semester (e.g., sem1): ", sem, sizeof sem);
             get_input("Enter attendance percent (e.g., 85): ", perc, sizeof perc);
-            /* read attendance.csv, replace if exists or append */
-            FILE *fa = fopen("attendance.csv", "r");
-            FILE *fatmp = fopen("attendance.tmp", "w");
-            int replaced = 0;
-            if (!fatmp) { if (fa) fclose(fa); printf("File error.\n"); continue; }
-            if (fa) {
-                while (fgets(line, sizeof line, fa)) {
-                    char cp[MAX_LINE]; strcpy(cp, line);
-                    char *p = strtok(cp, ",");
-                    char lcourse[MAX_FIELD]; if (p) strncpy(lcourse, p, MAX_FIELD); else lcourse[0]='\0';
-                    p = strtok(NULL, ","); char lroll[MAX_FIELD]; if (p) strncpy(lroll, p, MAX_FIELD); else lroll[0]='\0';
-                    p = strtok(NULL, ","); char lsem[MAX_FIELD]; if (p) strncpy(lsem, p, MAX_FIELD); else lsem[0]='\0';
-                    trim_newline(lcourse); trim_newline(lroll); trim_newline(lsem);
-                    if (strcmp(lcourse, course) == 0 && strcmp(lroll, roll) == 0 && strcmp(lsem, sem) == 0) {
-                        /* replace */
-                        fprintf(fatmp, "%s,%s,%s,%s\n", course, roll, sem, perc);
-                        replaced = 1;
-                    } else {
-                        fputs(line, fatmp);
-                    }
-                }
-                fclose(fa);
-            }
-            if (!replaced) {
-                fprintf(fatmp, "%s,%s,%s,%s\n", course, roll, sem, perc);
-            }
-            fclose(fatmp);
-            remove("attendance.csv");
-            rename("attendance.tmp", "attendance.csv");
-            printf("Attendance updated for %s, %s, %s = %s\n", course, roll, sem, perc);
+            int rc = set_sem_value(c, 0, roll, sem, perc);
+            if (rc == -1) { printf("Roll %s is not enrolled in %s.\n", roll, c->name); continue; }
+            if (rc == -3) { printf("Attendance must be a percent between 0 and 100.\n"); continue; }
+            if (rc != 0) { printf("File error.\n"); continue; }
+            printf("Attendance updated for %s, %s, %s = %s\n", c->name, roll, sem, perc);
         } else if (strcmp(choice, "2") == 0) {
             char sem[MAX_FIELD], grade[MAX_FIELD];
             get_input("Enter semester (e.g., sem1): ", sem, sizeof sem);
             get_input("Enter grade (e.g., A / 85): ", grade, sizeof grade);
-            FILE *fg = fopen("grades.csv", "r");
-            FILE *fgtmp = fopen("grades.tmp", "w");
-            int replaced = 0;
-            if (!fgtmp) { if (fg) fclose(fg); printf("File error.\n"); continue; }
-            if (fg) {
-                while (fgets(line, sizeof line, fg)) {
-                    char cp[MAX_LINE]; strcpy(cp, line);
-                    char *p = strtok(cp, ",");
-                    char lcourse[MAX_FIELD]; if (p) strncpy(lcourse, p, MAX_FIELD); else lcourse[0]='\0';
-                    p = strtok(NULL, ","); char lroll[MAX_FIELD]; if (p) strncpy(lroll, p, MAX_FIELD); else lroll[0]='\0';
-                    p = strtok(NULL, ","); char lsem[MAX_FIELD]; if (p) strncpy(lsem, p, MAX_FIELD); else lsem[0]='\0';
-                    trim_newline(lcourse); trim_newline(lroll); trim_newline(lsem);
-                    if (strcmp(lcourse, course) == 0 && strcmp(lroll, roll) == 0 && strcmp(lsem, sem) == 0) {
-                        fprintf(fgtmp, "%s,%s,%s,%s\n", course, roll, sem, grade);
-                        replaced = 1;
-                    } else {
-                        fputs(line, fgtmp);
-                    }
-                }
-                fclose(fg);
-            }
-            if (!replaced) {
-                fprintf(fgtmp, "%s,%s,%s,%s\n", course, roll, sem, grade);
-            }
-            fclose(fgtmp);
-            remove("grades.csv");
-            rename("grades.tmp", "grades.csv");
-            printf("Grade updated for %s, %s, %s = %s\n", course, roll, sem, grade);
+            int rc = set_sem_value(c, 1, roll, sem, grade);
+            if (rc == -1) { printf("Roll %s is not enrolled in %s.\n", roll, c->name); continue; }
+            if (rc == -3) { printf("Grade cannot be empty.\n"); continue; }
+            if (rc != 0) { printf("File error.\n"); continue; }
+            printf("Grade updated for %s, %s, %s = %s\n", c->name, roll, sem, grade);
         } else if (strcmp(choice, "3") == 0) {
             /* Ask for CURRENT semester to view */
             char semFilter[MAX_FIELD];
@@ -456,51 +1029,18 @@ void faculty_menu() {
                 continue;
             }
 
+            char att[MAX_FIELD], grade[MAX_FIELD];
+            query_student(c, roll, semFilter, att, grade);
+
             /* print attendance only for that semester */
             printf("\nAttendance records (Semester: %s):\n", semFilter);
-            FILE *fa = fopen("attendance.csv", "r");
-            int any = 0;
-            if (fa) {
-                while (fgets(line, sizeof line, fa)) {
-                    char lcourse[MAX_FIELD], lroll[MAX_FIELD], lsem[MAX_FIELD], lperc[MAX_FIELD];
-                    char cp[MAX_LINE]; strcpy(cp, line);
-                    char *p = strtok(cp, ","); if (!p) continue; strncpy(lcourse, p, MAX_FIELD);
-                    p = strtok(NULL, ","); if (!p) continue; strncpy(lroll, p, MAX_FIELD);
-                    p = strtok(NULL, ","); if (!p) continue; strncpy(lsem, p, MAX_FIELD);
-                    p = strtok(NULL, ","); if (!p) continue; strncpy(lperc, p, MAX_FIELD);
-                    trim_newline(lcourse); trim_newline(lroll); trim_newline(lsem); trim_newline(lperc);
-                    if (strcmp(lcourse, course) == 0 && strcmp(lroll, roll) == 0
-                        && strcmp(lsem, semFilter) == 0) {
-                        any = 1;
-                        printf("Semester: %s | Attendance: %s\n", lsem, lperc);
-                    }
-                }
-                fclose(fa);
-            }
-            if (!any) printf("No attendance records.\n");
+            if (att[0]) printf("Semester: %s | Attendance: %s\n", semFilter, att);
+            else printf("No attendance records.\n");
 
             /* print grades only for that semester */
             printf("\nGrades records (Semester: %s):\n", semFilter);
-            FILE *fg = fopen("grades.csv", "r");
-            any = 0;
-            if (fg) {
-                while (fgets(line, sizeof line, fg)) {
-                    char lcourse[MAX_FIELD], lroll[MAX_FIELD], lsem[MAX_FIELD], lgrade[MAX_FIELD];
-                    char cp[MAX_LINE]; strcpy(cp, line);
-                    char *p = strtok(cp, ","); if (!p) continue; strncpy(lcourse, p, MAX_FIELD);
-                    p = strtok(NULL, ","); if (!p) continue; strncpy(lroll, p, MAX_FIELD);
-                    p = strtok(NULL, ","); if (!p) continue; strncpy(lsem, p, MAX_FIELD);
-                    p = strtok(NULL, ","); if (!p) continue; strncpy(lgrade, p, MAX_FIELD);
-                    trim_newline(lcourse); trim_newline(lroll); trim_newline(lsem); trim_newline(lgrade);
-                    if (strcmp(lcourse, course) == 0 && strcmp(lroll, roll) == 0
-                        && strcmp(lsem, semFilter) == 0) {
-                        any = 1;
-                        printf("Semester: %s | Grade: %s\n", lsem, lgrade);
-                    }
-                }
-                fclose(fg);
-            }
-            if (!any) printf("No grades records.\n");
+            if (grade[0]) printf("Semester: %s | Grade: %s\n", semFilter, grade);
+            else printf("No grades records.\n");
         } else if (strcmp(choice, "4") == 0) {
             break;
         } else {
@@ -512,24 +1052,24 @@ void faculty_menu() {
 /* Administrative: add new course */
 void admin_menu() {
     printf("\n-- Administrative Menu --\n");
+    if (fill_report(stdout) != 0) printf("No enrollment counters yet.\n");
     char course[MAX_FIELD];
     get_input("Enter new course name to add (exact string, e.g. Mtech): ", course, sizeof course);
     if (strlen(course) == 0) { printf("No course provided.\n"); return; }
     /* Check if exists */
-    FILE *fc = fopen("courses.txt", "r");
-    char line[MAX_LINE];
-    while (fc && fgets(line, sizeof line, fc)) {
-        trim_newline(line);
-        if (strcmp(line, course) == 0) {
-            printf("Course already exists.\n");
-            fclose(fc); return;
-        }
+    Course *c = find_course(course);
+    if (c && c->listed) {
+        printf("Course already exists.\n");
+        return;
     }
-    if (fc) fclose(fc);
-    FILE *fw = fopen("courses.txt", "a");
-    if (!fw) { printf("Could not open courses file.\n"); return; }
-    fprintf(fw, "%s\n", course);
-    fclose(fw);
+    char cap[16], credits[16], slots[MAX_FIELD], prereqs[MAX_FIELD];
+    get_input("Seat capacity (blank for unlimited): ", cap, sizeof cap);
+    get_input("Credits (blank for none): ", credits, sizeof credits);
+    get_input("Weekly slots, e.g. Mon9;Wed14-16 (blank for none): ", slots, sizeof slots);
+    get_input("Prerequisite courses, ';'-separated (blank for none): ", prereqs, sizeof prereqs);
+    int rc = crs_add_course(course, atoi(cap), atoi(credits), slots, prereqs);
+    if (rc == CRS_EBADVALUE) { printf("Bad course name, time slots or prerequisites.\n"); return; }
+    if (rc != CRS_OK) { printf("Could not open courses file.\n"); return; }
     printf("Course '%s' added.\n", course);
 }
 
@@ -541,7 +1081,8 @@ void student_menu() {
         printf("2. Opt For A Course\n");
         printf("3. View Students opted for course (aggregate)\n");
         printf("4. Opt out from a course\n");
-        printf("5. Back to role selection\n");
+        printf("5. Find a student's courses (roll, name or email)\n");
+        printf("6. Back to role selection\n");
         char choice[8];
         get_input("Choice: ", choice, sizeof choice);
         if (strcmp(choice, "1") == 0) {
@@ -553,6 +1094,8 @@ void student_menu() {
         } else if (strcmp(choice, "4") == 0) {
             opt_out_course();
         } else if (strcmp(choice, "5") == 0) {
+            find_student_menu();
+        } else if (strcmp(choice, "6") == 0) {
             break;
         } else {
             printf("Invalid option.\n");
@@ -560,9 +1103,270 @@ void student_menu() {
     }
 }
 
+void usage() {
+    printf("Usage:\n");
+    printf("  crs                                   interactive menus\n");
+    printf("  crs enroll --course NAME --roll ROLL --name NAME [--email EMAIL] [--year YEAR]\n");
+    printf("  crs drop --course NAME --roll ROLL\n");
+    printf("  crs attendance|grade --course NAME --roll ROLL --sem SEM --value VALUE\n");
+    printf("  crs query --course NAME --roll ROLL --sem SEM\n");
+    printf("  crs courses | students --course NAME\n");
+    printf("  crs add-course --name NAME [--capacity N] [--credits N] [--slots Mon9;Wed14-16] [--prereqs A;B]\n");
+    printf("      (the above go through a running server; see --socket)\n");
+    printf("  crs import registrations|attendance|grades FILE [--socket PATH]\n");
+    printf("  crs convert csv|bin|shards [--socket PATH]\n");
+    printf("                                        write the data in the given format\n");
+    printf("  crs serve [--socket PATH] [--threads N] [--metrics FILE] [--metrics-interval SEC]\n");
+    printf("  crs stats [--socket PATH] [--prom]        metrics of a running server\n");
+    printf("  crs loadgen [--socket PATH] [--clients N] [--requests N]\n");
+    printf("  crs sheet attendance|grades --course NAME [--sem SEM] FILE\n");
+    printf("      (import, convert, sheet, restore and the menus refuse to run while a\n");
+    printf("      server is up on --socket, default %s)\n", DEFAULT_SOCKET);
+    printf("  crs backup snapshot|delta DIR [--socket PATH]\n");
+    printf("  crs restore DIR [--socket PATH]       rebuild the data from a backup\n");
+    printf("  crs feed [--from SEQ] [--follow] [--socket PATH]\n");
+    printf("                                        changes from line SEQ of feed.log on\n");
+    printf("  crs find TEXT [--limit N]             courses of a roll, or students by email or name prefix\n");
+    printf("  crs fill                              capacity and fill rate per course\n");
+    printf("  crs memstats                          memory used by the loaded data, per record\n");
+    printf("  crs verify                            load time per file and integrity problems found\n");
+    printf("  crs roster [--course NAME] [--sort roll|name] [--page N] [--page-size N]\n");
+    printf("  crs report transcripts|averages|defaulters [--threshold PCT] [--threads N]\n");
+    printf("  crs bench-seats [--threads N] [--attempts N] [--capacity N]\n");
+    printf("Set CRS_STORAGE=binary to load and compact into %s instead of the CSV files,\n", DATA_BIN);
+    printf("or CRS_STORAGE=sharded for one shard per course under %s/ (the default once\n", SHARD_DIR);
+    printf("%s exists; CRS_STORAGE=csv overrides).\n", SHARD_MANIFEST);
+    printf("Set CRS_AIO=uring or CRS_AIO=threads to write the journal and snapshots\n");
+    printf("through the asynchronous I/O backend.\n");
+    printf("Set CRS_FEED=off to stop announcing changes in feed.log.\n");
+    printf("Set CRS_LOAD_THREADS to cap the threads that load the data (default: one per CPU).\n");
+}
+
+/* ---------- Scripted operations ----------
+ * crs enroll|drop|attendance|grade|query|courses|students|add-course take
+ * their arguments as --options and print the server protocol's reply:
+ * "OK", "OK waitlisted" or "ERR <reason>" for a change, "OK n" and n
+ * tab-separated rows for a listing. With a server running the request is
+ * sent to it, since a change made behind its back would be overwritten
+ * at its next compaction; otherwise the data is loaded and the request
+ * run through the same handler (serve_op) against the library API. The
+ * exit status is 0 for OK, 1 for ERR and 2 for bad usage. */
+
+const char *script_ops[] = { "enroll", "drop", "attendance", "grade", "query", "courses",
+                             "students", "add-course", NULL };
+
+int is_script_op(const char *cmd) {
+    for (int i = 0; script_ops[i]; i++)
+        if (strcmp(cmd, script_ops[i]) == 0) return 1;
+    return 0;
+}
+
+/* The protocol request for a scripted operation, or -1 if a required
+   option is missing */
+int op_request(int argc, char **argv, char *req, size_t len) {
+    const char *cmd = argv[1];
+    const char *course = opt_value(argc, argv, "--course", NULL), *roll = opt_value(argc, argv, "--roll", NULL);
+    const char *sem = opt_value(argc, argv, "--sem", NULL), *value = opt_value(argc, argv, "--value", NULL);
+    if (strcmp(cmd, "courses") == 0) { snprintf(req, len, "LIST\n"); return 0; }
+    if (strcmp(cmd, "add-course") == 0) {
+        const char *name = opt_value(argc, argv, "--name", NULL);
+        if (!name) return -1;
+        snprintf(req, len, "COURSE\t%s\t%s\t%s\t%s\t%s\n", name, opt_value(argc, argv, "--capacity", ""),
+                 opt_value(argc, argv, "--credits", ""), opt_value(argc, argv, "--slots", ""),
+                 opt_value(argc, argv, "--prereqs", ""));
+        return 0;
+    }
+    if (!course) return -1;
+    if (strcmp(cmd, "students") == 0) { snprintf(req, len, "ROSTER\t%s\n", course); return 0; }
+    if (!roll) return -1;
+    if (strcmp(cmd, "enroll") == 0) {
+        const char *name = opt_value(argc, argv, "--name", NULL);
+        if (!name) return -1;
+        snprintf(req, len, "ENROLL\t%s\t%s\t%s\t%s\t%s\n", course, roll, name,
+                 opt_value(argc, argv, "--email", ""), opt_value(argc, argv, "--year", ""));
+    } else if (strcmp(cmd, "drop") == 0) {
+        snprintf(req, len, "DROP\t%s\t%s\n", course, roll);
+    } else if (strcmp(cmd, "query") == 0 && sem) {
+        snprintf(req, len, "QUERY\t%s\t%s\t%s\n", course, roll, sem);
+    } else if (sem && value) {
+        snprintf(req, len, "%s\t%s\t%s\t%s\t%s\n", strcmp(cmd, "grade") == 0 ? "GRADE" : "ATTEND",
+                 course, roll, sem, value);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Send a request to a running server and print its reply. Returns -2 if
+   no server is up, else the exit status. */
+int run_op_remote(const char *path, const char *req) {
+    int fd = connect_unix(path);
+    if (fd < 0) return -2;
+    LineReader *r = xrealloc(NULL, sizeof *r);
+    r->fd = fd;
+    r->start = r->len = 0;
+    char line[REQUEST_MAX];
+    send_fmt(fd, "%s", req);
+    int got = read_line(r, line, sizeof line) == 1;
+    int ok = got && strncmp(line, "OK", 2) == 0;
+    if (got) printf("%s\n", line);
+    /* listings carry a row count */
+    long rows = ok && (strncmp(req, "LIST", 4) == 0 || strncmp(req, "ROSTER", 6) == 0) ? atol(line + 3) : 0;
+    for (long i = 0; i < rows && read_line(r, line, sizeof line) == 1; i++) printf("%s\n", line);
+    send_fmt(fd, "QUIT\n");
+    close(fd);
+    free(r);
+    if (!got) printf("ERR no-reply\n");
+    return ok ? 0 : 1;
+}
+
+/* Run a scripted operation on the loaded data */
+int run_op_local(int argc, char **argv) {
+    char req[REQUEST_MAX], *f[6];
+    if (op_request(argc, argv, req, sizeof req) != 0) { usage(); return 2; }
+    req[strcspn(req, "\n")] = '\0';
+    int n = split_line(req, f, 6, '\t');
+    fflush(stdout);
+    return serve_op(STDOUT_FILENO, f, n) < 0 ? 1 : 0;
+}
+
+/* Non-interactive subcommands */
+int run_command(int argc, char **argv) {
+    if (is_script_op(argv[1])) return run_op_local(argc, argv);
+    if (strcmp(argv[1], "import") == 0 && argc >= 4)
+        return import_file(argv[2], argv[3]) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "serve") == 0) {
+        int threads = atoi(opt_value(argc, argv, "--threads", "8"));
+        return run_server(opt_value(argc, argv, "--socket", DEFAULT_SOCKET),
+                          threads > 0 ? threads : DEFAULT_THREADS,
+                          opt_value(argc, argv, "--metrics", DEFAULT_METRICS),
+                          atoi(opt_value(argc, argv, "--metrics-interval", "10"))) == 0 ? 0 : 1;
+    }
+    if (strcmp(argv[1], "sheet") == 0 && argc >= 4) {
+        int grades = strcmp(argv[2], "grades") == 0;
+        Course *c = find_course(opt_value(argc, argv, "--course", ""));
+        if (!grades && strcmp(argv[2], "attendance") != 0) { usage(); return 2; }
+        if (!c || !c->listed) { printf("Unknown course.\n"); return 1; }
+        Sheet sheet = { 0 };
+        const char *sem = opt_value(argc, argv, "--sem", NULL);
+        if (sheet_load(&sheet, argv[argc - 1], sem) != 0) { printf("Could not open %s.\n", argv[argc - 1]); return 1; }
+        int rc = save_sheet(c, grades, &sheet);
+        sheet_free(&sheet);
+        return rc == 0 ? 0 : 1;
+    }
+    if (strcmp(argv[1], "backup") == 0 && argc >= 4) {
+        int delta = strcmp(argv[2], "delta") == 0;
+        if (!delta && strcmp(argv[2], "snapshot") != 0) { usage(); return 2; }
+        return (delta ? backup_delta(argv[3], stdout) : backup_snapshot(argv[3], stdout)) == 0 ? 0 : 1;
+    }
+    if (strcmp(argv[1], "memstats") == 0) { memory_report(stdout); return 0; }
+    if (strcmp(argv[1], "verify") == 0) return verify_report(stdout) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "fill") == 0) return fill_report(stdout) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "find") == 0 && argc >= 3) {
+        if (lookup_students(argv[2], (size_t)atol(opt_value(argc, argv, "--limit", "20"))) > 0) return 0;
+        printf("No matching student.\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "roster") == 0)
+        return run_roster(opt_value(argc, argv, "--course", NULL), opt_value(argc, argv, "--sort", ""),
+                          atoi(opt_value(argc, argv, "--page", "1")),
+                          atoi(opt_value(argc, argv, "--page-size", "0"))) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "report") == 0 && argc >= 3)
+        return run_report(argv[2], atof(opt_value(argc, argv, "--threshold", "75")),
+                          atoi(opt_value(argc, argv, "--threads", "4")), stdout) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "bench-seats") == 0)
+        return run_bench_seats(atoi(opt_value(argc, argv, "--threads", "8")),
+                               atol(opt_value(argc, argv, "--attempts", "1000000")),
+                               atoi(opt_value(argc, argv, "--capacity", "4"))) == 0 ? 0 : 1;
+    if (strcmp(argv[1], "convert") == 0 && argc >= 3) {
+        int rc = -1;
+        const char *wrote = "registrations.csv, attendance.csv, grades.csv";
+        if (strcmp(argv[2], "bin") == 0) {
+            rc = save_binary_snapshot(DATA_BIN);
+            wrote = DATA_BIN;
+        } else if (strcmp(argv[2], "shards") == 0) {
+            rc = save_sharded_snapshot();
+            wrote = SHARD_MANIFEST " and the course shards";
+        } else if (strcmp(argv[2], "csv") == 0) {
+            rc = save_csv_snapshot();
+        } else {
+            usage();
+            return 2;
+        }
+        if (rc != 0) { printf("Conversion failed.\n"); return 1; }
+        printf("Wrote %s.\n", wrote);
+        return 0;
+    }
+    usage();
+    return 2;
+}
+
 /* Main */
-int main() {
-    ensure_base_files();
+int main(int argc, char **argv) {
+    crs_configure();
+    /* the fill view needs only the counter table; without one it is
+       built by the normal startup below */
+    if (argc > 1 && strcmp(argv[1], "fill") == 0 && fill_report(stdout) == 0) return 0;
+    /* stats and the load generator are pure clients and touch no data files */
+    if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+        int prom = argc > 2 && strcmp(argv[argc - 1], "--prom") == 0;
+        return run_stats(opt_value(argc, argv, "--socket", DEFAULT_SOCKET), DEFAULT_METRICS, prom) == 0 ? 0 : 1;
+    }
+    if (argc > 1 && is_script_op(argv[1])) {
+        char req[REQUEST_MAX];
+        if (op_request(argc, argv, req, sizeof req) != 0) { usage(); return 2; }
+        int rc = run_op_remote(opt_value(argc, argv, "--socket", DEFAULT_SOCKET), req);
+        if (rc != -2) return rc;
+    }
+    if (argc > 1 && strcmp(argv[1], "loadgen") == 0)
+        return run_loadgen(opt_value(argc, argv, "--socket", DEFAULT_SOCKET),
+                           atoi(opt_value(argc, argv, "--clients", "8")),
+                           atoi(opt_value(argc, argv, "--requests", "1000"))) == 0 ? 0 : 1;
+    /* the feed is read from feed.log or a running server, not the data */
+    if (argc > 1 && strcmp(argv[1], "feed") == 0) {
+        int follow = 0;
+        for (int i = 2; i < argc; i++) follow |= strcmp(argv[i], "--follow") == 0;
+        return run_feed(opt_value(argc, argv, "--socket", DEFAULT_SOCKET),
+                        atol(opt_value(argc, argv, "--from", "1")), follow) == 0 ? 0 : 1;
+    }
+    /* backups go through a running server (which sees changes in flight),
+       else they are taken from the files after the normal startup */
+    char dir[PATH_MAX];
+    if (argc > 3 && strcmp(argv[1], "backup") == 0) {
+        if (strcmp(argv[2], "snapshot") != 0 && strcmp(argv[2], "delta") != 0) { usage(); return 2; }
+        mkdir(argv[3], 0755);
+        if (!realpath(argv[3], dir)) { printf("Could not open %s.\n", argv[3]); return 1; }
+        int rc = run_backup_remote(opt_value(argc, argv, "--socket", DEFAULT_SOCKET), argv[2], dir);
+        if (rc != -2) return rc == 0 ? 0 : 1;
+        argv[3] = dir;
+    }
+    /* the menus, sheets, imports, conversions and restores change the data
+       files behind a server's back, and its next compaction (from its
+       memory) would undo them */
+    if (argc == 1 || strcmp(argv[1], "sheet") == 0 || strcmp(argv[1], "import") == 0
+        || strcmp(argv[1], "convert") == 0 || strcmp(argv[1], "restore") == 0) {
+        const char *path = opt_value(argc, argv, "--socket", DEFAULT_SOCKET);
+        if (server_running(path)) {
+            printf("A server is running on %s; stop it before %s.\n", path,
+                   argc == 1 ? "using the menus" : strcmp(argv[1], "sheet") == 0 ? "entering a sheet"
+                   : strcmp(argv[1], "import") == 0 ? "importing" : strcmp(argv[1], "convert") == 0 ? "converting"
+                   : "restoring");
+            return 1;
+        }
+    }
+    if (argc >= 3 && strcmp(argv[1], "restore") == 0) {
+        if (!realpath(argv[2], dir)) { printf("Could not open %s.\n", argv[2]); return 1; }
+        ensure_base_files();
+        return restore_backup(dir, stdout) == 0 ? 0 : 1;
+    }
+    if (crs_init(NULL) != CRS_OK) return 1;
+    if (argc > 1) {
+        int rc = run_command(argc, argv);
+        /* the server keeps its own metrics file up to date, and a running
+           one owns it (crs stats falls back to it) */
+        if (strcmp(argv[1], "serve") != 0 && !server_running(DEFAULT_SOCKET)) metrics_dump(DEFAULT_METRICS);
+        return rc;
+    }
     printf("=== Simple Course Registration System (C) ===\n");
     while (1) {
         printf("\nSelect role:\n");
@@ -579,6 +1383,8 @@ int main() {
         } else if (strcmp(role, "3") == 0) {
             admin_menu();
         } else if (strcmp(role, "4") == 0) {
+            if (compact_journal() != 0) printf("Could not compact journal.\n");
+            metrics_dump(DEFAULT_METRICS);
             printf("Exiting program. Goodbye!\n");
             break;
         } else {
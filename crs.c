@@ -0,0 +1,5154 @@
+/* Course registration core: the in-memory registry, its storage formats,
+   the journal and the change API shared by the menus, the server and the
+   benchmark. Declared in crs_internal.h; crs.h is the public API. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "crs_internal.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Utility functions */
+void trim_newline(char *s) {
+    if (!s) return;
+    size_t len = strlen(s);
+    while (len > 0 && (s[len-1] == '\n' || s[len-1] == '\r')) {
+        s[len-1] = '\0'; len--;
+    }
+}
+
+int file_exists(const char *fname) {
+    FILE *f = fopen(fname, "r");
+    metric_add(METRIC_OPENS, 1);
+    if (!f) return 0;
+    fclose(f);
+    return 1;
+}
+
+void recover_snapshot();
+
+void ensure_base_files() {
+    /* finish or discard a snapshot commit interrupted by a crash */
+    recover_snapshot();
+    if (!file_exists("courses.txt")) {
+        FILE *f = fopen("courses.txt", "w");
+        if (f) {
+            fprintf(f, "Btech\nBFM\nBBA\nB.com\nBsc\n");
+            fclose(f);
+        }
+    }
+    if (!file_exists("registrations.csv")) {
+        FILE *f = fopen("registrations.csv", "w");
+        if (f) fclose(f);
+    }
+    if (!file_exists("waitlist.csv")) {
+        FILE *f = fopen("waitlist.csv", "w");
+        if (f) fclose(f);
+    }
+    if (!file_exists("attendance.csv")) {
+        FILE *f = fopen("attendance.csv", "w");
+        if (f) fclose(f);
+    }
+    if (!file_exists("grades.csv")) {
+        FILE *f = fopen("grades.csv", "w");
+        if (f) fclose(f);
+    }
+}
+
+/* Copy at most MAX_FIELD-1 chars and always terminate */
+void copy_field(char *dst, const char *src) {
+    strncpy(dst, src ? src : "", MAX_FIELD);
+    dst[MAX_FIELD - 1] = '\0';
+}
+
+/* A value that would split or end a journal or CSV record */
+int bad_field(const char *s) {
+    return s && strpbrk(s, ",\n") != NULL;
+}
+
+void *xrealloc(void *p, size_t size) {
+    void *q = realloc(p, size);
+    if (!q) {
+        printf("Out of memory.\n");
+        exit(1);
+    }
+    return q;
+}
+
+/* ---------- Metrics ----------
+ * Each operation runs inside a metric scope that records its latency in a
+ * log2 histogram (1us .. ~16s). While a scope is open, file opens, bytes
+ * read and written, and rows scanned on that thread are charged to its
+ * operation; anything outside a scope counts as "other". All counters are
+ * atomics, so the server's workers update them without a lock.
+ * metrics_write() renders them in Prometheus text format. */
+
+const char *metric_op_names[OP_COUNT] = {
+    "other", "load", "enroll", "drop", "attendance", "grade", "list",
+    "aggregate", "query", "compact", "import", "report"
+};
+const char *metric_kind_names[METRIC_KINDS] = {
+    "crs_file_opens_total", "crs_bytes_read_total", "crs_bytes_written_total", "crs_rows_scanned_total"
+};
+const char *metric_kind_help[METRIC_KINDS] = {
+    "Files opened.", "Bytes read from data files.", "Bytes written to data files.",
+    "Rows read from files or visited in memory."
+};
+
+atomic_long metric_hist[OP_COUNT][METRIC_BUCKETS];
+atomic_long metric_count[OP_COUNT];
+atomic_llong metric_nanos[OP_COUNT];
+atomic_llong metric_totals[OP_COUNT][METRIC_KINDS];
+_Thread_local int metric_current = OP_OTHER;
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+MetricScope metric_begin(int op) {
+    MetricScope m = { op, metric_current, now_seconds() };
+    metric_current = op;
+    return m;
+}
+
+void metric_end(MetricScope *m) {
+    double us = (now_seconds() - m->start) * 1e6;
+    int b = 0;
+    while (b < METRIC_BUCKETS - 1 && us > (double)(1L << b)) b++;
+    atomic_fetch_add(&metric_hist[m->op][b], 1);
+    atomic_fetch_add(&metric_count[m->op], 1);
+    atomic_fetch_add(&metric_nanos[m->op], (long long)(us * 1000));
+    metric_current = m->outer;
+}
+
+/* Charge n units of a METRIC_* kind to the current operation */
+void metric_add(int kind, long long n) {
+    atomic_fetch_add(&metric_totals[metric_current][kind], n);
+}
+
+/* Prometheus text exposition of every counter */
+void metrics_write(FILE *out) {
+    fprintf(out, "# HELP crs_op_duration_seconds Latency of registry operations.\n");
+    fprintf(out, "# TYPE crs_op_duration_seconds histogram\n");
+    for (int op = 0; op < OP_COUNT; op++) {
+        long cum = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cum += atomic_load(&metric_hist[op][b]);
+            if (b == METRIC_BUCKETS - 1)
+                fprintf(out, "crs_op_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %ld\n", metric_op_names[op], cum);
+            else
+                fprintf(out, "crs_op_duration_seconds_bucket{op=\"%s\",le=\"%g\"} %ld\n",
+                        metric_op_names[op], (double)(1L << b) / 1e6, cum);
+        }
+        fprintf(out, "crs_op_duration_seconds_sum{op=\"%s\"} %.9f\n", metric_op_names[op],
+                atomic_load(&metric_nanos[op]) / 1e9);
+        fprintf(out, "crs_op_duration_seconds_count{op=\"%s\"} %ld\n", metric_op_names[op],
+                atomic_load(&metric_count[op]));
+    }
+    for (int k = 0; k < METRIC_KINDS; k++) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", metric_kind_names[k], metric_kind_help[k],
+                metric_kind_names[k]);
+        for (int op = 0; op < OP_COUNT; op++)
+            fprintf(out, "%s{op=\"%s\"} %lld\n", metric_kind_names[k], metric_op_names[op],
+                    atomic_load(&metric_totals[op][k]));
+    }
+}
+
+/* Write the metrics to fname through a temp file, so a scraper never
+   reads a half-written file */
+int metrics_dump(const char *fname) {
+    char tmpname[MAX_FIELD];
+    snprintf(tmpname, sizeof tmpname, "%s.tmp", fname);
+    FILE *f = fopen(tmpname, "w");
+    if (!f) return -1;
+    metrics_write(f);
+    if (fclose(f) != 0) { remove(tmpname); return -1; }
+    return rename(tmpname, fname);
+}
+
+/* Human-readable summary for `crs stats` */
+void metrics_print_summary(FILE *out) {
+    fprintf(out, "%-11s %9s %10s %10s %10s %8s %12s %12s %10s\n", "operation", "count", "mean us",
+            "p50 us<=", "p99 us<=", "opens", "bytes read", "bytes written", "rows");
+    for (int op = 0; op < OP_COUNT; op++) {
+        long n = atomic_load(&metric_count[op]);
+        long long io[METRIC_KINDS];
+        for (int k = 0; k < METRIC_KINDS; k++) io[k] = atomic_load(&metric_totals[op][k]);
+        if (n == 0 && io[METRIC_OPENS] == 0 && io[METRIC_ROWS] == 0) continue;
+        /* percentiles as the upper bound of the bucket they fall in */
+        long p50 = n ? -1 : 0, p99 = n ? -1 : 0, cum = 0;
+        for (int b = 0; b < METRIC_BUCKETS && n > 0; b++) {
+            cum += atomic_load(&metric_hist[op][b]);
+            if (p50 < 0 && cum * 2 >= n) p50 = 1L << b;
+            if (p99 < 0 && cum * 100 >= n * 99) p99 = 1L << b;
+        }
+        fprintf(out, "%-11s %9ld %10.1f %10ld %10ld %8lld %12lld %12lld %10lld\n", metric_op_names[op], n,
+                n ? atomic_load(&metric_nanos[op]) / 1e3 / n : 0.0, p50, p99,
+                io[METRIC_OPENS], io[METRIC_READ], io[METRIC_WRITTEN], io[METRIC_ROWS]);
+    }
+}
+
+/* Value of --name in argv, or def */
+const char *opt_value(int argc, char **argv, const char *name, const char *def) {
+    for (int i = 2; i + 1 < argc; i++)
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    return def;
+}
+
+/* Split a line in place on delim, keeping empty fields */
+int split_line(char *line, char **fields, int max, char delim) {
+    int n = 0;
+    trim_newline(line);
+    char *p = line;
+    while (n < max) {
+        fields[n++] = p;
+        char *sep = strchr(p, delim);
+        if (!sep) break;
+        *sep = '\0';
+        p = sep + 1;
+    }
+    return n;
+}
+
+/* ---------- Memory-mapped record scanner ----------
+ * Data files are mapped read-only and split into lines and fields without
+ * copying: each field is a (pointer, length) view into the mapping. Lines
+ * have no length limit; only the stored field is capped at MAX_FIELD. */
+
+/* First `delim` or newline in [p, end), or end. Compares 16 bytes at a
+   time when SSE2 is available. */
+const char *find_sep(const char *p, const char *end, char delim) {
+#if defined(__SSE2__)
+    __m128i vd = _mm_set1_epi8(delim), vn = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vd), _mm_cmpeq_epi8(v, vn)));
+        if (m) return p + __builtin_ctz(m);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != delim && *p != '\n') p++;
+    return p;
+}
+
+/* Returns 0 on success (a missing or empty file scans as empty), -1 on error */
+int scanner_open(CsvScanner *s, const char *path) {
+    memset(s, 0, sizeof *s);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    metric_add(METRIC_OPENS, 1);
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return -1; }
+    if (st.st_size > 0) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) { close(fd); return -1; }
+        madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+        s->data = m;
+        s->size = (size_t)st.st_size;
+        metric_add(METRIC_READ, (long long)s->size);
+    }
+    close(fd);
+    s->pos = s->data;
+    s->end = s->data + s->size;
+    return 0;
+}
+
+void scanner_close(CsvScanner *s) {
+    metric_add(METRIC_ROWS, s->line_no);
+    if (s->data) munmap(s->data, s->size);
+    memset(s, 0, sizeof *s);
+}
+
+/* Split the next non-empty line into at most `max` fields (extra fields
+   are ignored). Pass '\n' as delim to take the whole line as one field.
+   Returns the field count, or 0 at end of file. */
+int scanner_next(CsvScanner *s, StrView *fields, int max, char delim) {
+    while (s->pos < s->end) {
+        const char *p = s->pos;
+        int n = 0;
+        s->line_no++;
+        for (;;) {
+            const char *q = find_sep(p, s->end, delim);
+            if (n < max) {
+                fields[n].ptr = p;
+                fields[n].len = (size_t)(q - p);
+                n++;
+            }
+            if (q == s->end || *q == '\n') {
+                s->pos = q == s->end ? q : q + 1;
+                break;
+            }
+            p = q + 1;
+        }
+        /* CRLF files: drop the \r from the last field */
+        StrView *last = &fields[n - 1];
+        if (last->len > 0 && last->ptr[last->len - 1] == '\r') last->len--;
+        if (n == 1 && last->len == 0) continue;
+        return n;
+    }
+    return 0;
+}
+
+/* Copy a view into a MAX_FIELD buffer, truncating like copy_field */
+void view_copy(char *dst, StrView v) {
+    size_t len = v.len < MAX_FIELD - 1 ? v.len : MAX_FIELD - 1;
+    memcpy(dst, v.ptr, len);
+    dst[len] = '\0';
+}
+
+/* Copy the first n views into terminated buffers; missing fields are empty */
+void views_to_fields(const StrView *v, int n, char out[][MAX_FIELD], int want) {
+    for (int i = 0; i < want; i++) {
+        if (i < n) view_copy(out[i], v[i]);
+        else out[i][0] = '\0';
+    }
+}
+
+/* ---------- Asynchronous I/O ----------
+ * An optional backend that runs batches of writes, fsyncs and read-ahead
+ * hints concurrently, selected with CRS_AIO:
+ *   off       every call blocks the caller in turn (the default)
+ *   threads   a small pool of I/O threads runs the batch in parallel
+ *   uring     one io_uring submission for the whole batch, reaped together
+ * The ring is driven through the raw syscalls, so there is no library
+ * dependency; if the kernel refuses io_uring the thread pool is used.
+ * aio_run() takes ops with `link` set as a chain: the next op starts only
+ * once this one has succeeded (a journal write and its fdatasync). Chains
+ * run in order, separate chains run concurrently. It returns once every op
+ * has finished, so the concurrency is within a batch; the journal uses a
+ * flusher thread on top of it to keep request threads off the disk. */
+
+#define AIO_RING_ENTRIES 64
+#define AIO_POOL_THREADS 4
+
+int aio_backend = AIO_OFF;
+
+const char *aio_backend_name(int backend) {
+    return backend == AIO_URING ? "uring" : backend == AIO_THREADS ? "threads" : "off";
+}
+
+/* One op, blocking; the result follows the AioOp convention */
+int aio_exec(const AioOp *op) {
+    size_t done = 0;
+    int rc;
+    switch (op->type) {
+    case AIO_WRITE:
+        while (done < op->len) {
+            ssize_t n = pwrite(op->fd, (const char *)op->buf + done, op->len - done, op->off + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return n < 0 ? -errno : -EIO;
+            done += (size_t)n;
+        }
+        return (int)done;
+    case AIO_FSYNC:
+        return fsync(op->fd) == 0 ? 0 : -errno;
+    case AIO_DATASYNC:
+        return fdatasync(op->fd) == 0 ? 0 : -errno;
+    case AIO_FADVISE:
+        rc = posix_fadvise(op->fd, 0, 0, POSIX_FADV_WILLNEED);
+        return -rc;
+    }
+    return -EINVAL;
+}
+
+/* Run a chain in order; the ops after a failure are cancelled */
+void aio_exec_chain(AioOp *ops, size_t n) {
+    int failed = 0;
+    for (size_t i = 0; i < n; i++) {
+        ops[i].result = failed ? -ECANCELED : aio_exec(&ops[i]);
+        if (ops[i].result < 0) failed = 1;
+    }
+}
+
+/* Length of the chain starting at ops[0] */
+size_t aio_chain_len(const AioOp *ops, size_t n) {
+    size_t len = 1;
+    while (len < n && ops[len - 1].link) len++;
+    return len;
+}
+
+/* Thread pool backend: each chain is a job */
+typedef struct AioJob {
+    AioOp *ops;
+    size_t n;
+    size_t *pending;        /* jobs of the batch still running */
+    struct AioJob *next;
+} AioJob;
+
+struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    AioJob *head, *tail;
+    int started;
+} aio_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0 };
+
+void *aio_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&aio_pool.lock);
+    for (;;) {
+        while (!aio_pool.head) pthread_cond_wait(&aio_pool.work, &aio_pool.lock);
+        AioJob *j = aio_pool.head;
+        aio_pool.head = j->next;
+        if (!aio_pool.head) aio_pool.tail = NULL;
+        pthread_mutex_unlock(&aio_pool.lock);
+        aio_exec_chain(j->ops, j->n);
+        pthread_mutex_lock(&aio_pool.lock);
+        (*j->pending)--;
+        pthread_cond_broadcast(&aio_pool.done);
+    }
+    return NULL;
+}
+
+int aio_pool_start() {
+    pthread_mutex_lock(&aio_pool.lock);
+    for (; aio_pool.started < AIO_POOL_THREADS; aio_pool.started++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, aio_worker, NULL) != 0) break;
+        pthread_detach(t);
+    }
+    int rc = aio_pool.started > 0 ? 0 : -1;
+    pthread_mutex_unlock(&aio_pool.lock);
+    return rc;
+}
+
+void aio_pool_run(AioOp *ops, size_t n) {
+    AioJob *jobs = xrealloc(NULL, n * sizeof *jobs);
+    size_t njobs = 0, pending = 0;
+    for (size_t i = 0; i < n; i += jobs[njobs++].n)
+        jobs[njobs] = (AioJob){ &ops[i], aio_chain_len(&ops[i], n - i), &pending, NULL };
+    pthread_mutex_lock(&aio_pool.lock);
+    for (size_t i = 0; i < njobs; i++) {
+        if (aio_pool.tail) aio_pool.tail->next = &jobs[i];
+        else aio_pool.head = &jobs[i];
+        aio_pool.tail = &jobs[i];
+    }
+    pending = njobs;
+    pthread_cond_broadcast(&aio_pool.work);
+    while (pending > 0) pthread_cond_wait(&aio_pool.done, &aio_pool.lock);
+    pthread_mutex_unlock(&aio_pool.lock);
+    free(jobs);
+}
+
+/* io_uring backend: the rings are shared with the kernel through mmap.
+   One batch is in flight at a time, so the submission queue is empty
+   whenever a batch starts and every completion belongs to it. */
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    pthread_mutex_t lock;
+} Uring;
+
+Uring aio_ring = { -1 };
+
+int uring_open(Uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return -1;
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (single && r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    r->cq_ptr = single ? r->sq_ptr
+                       : mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED || r->sqes == MAP_FAILED) {
+        int err = errno;
+        if (r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_len);
+        if (!single && r->cq_ptr != MAP_FAILED) munmap(r->cq_ptr, r->cq_len);
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    r->fd = fd;
+    pthread_mutex_init(&r->lock, NULL);
+    return 0;
+}
+
+int uring_enter(Uring *r, unsigned submit, unsigned wait) {
+    int n;
+    do n = (int)syscall(__NR_io_uring_enter, r->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+    return n;
+}
+
+/* Submit up to r->entries ops and wait for all of them */
+void uring_run(Uring *r, AioOp *ops, size_t n) {
+    unsigned tail = *r->sq_tail, mask = *r->sq_mask;
+    for (size_t i = 0; i < n; i++) {
+        AioOp *op = &ops[i];
+        unsigned idx = tail++ & mask;
+        struct io_uring_sqe *sqe = &r->sqes[idx];
+        memset(sqe, 0, sizeof *sqe);
+        sqe->fd = op->fd;
+        sqe->user_data = i;
+        switch (op->type) {
+        case AIO_WRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uintptr_t)op->buf;
+            sqe->len = (unsigned)op->len;
+            sqe->off = (uint64_t)op->off;
+            break;
+        case AIO_FSYNC:
+        case AIO_DATASYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = op->type == AIO_DATASYNC ? IORING_FSYNC_DATASYNC : 0;
+            break;
+        case AIO_FADVISE:
+            sqe->opcode = IORING_OP_FADVISE;
+            sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+            break;
+        }
+        if (op->link && i + 1 < n) sqe->flags |= IOSQE_IO_LINK;
+        r->sq_array[idx] = idx;
+        op->result = -ECANCELED;
+    }
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    /* the kernel may take fewer entries than offered; keep submitting */
+    int submitted = 0, k;
+    while ((size_t)submitted < n && (k = uring_enter(r, (unsigned)(n - (size_t)submitted), 0)) > 0)
+        submitted += k;
+    if ((size_t)submitted < n) {
+        /* take back what never reached the kernel; it runs blocking below,
+           once the submitted part has completed */
+        __atomic_store_n(r->sq_tail, *r->sq_head, __ATOMIC_RELEASE);
+    }
+    unsigned head = *r->cq_head;
+    for (int got = 0; got < submitted; ) {
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            if (uring_enter(r, 0, (unsigned)(submitted - got)) < 0) break;
+            continue;
+        }
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        if (cqe->user_data < n) ops[cqe->user_data].result = cqe->res;
+        head++;
+        got++;
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    for (size_t i = (size_t)submitted; i < n;) {
+        size_t chain = aio_chain_len(&ops[i], n - i);
+        /* the rest of a chain whose submitted head failed stays cancelled,
+           and after a short write uring_fixup() runs it */
+        AioOp *prev = i > 0 && ops[i - 1].link ? &ops[i - 1] : NULL;
+        if (!prev || (prev->result >= 0 && (prev->type != AIO_WRITE || (size_t)prev->result >= prev->len)))
+            aio_exec_chain(&ops[i], chain);
+        i += chain;
+    }
+}
+
+/* A short write completes with fewer bytes and breaks its chain: finish
+   it and rerun what was linked after it */
+void uring_fixup(AioOp *ops, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        AioOp *op = &ops[i];
+        if (op->type != AIO_WRITE || op->result < 0 || (size_t)op->result >= op->len) continue;
+        AioOp rest = *op;
+        rest.buf = (const char *)op->buf + op->result;
+        rest.len -= (size_t)op->result;
+        rest.off += op->result;
+        int r = aio_exec(&rest);
+        op->result = r < 0 ? r : (int)op->len;
+        if (op->link && i + 1 < n) aio_exec_chain(&ops[i + 1], aio_chain_len(&ops[i + 1], n - i - 1));
+    }
+}
+
+/* Run a batch on the active backend; 0 if every op succeeded */
+int aio_run(AioOp *ops, size_t n) {
+    if (n == 0) return 0;
+    if (aio_backend == AIO_URING) {
+        pthread_mutex_lock(&aio_ring.lock);
+        /* fill the ring without splitting a chain */
+        for (size_t i = 0; i < n; ) {
+            size_t len = aio_chain_len(&ops[i], n - i);
+            /* a chain the ring cannot hold runs blocking */
+            if (len > aio_ring.entries) {
+                aio_exec_chain(&ops[i], len);
+                i += len;
+                continue;
+            }
+            len = 0;
+            while (i + len < n && len < aio_ring.entries) {
+                size_t chain = aio_chain_len(&ops[i + len], n - i - len);
+                if (len > 0 && len + chain > aio_ring.entries) break;
+                len += chain;
+            }
+            uring_run(&aio_ring, &ops[i], len);
+            uring_fixup(&ops[i], len);
+            i += len;
+        }
+        pthread_mutex_unlock(&aio_ring.lock);
+    } else if (aio_backend == AIO_THREADS) {
+        aio_pool_run(ops, n);
+    } else {
+        for (size_t i = 0; i < n; i += aio_chain_len(&ops[i], n - i))
+            aio_exec_chain(&ops[i], aio_chain_len(&ops[i], n - i));
+    }
+    for (size_t i = 0; i < n; i++)
+        if (ops[i].result < 0) return -1;
+    return 0;
+}
+
+/* Start reading files into the page cache together, ahead of parsing them
+   one by one */
+void aio_prefetch(const char **paths, size_t n) {
+    if (aio_backend == AIO_OFF || n == 0) return;
+    AioOp *ops = xrealloc(NULL, n * sizeof *ops);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd < 0) continue;
+        metric_add(METRIC_OPENS, 1);
+        ops[count++] = (AioOp){ .type = AIO_FADVISE, .fd = fd };
+    }
+    aio_run(ops, count);
+    for (size_t i = 0; i < count; i++) close(ops[i].fd);
+    free(ops);
+}
+
+/* Select a backend by name (NULL or "off" for blocking I/O) and return
+   the one actually in use */
+int aio_init(const char *mode) {
+    int want = AIO_OFF;
+    if (mode && strcmp(mode, "uring") == 0) want = AIO_URING;
+    else if (mode && strcmp(mode, "threads") == 0) want = AIO_THREADS;
+    else if (mode && *mode && strcmp(mode, "off") != 0)
+        printf("Unknown I/O backend %s; using blocking I/O.\n", mode);
+    if (want == AIO_URING && aio_ring.fd < 0 && uring_open(&aio_ring, AIO_RING_ENTRIES) != 0) {
+        printf("io_uring is unavailable (%s); using the thread pool.\n", strerror(errno));
+        want = AIO_THREADS;
+    }
+    if (want == AIO_THREADS && aio_pool_start() != 0) {
+        printf("Could not start the I/O threads; using blocking I/O.\n");
+        want = AIO_OFF;
+    }
+    /* the journal reopens for the new backend at its next append */
+    journal_close();
+    aio_backend = want;
+    static int registered;
+    if (want != AIO_OFF && !registered) registered = atexit(journal_drain) == 0;
+    return want;
+}
+
+/* ---------- In-memory registry ----------
+ * The four data files are loaded once at startup. Menus query these tables
+ * instead of rescanning the files, so enrollment counts and duplicate checks
+ * are hash lookups. Files are only written to persist a change. */
+
+#define HASH_SEED 2166136261u
+#define SLOT_EMPTY   -1
+#define SLOT_DELETED -2
+
+/* FNV-1a, chained so several strings can make up one key */
+unsigned hash_str(const char *s, unsigned h) {
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    /* separator so ("ab","c") and ("a","bc") differ */
+    h ^= 0xff;
+    h *= 16777619u;
+    return h;
+}
+
+void hindex_free(HashIndex *ix) {
+    free(ix->slot); free(ix->hash);
+    ix->slot = NULL; ix->hash = NULL;
+    ix->cap = ix->used = ix->live = 0;
+}
+
+/* Returns the slot position holding the key, or -1 */
+long hindex_find(const HashIndex *ix, unsigned h, match_fn match,
+                 const void *table, const void *key) {
+    if (ix->cap == 0) return -1;
+    size_t mask = ix->cap - 1;
+    size_t pos = h & mask;
+    while (ix->slot[pos] != SLOT_EMPTY) {
+        if (ix->slot[pos] >= 0 && ix->hash[pos] == h
+            && match(table, ix->slot[pos], key))
+            return (long)pos;
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+void hindex_put_raw(HashIndex *ix, unsigned h, int idx) {
+    size_t mask = ix->cap - 1;
+    size_t pos = h & mask;
+    while (ix->slot[pos] >= 0) pos = (pos + 1) & mask;
+    if (ix->slot[pos] == SLOT_EMPTY) ix->used++;
+    ix->live++;
+    ix->slot[pos] = idx;
+    ix->hash[pos] = h;
+}
+
+void hindex_rehash(HashIndex *ix, size_t newcap) {
+    HashIndex old = *ix;
+    ix->slot = xrealloc(NULL, newcap * sizeof *ix->slot);
+    ix->hash = xrealloc(NULL, newcap * sizeof *ix->hash);
+    ix->cap = newcap;
+    ix->used = ix->live = 0;
+    for (size_t i = 0; i < newcap; i++) ix->slot[i] = SLOT_EMPTY;
+    for (size_t i = 0; i < old.cap; i++)
+        if (old.slot[i] >= 0) hindex_put_raw(ix, old.hash[i], old.slot[i]);
+    hindex_free(&old);
+}
+
+/* Insert a key that is known to be absent */
+void hindex_put(HashIndex *ix, unsigned h, int idx) {
+    if ((ix->used + 1) * 4 > ix->cap * 3) {
+        /* mostly tombstones: clean up in place instead of growing */
+        size_t ncap = ix->cap == 0 ? 16 : (ix->live * 2 < ix->cap ? ix->cap : ix->cap * 2);
+        hindex_rehash(ix, ncap);
+    }
+    hindex_put_raw(ix, h, idx);
+}
+
+void hindex_remove_at(HashIndex *ix, long pos) {
+    ix->slot[pos] = SLOT_DELETED;
+    ix->live--;
+}
+
+/* Grow a dynamic array so it can hold at least `need` elements */
+void *grow_array(void *p, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap) return p;
+    size_t ncap = *cap ? *cap * 2 : 16;
+    while (ncap < need) ncap *= 2;
+    *cap = ncap;
+    return xrealloc(p, ncap * elem);
+}
+
+/* Mix an integer into a running hash (for interned-id keys) */
+unsigned hash_int(unsigned x, unsigned h) {
+    h = (h ^ x) * 0x9e3779b1u;
+    return h ^ (h >> 15);
+}
+
+/* ---------- Arena ----------
+ * Interned strings live as long as the table that holds them, so they are
+ * packed back to back into large blocks instead of getting one malloc
+ * each. That saves the allocator's per-chunk header and rounding (a
+ * 6-byte roll used to cost 32 bytes of heap) and keeps the heap from
+ * fragmenting into millions of small chunks. */
+
+#define ARENA_BLOCK (1 << 20)
+
+void *arena_alloc(Arena *a, size_t n, size_t align) {
+    size_t off = (a->used + align - 1) & ~(align - 1);
+    if (a->nblocks == 0 || off + n > ARENA_BLOCK) {
+        /* anything too big for a block gets a block of its own */
+        size_t size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+        a->blocks = grow_array(a->blocks, &a->cap, a->nblocks + 1, sizeof *a->blocks);
+        a->blocks[a->nblocks++] = xrealloc(NULL, size);
+        a->bytes += size;
+        off = 0;
+    }
+    a->used = off + n;
+    return a->blocks[a->nblocks - 1] + off;
+}
+
+void arena_free(Arena *a) {
+    for (size_t i = 0; i < a->nblocks; i++) free(a->blocks[i]);
+    free(a->blocks);
+    memset(a, 0, sizeof *a);
+}
+
+/* ---------- String interning ----------
+ * Rolls, names, emails, semester labels, year labels and grade values
+ * repeat on many rows. Each distinct string is stored once, in the
+ * table's arena, and referred to by an integer id, so records are small
+ * fixed-size structs and the hot-path indexes compare ints instead of
+ * calling strcmp. */
+
+/* Strings live in fixed-size chunks that never move, so str_of() needs no
+   lock once an id has been handed out; only interning takes the mutex. */
+#define STR_CHUNK 4096
+#define STR_MAX_CHUNKS 65536
+
+StrTable strings = { NULL, 0, { 0 }, { 0 }, PTHREAD_MUTEX_INITIALIZER };
+
+void strtable_init(StrTable *t) {
+    memset(t, 0, sizeof *t);
+    pthread_mutex_init(&t->lock, NULL);
+}
+
+const char *strtable_get(const StrTable *t, int id) {
+    return t->chunks[id / STR_CHUNK][id % STR_CHUNK];
+}
+
+int match_str(const void *table, int idx, const void *key) {
+    return strcmp(strtable_get(table, idx), (const char *)key) == 0;
+}
+
+int intern_find_locked(StrTable *t, const char *s) {
+    long pos = hindex_find(&t->index, hash_str(s, HASH_SEED), match_str, t, s);
+    return pos < 0 ? -1 : t->index.slot[pos];
+}
+
+/* Id of s, or -1 if it was never interned */
+int intern_find(StrTable *t, const char *s) {
+    pthread_mutex_lock(&t->lock);
+    int id = intern_find_locked(t, s);
+    pthread_mutex_unlock(&t->lock);
+    return id;
+}
+
+/* Add a string known to be absent; h is its hash_str() */
+int intern_add_locked(StrTable *t, const char *s, size_t len, unsigned h) {
+    size_t chunk = t->count / STR_CHUNK;
+    if (chunk >= STR_MAX_CHUNKS) {
+        printf("String table full.\n");
+        exit(1);
+    }
+    if (!t->chunks) {
+        t->chunks = xrealloc(NULL, STR_MAX_CHUNKS * sizeof *t->chunks);
+        memset(t->chunks, 0, STR_MAX_CHUNKS * sizeof *t->chunks);
+    }
+    if (!t->chunks[chunk]) t->chunks[chunk] = xrealloc(NULL, STR_CHUNK * sizeof **t->chunks);
+    char *copy = arena_alloc(&t->arena, len + 1, 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    t->chunks[chunk][t->count % STR_CHUNK] = copy;
+    int id = (int)t->count++;
+    hindex_put(&t->index, h, id);
+    return id;
+}
+
+int intern(StrTable *t, const char *s) {
+    pthread_mutex_lock(&t->lock);
+    int id = intern_find_locked(t, s);
+    if (id < 0) id = intern_add_locked(t, s, strlen(s), hash_str(s, HASH_SEED));
+    pthread_mutex_unlock(&t->lock);
+    return id;
+}
+
+/* Hash of a view as hash_str() would hash its view_copy() */
+unsigned hash_view(StrView v) {
+    size_t len = v.len < MAX_FIELD - 1 ? v.len : MAX_FIELD - 1;
+    unsigned h = HASH_SEED;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)v.ptr[i];
+        h *= 16777619u;
+    }
+    h ^= 0xff;
+    h *= 16777619u;
+    return h;
+}
+
+int match_view(const void *table, int idx, const void *key) {
+    const StrView *v = key;
+    const char *s = strtable_get(table, idx);
+    return strncmp(s, v->ptr, v->len) == 0 && s[v->len] == '\0';
+}
+
+/* Intern a view, cut at MAX_FIELD like view_copy(), given its
+   hash_view(). The caller holds t->lock, so a batch of strings costs one
+   lock round. */
+int intern_view_locked(StrTable *t, StrView v, unsigned h) {
+    if (v.len > MAX_FIELD - 1) v.len = MAX_FIELD - 1;
+    long pos = hindex_find(&t->index, h, match_view, t, &v);
+    return pos >= 0 ? t->index.slot[pos] : intern_add_locked(t, v.ptr, v.len, h);
+}
+
+void strtable_free(StrTable *t) {
+    arena_free(&t->arena);
+    for (size_t i = 0; t->chunks && i < STR_MAX_CHUNKS && t->chunks[i]; i++) free(t->chunks[i]);
+    free(t->chunks);
+    hindex_free(&t->index);
+    pthread_mutex_destroy(&t->lock);
+    memset(t, 0, sizeof *t);
+}
+
+/* String for an id in the global table */
+const char *str_of(int id) {
+    return strtable_get(&strings, id);
+}
+
+/* ---------- Student indexes ----------
+ * The registry is keyed course-first. These indexes answer student-first
+ * questions without a scan: which courses a roll is enrolled in or
+ * waiting for, students by case-insensitive name prefix, and students by
+ * email. The registry mutators (add/remove registration, waitlist
+ * push/remove) keep them current, so live changes, journal replay,
+ * import and every storage format's loader all go through them. They are
+ * rebuilt with the registry at load rather than stored separately, which
+ * keeps the snapshot the one source of truth.
+ *
+ * Name prefixes are served from a sorted array of lowercase names plus an
+ * unsorted tail of recent additions, merged in before a search once the
+ * tail passes NAME_TAIL_MAX. A student whose name or email changes leaves
+ * a stale key behind; searches skip it and merges drop it. */
+
+#define NAME_TAIL_MAX 1024
+
+StudentIndex students = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Lowercase copy (ASCII) for the case-insensitive keys */
+void lower_copy(char *dst, const char *src) {
+    size_t i = 0;
+    for (; src[i] && i < MAX_FIELD - 1; i++) dst[i] = (char)tolower((unsigned char)src[i]);
+    dst[i] = '\0';
+}
+
+int match_student(const void *table, int idx, const void *key) {
+    return ((const StudentIndex *)table)->rows[idx].roll == *(const int *)key;
+}
+
+int match_email(const void *table, int idx, const void *key) {
+    return ((const StudentIndex *)table)->emails[idx].key == *(const int *)key;
+}
+
+Student *student_find(int roll) {
+    long pos = hindex_find(&students.by_roll, hash_int(roll, HASH_SEED), match_student, &students, &roll);
+    return pos < 0 ? NULL : &students.rows[students.by_roll.slot[pos]];
+}
+
+void student_add_email(int idx, int lemail) {
+    StudentIndex *x = &students;
+    x->emails = grow_array(x->emails, &x->emails_cap, x->nemails + 1, sizeof *x->emails);
+    StudentKey *k = &x->emails[x->nemails];
+    *k = (StudentKey){ lemail, idx, -1 };
+    long pos = hindex_find(&x->by_email, hash_int(lemail, HASH_SEED), match_email, x, &lemail);
+    if (pos < 0) {
+        hindex_put(&x->by_email, hash_int(lemail, HASH_SEED), (int)x->nemails);
+    } else {
+        StudentKey *head = &x->emails[x->by_email.slot[pos]];
+        k->next = head->next;
+        head->next = (int)x->nemails;
+    }
+    x->nemails++;
+}
+
+/* Record that roll is enrolled in (or waiting for) c. Called by the
+   registry mutators under the course lock; takes strings.lock inside
+   students.lock, never the other way round. */
+void student_link(Course *c, int roll, int name, int email, int waiting) {
+    StudentIndex *x = &students;
+    pthread_mutex_lock(&x->lock);
+    Student *s = student_find(roll);
+    if (!s) {
+        x->rows = grow_array(x->rows, &x->cap, x->count + 1, sizeof *x->rows);
+        s = &x->rows[x->count];
+        memset(s, 0, sizeof *s);
+        s->roll = roll;
+        s->name = s->email = s->lname = s->lemail = -1;
+        hindex_put(&x->by_roll, hash_int(roll, HASH_SEED), (int)x->count);
+        x->count++;
+    }
+    int idx = (int)(s - x->rows);
+    char lower[MAX_FIELD];
+    /* the common case, another course for a known student, interns nothing */
+    if (s->name != name) {
+        s->name = name;
+        lower_copy(lower, str_of(name));
+        int lname = intern(&strings, lower);
+        if (s->lname != lname) {
+            s->lname = lname;
+            x->names = grow_array(x->names, &x->names_cap, x->nnames + 1, sizeof *x->names);
+            x->names[x->nnames++] = (StudentKey){ lname, idx, -1 };
+        }
+    }
+    if (s->email != email) {
+        s->email = email;
+        lower_copy(lower, str_of(email));
+        int lemail = intern(&strings, lower);
+        if (s->lemail != lemail) {
+            s->lemail = lemail;
+            if (lower[0]) student_add_email(idx, lemail);
+        }
+    }
+    size_t i = 0;
+    while (i < s->count && s->courses[i].course != c) i++;
+    if (i == s->count) {
+        s->courses = grow_array(s->courses, &s->cap, s->count + 1, sizeof *s->courses);
+        s->courses[s->count++].course = c;
+        for (int w = 0; w < SLOT_WORDS; w++) s->slots[w] |= c->slots[w];
+        s->credits += c->credits;
+    }
+    s->courses[i].waiting = waiting;
+    pthread_mutex_unlock(&x->lock);
+}
+
+void student_unlink(Course *c, int roll) {
+    pthread_mutex_lock(&students.lock);
+    Student *s = student_find(roll);
+    for (size_t i = 0; s && i < s->count; i++) {
+        if (s->courses[i].course != c) continue;
+        memmove(&s->courses[i], &s->courses[i + 1], (s->count - i - 1) * sizeof *s->courses);
+        s->count--;
+        /* slots can overlap between courses, so rebuild rather than clear */
+        memset(s->slots, 0, sizeof s->slots);
+        s->credits = 0;
+        for (size_t j = 0; j < s->count; j++) {
+            const Course *k = s->courses[j].course;
+            for (int w = 0; w < SLOT_WORDS; w++) s->slots[w] |= k->slots[w];
+            s->credits += k->credits;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&students.lock);
+}
+
+/* A key is current while its student still has it */
+int student_key_current(const StudentKey *k, int email) {
+    const Student *s = &students.rows[k->student];
+    return (email ? s->lemail : s->lname) == k->key;
+}
+
+/* Collect a matching key's student if it is in some course */
+void collect_student(const StudentKey *k, int email, int **idx, size_t *n, size_t *cap) {
+    if (!student_key_current(k, email) || students.rows[k->student].count == 0) return;
+    *idx = grow_array(*idx, cap, *n + 1, sizeof **idx);
+    (*idx)[(*n)++] = k->student;
+}
+
+/* Name order, then student, so duplicates end up adjacent */
+int cmp_name_keys(const void *a, const void *b) {
+    const StudentKey *x = a, *y = b;
+    int c = x->key == y->key ? 0 : strcmp(str_of(x->key), str_of(y->key));
+    return c ? c : x->student - y->student;
+}
+
+/* Sort the tail and merge it into the sorted names, dropping stale and
+   duplicate keys on the way */
+void merge_name_tail() {
+    StudentIndex *x = &students;
+    StudentKey *tail = x->names + x->sorted;
+    size_t ntail = x->nnames - x->sorted;
+    qsort(tail, ntail, sizeof *tail, cmp_name_keys);
+    StudentKey *out = xrealloc(NULL, (x->nnames + 1) * sizeof *out);
+    size_t i = 0, j = 0, n = 0;
+    while (i < x->sorted || j < ntail) {
+        StudentKey *k = j == ntail || (i < x->sorted && cmp_name_keys(&x->names[i], &tail[j]) <= 0)
+                      ? &x->names[i++] : &tail[j++];
+        if (!student_key_current(k, 0)) continue;
+        if (n > 0 && cmp_name_keys(&out[n - 1], k) == 0) continue;
+        out[n++] = *k;
+    }
+    free(x->names);
+    x->names = out;
+    x->names_cap = x->nnames + 1;
+    x->nnames = x->sorted = n;
+}
+
+/* Calls fn with the student holding roll. Returns 1 if found. */
+int find_student(const char *roll, student_fn fn, void *arg) {
+    MetricScope m = metric_begin(OP_QUERY);
+    int id = intern_find(&strings, roll);
+    pthread_mutex_lock(&students.lock);
+    Student *s = id < 0 ? NULL : student_find(id);
+    int found = s && s->count > 0;
+    if (found) fn(s, arg);
+    pthread_mutex_unlock(&students.lock);
+    metric_end(&m);
+    return found;
+}
+
+int cmp_student_rows(const void *a, const void *b) {
+    const Student *x = &students.rows[*(const int *)a], *y = &students.rows[*(const int *)b];
+    int c = strcmp(str_of(x->lname), str_of(y->lname));
+    return c ? c : compare_rolls(str_of(x->roll), str_of(y->roll));
+}
+
+/* Visit the matched students in name order, at most limit (0 = all), and
+   return how many matched. idx is sorted and deduplicated here. */
+size_t visit_students(int *idx, size_t n, size_t limit, student_fn fn, void *arg) {
+    qsort(idx, n, sizeof *idx, cmp_student_rows);
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++)
+        if (kept == 0 || idx[kept - 1] != idx[i]) idx[kept++] = idx[i];
+    for (size_t i = 0; i < kept && (limit == 0 || i < limit); i++) fn(&students.rows[idx[i]], arg);
+    return kept;
+}
+
+/* Students whose name starts with prefix, ignoring case */
+size_t find_students_by_name(const char *prefix, size_t limit, student_fn fn, void *arg) {
+    MetricScope m = metric_begin(OP_QUERY);
+    char lower[MAX_FIELD];
+    lower_copy(lower, prefix);
+    size_t plen = strlen(lower);
+    StudentIndex *x = &students;
+    pthread_mutex_lock(&x->lock);
+    if (x->nnames - x->sorted > NAME_TAIL_MAX) merge_name_tail();
+    /* first sorted key >= prefix */
+    size_t lo = 0, hi = x->sorted;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(str_of(x->names[mid].key), lower) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    int *idx = NULL;
+    size_t n = 0, cap = 0, scanned = 0;
+    for (size_t i = lo; i < x->sorted && strncmp(str_of(x->names[i].key), lower, plen) == 0; i++, scanned++)
+        collect_student(&x->names[i], 0, &idx, &n, &cap);
+    for (size_t i = x->sorted; i < x->nnames; i++, scanned++)
+        if (strncmp(str_of(x->names[i].key), lower, plen) == 0) collect_student(&x->names[i], 0, &idx, &n, &cap);
+    size_t matched = visit_students(idx, n, limit, fn, arg);
+    pthread_mutex_unlock(&x->lock);
+    free(idx);
+    metric_add(METRIC_ROWS, (long long)scanned);
+    metric_end(&m);
+    return matched;
+}
+
+/* Students registered with this email, ignoring case */
+size_t find_students_by_email(const char *email, student_fn fn, void *arg) {
+    MetricScope m = metric_begin(OP_QUERY);
+    char lower[MAX_FIELD];
+    lower_copy(lower, email);
+    int key = intern_find(&strings, lower);
+    StudentIndex *x = &students;
+    int *idx = NULL;
+    size_t n = 0, cap = 0, matched = 0;
+    pthread_mutex_lock(&x->lock);
+    long pos = key < 0 ? -1 : hindex_find(&x->by_email, hash_int(key, HASH_SEED), match_email, x, &key);
+    for (int e = pos < 0 ? -1 : x->by_email.slot[pos]; e >= 0; e = x->emails[e].next)
+        collect_student(&x->emails[e], 1, &idx, &n, &cap);
+    matched = visit_students(idx, n, 0, fn, arg);
+    pthread_mutex_unlock(&x->lock);
+    free(idx);
+    metric_end(&m);
+    return matched;
+}
+
+Registry registry = { NULL, 0, 0, { 0 }, PTHREAD_RWLOCK_INITIALIZER };
+
+int match_course(const void *table, int idx, const void *key) {
+    return strcmp(((const Registry *)table)->courses[idx]->name, (const char *)key) == 0;
+}
+
+int match_reg(const void *table, int idx, const void *key) {
+    return ((const RegTable *)table)->rows[idx].roll == *(const int *)key;
+}
+
+typedef struct { int roll, sem; } SemKey;
+
+int match_sem(const void *table, int idx, const void *key) {
+    const SemRecord *r = &((const SemTable *)table)->rows[idx];
+    const SemKey *k = key;
+    return r->roll == k->roll && r->sem == k->sem;
+}
+
+Course *find_course(const char *name) {
+    long pos = hindex_find(&registry.index, hash_str(name, HASH_SEED), match_course, &registry, name);
+    return pos < 0 ? NULL : registry.courses[registry.index.slot[pos]];
+}
+
+Course *add_course(const char *name, int listed) {
+    Course *c = find_course(name);
+    if (c) {
+        if (listed) c->listed = 1;
+        return c;
+    }
+    registry.courses = grow_array(registry.courses, &registry.cap, registry.count + 1, sizeof *registry.courses);
+    c = xrealloc(NULL, sizeof *c);
+    memset(c, 0, sizeof *c);
+    copy_field(c->name, name);
+    c->listed = listed;
+    atomic_init(&c->seats, 0);
+    atomic_init(&c->enrolled, 0);
+    atomic_init(&c->waiting, 0);
+    pthread_mutex_init(&c->lock, NULL);
+    registry.courses[registry.count] = c;
+    hindex_put(&registry.index, hash_str(c->name, HASH_SEED), (int)registry.count);
+    registry.count++;
+    return c;
+}
+
+/* Course by its 1-based position in the listing (listed courses only) */
+Course *course_by_number(int number) {
+    int index = 0;
+    for (size_t i = 0; i < registry.count; i++) {
+        if (!registry.courses[i]->listed) continue;
+        if (++index == number) return registry.courses[i];
+    }
+    return NULL;
+}
+
+Registration *find_registration(Course *c, int roll) {
+    long pos = hindex_find(&c->regs.index, hash_int(roll, HASH_SEED), match_reg, &c->regs, &roll);
+    return pos < 0 ? NULL : &c->regs.rows[c->regs.index.slot[pos]];
+}
+
+/* Lookup by roll text; a roll never interned cannot be enrolled anywhere */
+Registration *lookup_registration(Course *c, const char *roll) {
+    int id = intern_find(&strings, roll);
+    return id < 0 ? NULL : find_registration(c, id);
+}
+
+/* The table half of add_registration; the loader links the students
+   itself afterwards */
+int insert_registration(Course *c, int roll, int name, int email, int year) {
+    if (find_registration(c, roll)) return -1;
+    RegTable *t = &c->regs;
+    t->rows = grow_array(t->rows, &t->cap, t->count + 1, sizeof *t->rows);
+    Registration *r = &t->rows[t->count];
+    *r = (Registration){ roll, year, name, email };
+    hindex_put(&t->index, hash_int(roll, HASH_SEED), (int)t->count);
+    t->count++;
+    atomic_fetch_add(&c->enrolled, 1);
+    return 0;
+}
+
+/* Returns 0 on success, -1 if the roll is already enrolled */
+int add_registration(Course *c, int roll, int name, int email, int year) {
+    if (insert_registration(c, roll, name, email, year) != 0) return -1;
+    student_link(c, roll, name, email, 0);
+    return 0;
+}
+
+unsigned hash_sem(int roll, int sem) {
+    return hash_int(sem, hash_int(roll, HASH_SEED));
+}
+
+SemRecord *find_sem_record(SemTable *t, int roll, int sem) {
+    SemKey k = { roll, sem };
+    long pos = hindex_find(&t->index, hash_sem(roll, sem), match_sem, t, &k);
+    return pos < 0 ? NULL : &t->rows[t->index.slot[pos]];
+}
+
+SemRecord *lookup_sem_record(SemTable *t, const char *roll, const char *sem) {
+    int r = intern_find(&strings, roll), s = intern_find(&strings, sem);
+    return r < 0 || s < 0 ? NULL : find_sem_record(t, r, s);
+}
+
+/* Insert or replace the value for (roll, sem) */
+void upsert_sem_record(SemTable *t, int roll, int sem, SemValue value) {
+    SemRecord *r = find_sem_record(t, roll, sem);
+    if (r) {
+        r->value = value;
+        return;
+    }
+    t->rows = grow_array(t->rows, &t->cap, t->count + 1, sizeof *t->rows);
+    r = &t->rows[t->count];
+    r->roll = roll;
+    r->sem = sem;
+    r->value = value;
+    hindex_put(&t->index, hash_sem(roll, sem), (int)t->count);
+    t->count++;
+}
+
+/* Remove every (roll, *) row. The last row is moved into each hole and its
+   index slot repointed, so removal never shifts the whole array. */
+void remove_sem_records(SemTable *t, int roll) {
+    size_t i = 0;
+    while (i < t->count) {
+        SemRecord *r = &t->rows[i];
+        if (r->roll != roll) { i++; continue; }
+        SemKey k = { r->roll, r->sem };
+        hindex_remove_at(&t->index, hindex_find(&t->index, hash_sem(r->roll, r->sem), match_sem, t, &k));
+        size_t last = t->count - 1;
+        if (i != last) {
+            SemRecord *m = &t->rows[last];
+            SemKey mk = { m->roll, m->sem };
+            long pos = hindex_find(&t->index, hash_sem(m->roll, m->sem), match_sem, t, &mk);
+            t->rows[i] = *m;
+            t->index.slot[pos] = (int)i;
+        }
+        t->count--;
+    }
+}
+
+/* Remove a registration and its attendance/grade rows.
+   Returns 0 on success, -1 if the roll is not enrolled. */
+int remove_registration(Course *c, int roll) {
+    RegTable *t = &c->regs;
+    long pos = hindex_find(&t->index, hash_int(roll, HASH_SEED), match_reg, t, &roll);
+    if (pos < 0) return -1;
+    size_t i = (size_t)t->index.slot[pos];
+    hindex_remove_at(&t->index, pos);
+    size_t last = t->count - 1;
+    if (i != last) {
+        Registration *m = &t->rows[last];
+        long mpos = hindex_find(&t->index, hash_int(m->roll, HASH_SEED), match_reg, t, &m->roll);
+        t->rows[i] = *m;
+        t->index.slot[mpos] = (int)i;
+    }
+    t->count--;
+    remove_sem_records(&c->attendance, roll);
+    remove_sem_records(&c->grades, roll);
+    atomic_fetch_sub(&c->enrolled, 1);
+    student_unlink(c, roll);
+    return 0;
+}
+
+/* ---------- Capacity and waitlists ----------
+ * A seat is claimed with a compare-and-swap on the course's seat counter
+ * before the course lock is taken, so concurrent enrollments can never
+ * oversell a course and a full course rejects claims without locking.
+ * When an enrolled student drops, the head of the waitlist inherits the
+ * seat (the counter is left unchanged) as long as the course is under
+ * capacity; replay applies the same rule so both paths agree. */
+
+/* Try to claim one seat. Returns 1 on success, 0 if the course is full. */
+int reserve_seat(Course *c) {
+    int cur = atomic_load(&c->seats);
+    do {
+        if (c->capacity > 0 && cur >= c->capacity) return 0;
+    } while (!atomic_compare_exchange_weak(&c->seats, &cur, cur + 1));
+    return 1;
+}
+
+void release_seat(Course *c) {
+    atomic_fetch_sub(&c->seats, 1);
+}
+
+/* Position (0-based) of a roll on the waitlist, or -1 */
+long waitlist_find(Course *c, int roll) {
+    for (size_t i = 0; i < c->waitlist.count; i++)
+        if (c->waitlist.rows[i].roll == roll) return (long)i;
+    return -1;
+}
+
+/* The table half of waitlist_push, as insert_registration */
+int insert_waitlisted(Course *c, int roll, int name, int email, int year) {
+    if (find_registration(c, roll) || waitlist_find(c, roll) >= 0) return -1;
+    Waitlist *w = &c->waitlist;
+    w->rows = grow_array(w->rows, &w->cap, w->count + 1, sizeof *w->rows);
+    Registration *r = &w->rows[w->count++];
+    *r = (Registration){ roll, year, name, email };
+    atomic_fetch_add(&c->waiting, 1);
+    return 0;
+}
+
+/* Returns 0 on success, -1 if the roll is already enrolled or waiting */
+int waitlist_push(Course *c, int roll, int name, int email, int year) {
+    if (insert_waitlisted(c, roll, name, email, year) != 0) return -1;
+    student_link(c, roll, name, email, 1);
+    return 0;
+}
+
+int waitlist_remove(Course *c, int roll) {
+    long i = waitlist_find(c, roll);
+    if (i < 0) return -1;
+    Waitlist *w = &c->waitlist;
+    memmove(&w->rows[i], &w->rows[i + 1], (w->count - i - 1) * sizeof *w->rows);
+    w->count--;
+    atomic_fetch_sub(&c->waiting, 1);
+    student_unlink(c, roll);
+    return 0;
+}
+
+/* After a drop: move the head of the waitlist into the course if there is
+   room. Returns 1 if someone was promoted. */
+int promote_waitlisted(Course *c) {
+    Waitlist *w = &c->waitlist;
+    if (w->count == 0 || (c->capacity > 0 && c->regs.count >= (size_t)c->capacity)) return 0;
+    Registration head = w->rows[0];
+    memmove(&w->rows[0], &w->rows[1], (w->count - 1) * sizeof *w->rows);
+    w->count--;
+    atomic_fetch_sub(&c->waiting, 1);
+    add_registration(c, head.roll, head.name, head.email, head.year);
+    feed_emit("P,%s,%s\n", c->name, str_of(head.roll));
+    return 1;
+}
+
+/* Drop a roll from the course or, failing that, from its waitlist.
+   Returns 1 if a waitlisted student took the freed seat, 0 if not, and
+   -1 if the roll was neither enrolled nor waiting. */
+int drop_registration(Course *c, int roll) {
+    if (remove_registration(c, roll) == 0) return promote_waitlisted(c);
+    return waitlist_remove(c, roll) == 0 ? 0 : -1;
+}
+
+/* Align the seat counters and the counter table with the loaded data
+   (single-threaded) */
+void sync_seat_counters() {
+    for (size_t i = 0; i < registry.count; i++)
+        atomic_store(&registry.courses[i]->seats, (int)registry.courses[i]->regs.count);
+    counts_verify();
+}
+
+/* Which per-course table a semester file maps to */
+SemTable *sem_table(Course *c, int grades) {
+    return grades ? &c->grades : &c->attendance;
+}
+
+/* Parse an attendance percent ("85", "85.5", "85%"); 0 on success */
+int parse_percent(const char *s, float *out) {
+    char *end;
+    double d = strtod(s, &end);
+    if (end == s) return -1;
+    if (*end == '%') end++;
+    /* written so that NaN fails it too */
+    if (*end != '\0' || !(d >= 0 && d <= 100)) return -1;
+    *out = (float)d;
+    return 0;
+}
+
+/* Parse the text form of an attendance or grade value; 0 on success */
+int parse_sem_value(int grades, const char *s, SemValue *out) {
+    if (grades) {
+        if (strlen(s) == 0) return -1;
+        out->grade = intern(&strings, s);
+        return 0;
+    }
+    return parse_percent(s, &out->percent);
+}
+
+/* Text form of a value; buf must hold MAX_FIELD chars */
+const char *format_sem_value(int grades, SemValue v, char *buf) {
+    if (grades) return str_of(v.grade);
+    snprintf(buf, MAX_FIELD, "%g", v.percent);
+    return buf;
+}
+
+/* ---------- Parallel loading ----------
+ * A data file is mapped once and cut at line boundaries into one chunk
+ * per worker. Each worker splits its lines into fields, parses the
+ * values and hashes the strings, then interns a block of LOAD_BLOCK lines
+ * under a single strings.lock round (the other workers keep parsing in
+ * the meantime), leaving one compact LoadRow of ids per line. The rows
+ * are then inserted course by course, one worker per group of courses,
+ * each walking the chunks in file order, so enrollment order, waitlist
+ * order and which of two values for the same semester wins all come out
+ * as they would from a sequential load. The student index is shared by
+ * every course and is linked last, in one pass.
+ *
+ * The load doubles as an integrity check. Lines longer than MAX_LINE are
+ * flagged but kept (fields are cut at MAX_FIELD as always); malformed
+ * lines (too few fields, a bad value) are skipped. The original text of
+ * both is held until a rewrite would drop it from the data files, and is
+ * then appended to REJECTED_FILE (see keep_rejected); a duplicate
+ * registration of a roll in a course is skipped and a second value for
+ * the same roll and semester replaces the first; and once everything is
+ * in, attendance and grade rows for a roll with no registration in the
+ * course are counted as orphans (and kept). Each file gets a LoadReport
+ * with the counts, the first few offenders, the time taken and the
+ * throughput; startup prints a warning when there are problems and
+ * `crs verify` prints the reports. CRS_LOAD_THREADS caps the number of
+ * workers, which is otherwise one per online CPU. */
+
+#define LOAD_BLOCK 4096
+#define LOAD_MIN_CHUNK (4 << 20)   /* smaller pieces are not worth a thread */
+#define LOAD_MAX_THREADS 64
+#define LOAD_COURSE_CACHE 256
+#define REJECTED_FILE "rejected.log"
+
+typedef struct {
+    int course;        /* interned name, or -1 for the spec's course */
+    int roll;
+    union {
+        struct { int name, email, year; } reg;   /* R and W */
+        struct { int sem; SemValue value; } sem; /* A and G */
+    } u;
+    unsigned line;     /* within the chunk, then within the file */
+} LoadRow;
+
+typedef struct {
+    char kind;         /* R, W, A or G */
+    const char *path;
+    Course *course;    /* the course of every row (shard files), else column 0 */
+    int sem;           /* the semester of every row (shard files), else -1 */
+    LoadReport *report;
+} LoadSpec;
+
+typedef struct {
+    int kind;
+    long line;
+    char what[MAX_FIELD];
+} LoadIssue;
+
+/* One worker's chunk and, later, its group of courses */
+typedef struct {
+    const LoadSpec *spec;
+    const char *start, *end;
+    LoadRow *rows;
+    size_t count, cap;
+    long lines;
+    long issues[LOAD_ISSUES];
+    LoadIssue *samples;
+    size_t nsamples, samples_cap;
+    struct { long line; const char *ptr; size_t len; } *rejects;   /* into the mapping */
+    size_t nrejects, rejects_cap;
+    struct { int id; Course *c; } cache[LOAD_COURSE_CACHE];
+    /* insert phase */
+    struct LoadJob *job;
+    int group;
+} LoadChunk;
+
+typedef struct LoadJob {
+    LoadChunk *chunks;
+    int nchunks;
+} LoadJob;
+
+LoadReport *load_reports;
+size_t nload_reports, load_reports_cap;
+
+/* The text of the lines a load skipped or cut, per data file, as
+   "path:line: text" lines ready for REJECTED_FILE */
+typedef struct {
+    char path[MAX_LINE];
+    char *text;
+    size_t len, cap;
+} RejectedLines;
+
+RejectedLines *rejected;
+size_t nrejected, rejected_cap;
+
+/* Also forgets the rejected lines: a reload finds them again */
+void load_reports_reset() {
+    free(load_reports);
+    load_reports = NULL;
+    nload_reports = load_reports_cap = 0;
+    for (size_t i = 0; i < nrejected; i++) free(rejected[i].text);
+    free(rejected);
+    rejected = NULL;
+    nrejected = rejected_cap = 0;
+}
+
+/* The report named label, created on first use */
+LoadReport *load_report(const char *label, char kind) {
+    for (size_t i = 0; i < nload_reports; i++)
+        if (strcmp(load_reports[i].file, label) == 0) return &load_reports[i];
+    load_reports = grow_array(load_reports, &load_reports_cap, nload_reports + 1, sizeof *load_reports);
+    LoadReport *r = &load_reports[nload_reports++];
+    memset(r, 0, sizeof *r);
+    snprintf(r->file, sizeof r->file, "%s", label);
+    r->kind = kind;
+    return r;
+}
+
+int load_thread_count() {
+    const char *env = getenv("CRS_LOAD_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > LOAD_MAX_THREADS ? LOAD_MAX_THREADS : (int)n;
+}
+
+/* Count an issue, keeping its description while the kind has fewer than
+   LOAD_SAMPLES; line numbers are fixed up once all chunks are parsed */
+void load_issue(LoadChunk *ch, int kind, long line, const char *fmt, ...) {
+    if (ch->issues[kind]++ >= LOAD_SAMPLES) return;
+    ch->samples = grow_array(ch->samples, &ch->samples_cap, ch->nsamples + 1, sizeof *ch->samples);
+    LoadIssue *is = &ch->samples[ch->nsamples++];
+    is->kind = kind;
+    is->line = line;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(is->what, sizeof is->what, fmt, ap);
+    va_end(ap);
+}
+
+void load_reject(LoadChunk *ch, long line, const char *ptr, size_t len) {
+    ch->rejects = grow_array(ch->rejects, &ch->rejects_cap, ch->nrejects + 1, sizeof *ch->rejects);
+    ch->rejects[ch->nrejects].line = line;
+    ch->rejects[ch->nrejects].ptr = ptr;
+    ch->rejects[ch->nrejects++].len = len;
+}
+
+/* Set aside a copy of a rejected line of path */
+void reject_line(const char *path, long line, const char *text, size_t len) {
+    RejectedLines *r = NULL;
+    for (size_t j = nrejected; j > 0 && !r; j--)
+        if (strcmp(rejected[j - 1].path, path) == 0) r = &rejected[j - 1];
+    if (!r) {
+        rejected = grow_array(rejected, &rejected_cap, nrejected + 1, sizeof *rejected);
+        r = &rejected[nrejected++];
+        memset(r, 0, sizeof *r);
+        snprintf(r->path, sizeof r->path, "%s", path);
+    }
+    char head[MAX_LINE];
+    size_t hl = (size_t)snprintf(head, sizeof head, "%s:%ld: ", path, line);
+    if (hl >= sizeof head) hl = sizeof head - 1;
+    r->text = grow_array(r->text, &r->cap, r->len + hl + len + 1, 1);
+    memcpy(r->text + r->len, head, hl);
+    memcpy(r->text + r->len + hl, text, len);
+    r->len += hl + len;
+    r->text[r->len++] = '\n';
+}
+
+/* Copy the chunks' rejected lines out of the mapping, in file order */
+void load_keep_rejects(const char *path, LoadChunk *chunks, int n) {
+    for (int k = 0; k < n; k++) {
+        LoadChunk *ch = &chunks[k];
+        for (size_t i = 0; i < ch->nrejects; i++)
+            reject_line(path, ch->rejects[i].line, ch->rejects[i].ptr, ch->rejects[i].len);
+        free(ch->rejects);
+        ch->rejects = NULL;
+        ch->nrejects = ch->rejects_cap = 0;
+    }
+}
+
+/* The course named by an interned id, created (unlisted) if new */
+Course *load_course(LoadChunk *ch, int id) {
+    unsigned slot = (unsigned)id % LOAD_COURSE_CACHE;
+    if (ch->cache[slot].c && ch->cache[slot].id == id) return ch->cache[slot].c;
+    pthread_rwlock_wrlock(&registry.lock);
+    Course *c = add_course(str_of(id), 0);
+    pthread_rwlock_unlock(&registry.lock);
+    ch->cache[slot].id = id;
+    ch->cache[slot].c = c;
+    return c;
+}
+
+/* Fields of one parsed line, with the hashes of those to intern */
+typedef struct {
+    StrView v[5];
+    unsigned h[5];
+    int n;
+    SemValue value;
+    long line;
+} LoadLine;
+
+/* The last field that is a string. Fields up to it are interned: the
+   course (unless fixed), the roll, then name, email and year, or the
+   semester (unless fixed) and a grade. */
+int load_last_string(const LoadSpec *sp) {
+    int off = sp->course ? 0 : 1;
+    if (sp->kind == 'R' || sp->kind == 'W') return off + 3;
+    return off + (sp->sem < 0 ? 1 : 0) + (sp->kind == 'G' ? 1 : 0);
+}
+
+/* Intern a block of lines under one lock round and append their rows */
+void load_flush(LoadChunk *ch, LoadLine *b, size_t n) {
+    const LoadSpec *sp = ch->spec;
+    int off = sp->course ? 0 : 1, regs = sp->kind == 'R' || sp->kind == 'W';
+    int last = load_last_string(sp);
+    int ids[5];
+    ch->rows = grow_array(ch->rows, &ch->cap, ch->count + n, sizeof *ch->rows);
+    pthread_mutex_lock(&strings.lock);
+    for (size_t i = 0; i < n; i++) {
+        LoadLine *l = &b[i];
+        for (int j = 0; j <= last; j++)
+            ids[j] = intern_view_locked(&strings, j < l->n ? l->v[j] : (StrView){ "", 0 }, l->h[j]);
+        LoadRow *r = &ch->rows[ch->count + i];
+        r->course = sp->course ? -1 : ids[0];
+        r->roll = ids[off];
+        r->line = (unsigned)l->line;
+        if (regs) {
+            r->u.reg.name = ids[off + 1];
+            r->u.reg.email = ids[off + 2];
+            r->u.reg.year = ids[off + 3];
+        } else {
+            r->u.sem.sem = sp->sem < 0 ? ids[off + 1] : sp->sem;
+            r->u.sem.value = l->value;
+            if (sp->kind == 'G') r->u.sem.value.grade = ids[last];
+        }
+    }
+    pthread_mutex_unlock(&strings.lock);
+    for (size_t i = 0; i < n; i++)
+        if (ch->rows[ch->count + i].course >= 0) load_course(ch, ch->rows[ch->count + i].course);
+    ch->count += n;
+}
+
+/* Phase 1: parse, check and intern one chunk */
+void *load_parse_worker(void *arg) {
+    LoadChunk *ch = arg;
+    const LoadSpec *sp = ch->spec;
+    int off = sp->course ? 0 : 1, regs = sp->kind == 'R' || sp->kind == 'W';
+    /* fields a row needs: registrations only need the roll */
+    int want = regs ? off + 4 : off + (sp->sem < 0 ? 3 : 2);
+    int need = regs ? off + 1 : want, last = load_last_string(sp);
+    CsvScanner sc = { 0 };
+    sc.pos = ch->start;
+    sc.end = ch->end;
+    LoadLine *block = xrealloc(NULL, LOAD_BLOCK * sizeof *block);
+    size_t nb = 0;
+    char buf[MAX_FIELD];
+    int n;
+    while ((n = scanner_next(&sc, block[nb].v, want, ','))) {
+        LoadLine *l = &block[nb];
+        l->n = n;
+        l->line = sc.line_no;
+        /* the scanner stops after the newline, or at the end of the chunk */
+        size_t len = (size_t)(sc.pos - l->v[0].ptr) - (sc.pos[-1] == '\n');
+        if (len > 0 && l->v[0].ptr[len - 1] == '\r') len--;
+        /* a long line is kept cut, a malformed one not at all: either way
+           the original is set aside, once */
+        if (len > MAX_LINE) {
+            load_issue(ch, LOAD_LONG_LINE, l->line, "%zu bytes", len);
+            load_reject(ch, l->line, l->v[0].ptr, len);
+        }
+        if (n < need) {
+            load_issue(ch, LOAD_MALFORMED, l->line, "%d field%s, expected %d", n, n == 1 ? "" : "s", want);
+            if (len <= MAX_LINE) load_reject(ch, l->line, l->v[0].ptr, len);
+            continue;
+        }
+        if (!regs) {
+            StrView v = l->v[want - 1];
+            view_copy(buf, v);
+            /* a grade label is interned with the other strings */
+            if (sp->kind == 'G' ? buf[0] == '\0' : parse_percent(buf, &l->value.percent) != 0) {
+                load_issue(ch, LOAD_MALFORMED, l->line, "bad %s '%s'", sp->kind == 'G' ? "grade" : "attendance", buf);
+                if (len <= MAX_LINE) load_reject(ch, l->line, l->v[0].ptr, len);
+                continue;
+            }
+        }
+        for (int j = 0; j <= last; j++) l->h[j] = hash_view(j < n ? l->v[j] : (StrView){ "", 0 });
+        if (++nb == LOAD_BLOCK) {
+            load_flush(ch, block, nb);
+            nb = 0;
+        }
+    }
+    if (nb) load_flush(ch, block, nb);
+    free(block);
+    ch->lines = sc.line_no;
+    return NULL;
+}
+
+/* The course a row belongs to, through the worker's cache */
+Course *load_row_course(LoadChunk *ch, const LoadRow *r) {
+    return r->course < 0 ? ch->spec->course : load_course(ch, r->course);
+}
+
+/* Phase 2: insert the rows of one group of courses, in file order */
+void *load_insert_worker(void *arg) {
+    LoadChunk *me = arg;
+    const LoadSpec *sp = me->spec;
+    LoadJob *job = me->job;
+    char buf[MAX_FIELD];
+    for (int k = 0; k < job->nchunks; k++) {
+        LoadChunk *ch = &job->chunks[k];
+        for (size_t i = 0; i < ch->count; i++) {
+            LoadRow *r = &ch->rows[i];
+            if (r->course >= 0 && hash_int(r->course, HASH_SEED) % job->nchunks != (unsigned)me->group) continue;
+            Course *c = load_row_course(me, r);
+            if (sp->kind == 'R' || sp->kind == 'W') {
+                int rc = sp->kind == 'R' ? insert_registration(c, r->roll, r->u.reg.name, r->u.reg.email, r->u.reg.year)
+                                         : insert_waitlisted(c, r->roll, r->u.reg.name, r->u.reg.email, r->u.reg.year);
+                /* marked so the link pass skips it */
+                if (rc != 0) {
+                    load_issue(me, LOAD_DUPLICATE, r->line, "roll %s already in %s", str_of(r->roll), c->name);
+                    r->roll = -1;
+                }
+                continue;
+            }
+            SemTable *t = sem_table(c, sp->kind == 'G');
+            SemRecord *old = find_sem_record(t, r->roll, r->u.sem.sem);
+            if (old)
+                load_issue(me, LOAD_DUPLICATE, r->line, "second value for roll %s, %s in %s (replaces %s)",
+                           str_of(r->roll), str_of(r->u.sem.sem), c->name,
+                           format_sem_value(sp->kind == 'G', old->value, buf));
+            upsert_sem_record(t, r->roll, r->u.sem.sem, r->u.sem.value);
+        }
+    }
+    return NULL;
+}
+
+int cmp_load_issues(const void *a, const void *b) {
+    const LoadIssue *x = a, *y = b;
+    if (x->kind != y->kind) return x->kind - y->kind;
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+/* Add the workers' counts and first samples to the report */
+void load_collect(LoadReport *rep, const char *path, LoadChunk *chunks, int n) {
+    LoadIssue *all = NULL;
+    size_t count = 0, cap = 0;
+    for (int k = 0; k < n; k++) {
+        for (int i = 0; i < LOAD_ISSUES; i++) rep->issues[i] += chunks[k].issues[i];
+        all = grow_array(all, &cap, count + chunks[k].nsamples, sizeof *all);
+        memcpy(all + count, chunks[k].samples, chunks[k].nsamples * sizeof *all);
+        count += chunks[k].nsamples;
+        free(chunks[k].samples);
+        chunks[k].samples = NULL;
+        chunks[k].nsamples = chunks[k].samples_cap = 0;
+        memset(chunks[k].issues, 0, sizeof chunks[k].issues);
+    }
+    qsort(all, count, sizeof *all, cmp_load_issues);
+    for (size_t i = 0; i < count; i++) {
+        int kind = all[i].kind, slot = 0;
+        while (slot < LOAD_SAMPLES && rep->samples[kind][slot][0]) slot++;
+        if (slot == LOAD_SAMPLES) continue;
+        snprintf(rep->samples[kind][slot], sizeof rep->samples[kind][slot], "%s:%ld: %s", path, all[i].line,
+                 all[i].what);
+    }
+    free(all);
+}
+
+/* Load one data file of the given kind */
+void load_rows(const LoadSpec *sp) {
+    double start = now_seconds();
+    CsvScanner sc;
+    if (scanner_open(&sc, sp->path) != 0 || sc.size == 0) { scanner_close(&sc); return; }
+    int threads = load_thread_count();
+    if ((size_t)threads > sc.size / LOAD_MIN_CHUNK) threads = (int)(sc.size / LOAD_MIN_CHUNK);
+    if (threads < 1 || sp->course) threads = 1;
+    LoadJob job = { xrealloc(NULL, threads * sizeof *job.chunks), threads };
+    memset(job.chunks, 0, threads * sizeof *job.chunks);
+    pthread_t tids[LOAD_MAX_THREADS];
+    const char *p = sc.data;
+    for (int k = 0; k < threads; k++) {
+        LoadChunk *ch = &job.chunks[k];
+        ch->spec = sp;
+        ch->job = &job;
+        ch->group = k;
+        ch->start = p;
+        /* cut just after the first newline past the even split point */
+        const char *cut = k == threads - 1 ? sc.end : sc.data + sc.size / threads * (k + 1);
+        if (cut < p) cut = p;
+        while (cut < sc.end && cut[-1] != '\n') cut++;
+        ch->end = p = cut;
+    }
+    for (int k = 1; k < threads; k++) pthread_create(&tids[k], NULL, load_parse_worker, &job.chunks[k]);
+    load_parse_worker(&job.chunks[0]);
+    for (int k = 1; k < threads; k++) pthread_join(tids[k], NULL);
+
+    /* chunk line numbers become file line numbers */
+    long base = 0, rows = 0;
+    for (int k = 0; k < threads; k++) {
+        LoadChunk *ch = &job.chunks[k];
+        for (size_t i = 0; i < ch->count; i++) ch->rows[i].line += (unsigned)base;
+        for (size_t i = 0; i < ch->nsamples; i++) ch->samples[i].line += base;
+        for (size_t i = 0; i < ch->nrejects; i++) ch->rejects[i].line += base;
+        base += ch->lines;
+        rows += (long)ch->count;
+    }
+    load_collect(sp->report, sp->path, job.chunks, threads);
+    load_keep_rejects(sp->path, job.chunks, threads);
+
+    for (int k = 1; k < threads; k++) pthread_create(&tids[k], NULL, load_insert_worker, &job.chunks[k]);
+    load_insert_worker(&job.chunks[0]);
+    for (int k = 1; k < threads; k++) pthread_join(tids[k], NULL);
+    load_collect(sp->report, sp->path, job.chunks, threads);
+
+    /* the student index is shared by all courses */
+    if (sp->kind == 'R' || sp->kind == 'W') {
+        for (int k = 0; k < threads; k++) {
+            LoadChunk *ch = &job.chunks[k];
+            for (size_t i = 0; i < ch->count; i++) {
+                LoadRow *r = &ch->rows[i];
+                if (r->roll >= 0)
+                    student_link(load_row_course(ch, r), r->roll, r->u.reg.name, r->u.reg.email, sp->kind == 'W');
+            }
+        }
+    }
+    for (int k = 0; k < threads; k++) free(job.chunks[k].rows);
+    free(job.chunks);
+
+    LoadReport *rep = sp->report;
+    rep->files++;
+    rep->bytes += (long long)sc.size;
+    rep->rows += rows;
+    rep->seconds += now_seconds() - start;
+    if (threads > rep->threads) rep->threads = threads;
+    metric_add(METRIC_ROWS, base);
+    sc.line_no = 0;
+    scanner_close(&sc);
+}
+
+/* Attendance and grade rows of rolls not registered in their course,
+   checked once everything is loaded since shard files come in any order */
+typedef struct {
+    int group, groups;
+    long orphans[2];
+    char samples[2][LOAD_SAMPLES][MAX_LINE];
+} OrphanCheck;
+
+void *orphan_worker(void *arg) {
+    OrphanCheck *oc = arg;
+    for (size_t i = oc->group; i < registry.count; i += (size_t)oc->groups) {
+        Course *c = registry.courses[i];
+        for (int g = 0; g < 2; g++) {
+            SemTable *t = sem_table(c, g);
+            for (size_t j = 0; j < t->count; j++) {
+                if (find_registration(c, t->rows[j].roll)) continue;
+                if (oc->orphans[g] < LOAD_SAMPLES)
+                    snprintf(oc->samples[g][oc->orphans[g]], MAX_LINE, "roll %s, %s in %s",
+                             str_of(t->rows[j].roll), str_of(t->rows[j].sem), c->name);
+                oc->orphans[g]++;
+            }
+        }
+    }
+    return NULL;
+}
+
+void check_orphans(const char *label_att, const char *label_grades) {
+    int threads = load_thread_count();
+    if ((size_t)threads > registry.count) threads = registry.count ? (int)registry.count : 1;
+    OrphanCheck *oc = xrealloc(NULL, threads * sizeof *oc);
+    memset(oc, 0, threads * sizeof *oc);
+    pthread_t tids[LOAD_MAX_THREADS];
+    for (int k = 0; k < threads; k++) {
+        oc[k].group = k;
+        oc[k].groups = threads;
+        if (k > 0) pthread_create(&tids[k], NULL, orphan_worker, &oc[k]);
+    }
+    orphan_worker(&oc[0]);
+    for (int k = 1; k < threads; k++) pthread_join(tids[k], NULL);
+    for (int g = 0; g < 2; g++) {
+        long total = 0;
+        for (int k = 0; k < threads; k++) total += oc[k].orphans[g];
+        if (total == 0) continue;
+        LoadReport *rep = load_report(g ? label_grades : label_att, g ? 'G' : 'A');
+        rep->issues[LOAD_ORPHAN] += total;
+        int slot = 0;
+        for (int k = 0; k < threads; k++)
+            for (long i = 0; i < oc[k].orphans[g] && i < LOAD_SAMPLES && slot < LOAD_SAMPLES; i++)
+                memcpy(rep->samples[LOAD_ORPHAN][slot++], oc[k].samples[g][i], MAX_LINE);
+    }
+    free(oc);
+}
+
+const char *load_issue_names[LOAD_ISSUES] = { "long lines", "malformed", "duplicate keys", "orphan rows" };
+
+long load_issue_total() {
+    long n = 0;
+    for (size_t i = 0; i < nload_reports; i++)
+        for (int k = 0; k < LOAD_ISSUES; k++) n += load_reports[i].issues[k];
+    return n;
+}
+
+/* One line per problem kind found, for startup */
+void load_warn(FILE *out) {
+    if (load_issue_total() == 0) return;
+    long n[LOAD_ISSUES] = { 0 };
+    for (size_t i = 0; i < nload_reports; i++)
+        for (int k = 0; k < LOAD_ISSUES; k++) n[k] += load_reports[i].issues[k];
+    fprintf(out, "Data check:");
+    for (int k = 0, first = 1; k < LOAD_ISSUES; k++)
+        if (n[k]) { fprintf(out, "%s %ld %s", first ? "" : ",", n[k], load_issue_names[k]); first = 0; }
+    fprintf(out, " (crs verify lists them; skipped and cut lines go to %s at the next rewrite)\n", REJECTED_FILE);
+}
+
+/* Per file: rows, size, load time and throughput, then the problems
+   found with the first few of each. Returns the number of problems. */
+long verify_report(FILE *out) {
+    fprintf(out, "%-28s %6s %10s %9s %9s %10s %11s %7s\n", "file", "files", "rows", "MB", "seconds",
+            "MB/s", "rows/s", "threads");
+    for (size_t i = 0; i < nload_reports; i++) {
+        LoadReport *r = &load_reports[i];
+        double mb = r->bytes / 1e6, s = r->seconds > 0 ? r->seconds : 1e-9;
+        fprintf(out, "%-28s %6ld %10ld %9.1f %9.3f %10.1f %11.0f %7d\n", r->file, r->files, r->rows, mb,
+                r->seconds, mb / s, r->rows / s, r->threads);
+    }
+    for (size_t i = 0; i < nload_reports; i++) {
+        LoadReport *r = &load_reports[i];
+        for (int k = 0; k < LOAD_ISSUES; k++) {
+            if (!r->issues[k]) continue;
+            fprintf(out, "\n%s: %ld %s\n", r->file, r->issues[k], load_issue_names[k]);
+            for (int j = 0; j < LOAD_SAMPLES && r->samples[k][j][0]; j++) fprintf(out, "  %s\n", r->samples[k][j]);
+            if (r->issues[k] > LOAD_SAMPLES) fprintf(out, "  ...\n");
+        }
+    }
+    long n = load_issue_total();
+    fprintf(out, n ? "\n%ld problem%s found.\n" : "\nNo problems found.\n", n, n == 1 ? "" : "s");
+    return n;
+}
+
+void load_sem_file(const char *fname, int grades) {
+    LoadSpec sp = { grades ? 'G' : 'A', fname, NULL, -1, load_report(fname, grades ? 'G' : 'A') };
+    load_rows(&sp);
+}
+
+/* registrations.csv and waitlist.csv share the same row layout */
+void load_reg_file(const char *fname, int waitlist) {
+    LoadSpec sp = { waitlist ? 'W' : 'R', fname, NULL, -1, load_report(fname, waitlist ? 'W' : 'R') };
+    load_rows(&sp);
+}
+
+void load_csv_snapshot() {
+    const char *files[] = { "registrations.csv", "waitlist.csv", "attendance.csv", "grades.csv" };
+    aio_prefetch(files, sizeof files / sizeof *files);
+    load_reg_file("registrations.csv", 0);
+    load_reg_file("waitlist.csv", 1);
+    load_sem_file("attendance.csv", 0);
+    load_sem_file("grades.csv", 1);
+}
+
+/* ---------- Timetables and prerequisites ----------
+ * courses.txt can carry metadata after the capacity:
+ *   name,capacity,credits,slots,prerequisites
+ * with slots a ';'-separated list of weekly hours such as Mon9 or Tue14-16
+ * (14:00 to 16:00) and prerequisites a ';'-separated list of course names.
+ * A course's slots are a 168-bit mask, one bit per hour of the week, and
+ * every student carries the OR of the masks and the sum of the credits of
+ * the courses they are enrolled in or waiting for, kept current by
+ * student_link/student_unlink. Checking an enrollment is then a few word
+ * ANDs, one addition and a look through the student's own courses for the
+ * prerequisites. The registry has no record of completed courses, so a
+ * prerequisite counts as met while the student is enrolled in it.
+ * Waitlisted courses hold their slots and credits too, so a promotion can
+ * never produce a clash.
+ *
+ * enroll_student and import check every new enrollment; rows already in
+ * the data files or the journal were checked when they were made and are
+ * loaded as they are. Checks for the same roll are serialized by a striped
+ * lock held from the check until the row is in, so two concurrent
+ * enrollments of one student cannot both pass. CRS_CREDIT_CAP replaces
+ * the default cap of DEFAULT_CREDIT_CAP credits (0 = no cap). */
+
+#define DEFAULT_CREDIT_CAP 24
+#define RULE_LOCKS 64
+
+int credit_cap = DEFAULT_CREDIT_CAP;
+int course_rules;          /* some course has credits, slots or prerequisites */
+pthread_mutex_t rule_locks[RULE_LOCKS];
+
+const char *day_names[] = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" };
+
+/* Set the bits for a ';'-separated list of slots. Returns -1 on a bad slot. */
+int parse_slots(const char *text, uint64_t *mask) {
+    char buf[MAX_LINE], *save;
+    memset(mask, 0, SLOT_WORDS * sizeof *mask);
+    snprintf(buf, sizeof buf, "%s", text);
+    for (char *tok = strtok_r(buf, "; ", &save); tok; tok = strtok_r(NULL, "; ", &save)) {
+        int day = -1;
+        for (int d = 0; d < 7; d++)
+            if (strncasecmp(tok, day_names[d], 3) == 0) day = d;
+        if (day < 0 || !isdigit((unsigned char)tok[3])) return -1;
+        char *end;
+        long from = strtol(tok + 3, &end, 10), to = from + 1;
+        if (*end == '-') to = strtol(end + 1, &end, 10);
+        if (*end != '\0' || from > 23 || to > 24 || to <= from) return -1;
+        for (long h = from; h < to; h++) {
+            int bit = day * 24 + (int)h;
+            mask[bit / 64] |= 1ull << (bit % 64);
+        }
+    }
+    return 0;
+}
+
+int slot_set(const uint64_t *mask, int bit) {
+    return bit < 7 * 24 && (mask[bit / 64] >> (bit % 64) & 1);
+}
+
+/* The inverse of parse_slots, with runs of hours merged */
+char *format_slots(const uint64_t *mask, char *buf, size_t len) {
+    size_t n = 0;
+    buf[0] = '\0';
+    for (int bit = 0; bit < 7 * 24; bit++) {
+        if (!slot_set(mask, bit)) continue;
+        int end = bit + 1;
+        while (end % 24 != 0 && slot_set(mask, end)) end++;
+        int h = bit % 24;
+        char one[16];
+        if (end - bit > 1) snprintf(one, sizeof one, "%s%d-%d", day_names[bit / 24], h, h + end - bit);
+        else snprintf(one, sizeof one, "%s%d", day_names[bit / 24], h);
+        n += snprintf(buf + n, n < len ? len - n : 0, "%s%s", n ? ";" : "", one);
+        if (n >= len) break;
+        bit = end - 1;
+    }
+    return buf;
+}
+
+void enable_course_rules() {
+    if (course_rules) return;
+    for (int i = 0; i < RULE_LOCKS; i++) pthread_mutex_init(&rule_locks[i], NULL);
+    const char *cap = getenv("CRS_CREDIT_CAP");
+    if (cap) credit_cap = atoi(cap);
+    course_rules = 1;
+}
+
+/* Apply the metadata fields of a courses.txt line. Prerequisites not yet
+   listed are created unlisted, to be filled in by their own line. Must
+   run before any student is linked to the course. Returns -1 (and changes
+   nothing) if the slots do not parse. */
+int set_course_rules(Course *c, const char *credits, const char *slots, const char *prereqs) {
+    uint64_t mask[SLOT_WORDS];
+    if (parse_slots(slots, mask) != 0) return -1;
+    memcpy(c->slots, mask, sizeof mask);
+    c->credits = atoi(credits) > 0 ? atoi(credits) : 0;
+    c->nprereqs = 0;
+    char buf[MAX_LINE], *save;
+    snprintf(buf, sizeof buf, "%s", prereqs);
+    size_t cap = 0;
+    for (char *tok = strtok_r(buf, ";", &save); tok; tok = strtok_r(NULL, ";", &save)) {
+        while (*tok == ' ') tok++;
+        if (*tok == '\0' || strcmp(tok, c->name) == 0) continue;
+        c->prereqs = grow_array(c->prereqs, &cap, c->nprereqs + 1, sizeof *c->prereqs);
+        c->prereqs[c->nprereqs++] = add_course(tok, 0);
+    }
+    if (c->credits || c->nprereqs || mask[0] || mask[1] || mask[2]) enable_course_rules();
+    return 0;
+}
+
+const char *rule_name(int rule) {
+    static const char *names[] = { "ok", "slot-clash", "credit-cap", "prerequisite" };
+    return rule >= 0 && rule <= RULE_PREREQ ? names[rule] : "unknown";
+}
+
+/* Whether roll may take c on top of their current courses: a RULE_* code,
+   with a sentence for the user in why if given. A roll already in c
+   passes. */
+int check_enrollment(Course *c, int roll, char *why, size_t len) {
+    if (why && len) why[0] = '\0';
+    if (!course_rules) return RULE_OK;
+    int rule = RULE_OK;
+    char slots[MAX_LINE];
+    pthread_mutex_lock(&students.lock);
+    Student *s = roll < 0 ? NULL : student_find(roll);
+    uint64_t clash = 0;
+    int credits = c->credits, already = 0;
+    if (s) {
+        for (int w = 0; w < SLOT_WORDS; w++) clash |= s->slots[w] & c->slots[w];
+        credits += s->credits;
+        for (size_t i = 0; i < s->count; i++) already |= s->courses[i].course == c;
+    }
+    if (already) {
+        /* the duplicate check reports it */
+    } else if (clash) {
+        rule = RULE_SLOT_CLASH;
+        /* name the first course that overlaps */
+        for (size_t i = 0; why && i < s->count; i++) {
+            const Course *k = s->courses[i].course;
+            uint64_t both[SLOT_WORDS];
+            clash = 0;
+            for (int w = 0; w < SLOT_WORDS; w++) clash |= both[w] = k->slots[w] & c->slots[w];
+            if (!clash) continue;
+            snprintf(why, len, "%s meets at the same time as %s (%s)", c->name, k->name,
+                     format_slots(both, slots, sizeof slots));
+            break;
+        }
+    } else if (credit_cap > 0 && c->credits > 0 && credits > credit_cap) {
+        rule = RULE_CREDIT_CAP;
+        if (why) snprintf(why, len, "%s would bring the total to %d credits, over the cap of %d",
+                          c->name, credits, credit_cap);
+    } else {
+        for (size_t p = 0; p < c->nprereqs && rule == RULE_OK; p++) {
+            size_t i = 0;
+            while (s && i < s->count && (s->courses[i].course != c->prereqs[p] || s->courses[i].waiting)) i++;
+            if (s && i < s->count) continue;
+            rule = RULE_PREREQ;
+            if (why) snprintf(why, len, "%s requires %s first", c->name, c->prereqs[p]->name);
+        }
+    }
+    pthread_mutex_unlock(&students.lock);
+    return rule;
+}
+
+/* The lock serializing checks for roll, or NULL when no course has rules */
+pthread_mutex_t *rule_lock(int roll) {
+    return course_rules ? &rule_locks[hash_int(roll, HASH_SEED) % RULE_LOCKS] : NULL;
+}
+
+/* ---------- Crash-safe file replacement ----------
+ * A file is rewritten into a temp copy that is fsync'd before it is renamed
+ * over the original, and the directory is fsync'd after the rename, so a
+ * crash leaves either the old or the new contents and never an empty file.
+ * The CSV snapshot spans four files. They are all staged first, and then
+ * a commit record (SNAPSHOT_COMMIT) listing the renames is made durable
+ * before any rename happens. recover_snapshot() runs from
+ * ensure_base_files() at startup. It completes the renames if the commit
+ * record exists, and otherwise discards half-staged temp files, so the
+ * four files always change together. */
+
+#define SNAPSHOT_COMMIT "snapshot.commit"
+
+typedef struct { const char *fname, *tmpname; } StagedFile;
+
+const StagedFile csv_files[] = {
+    { "registrations.csv", "registrations.tmp" },
+    { "waitlist.csv", "waitlist.tmp" },
+    { "attendance.csv", "attendance.tmp" },
+    { "grades.csv", "grades.tmp" },
+};
+#define CSV_FILE_COUNT (sizeof csv_files / sizeof *csv_files)
+
+/* Make directory entries (renames, creations) durable */
+int sync_dir_at(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+int sync_dir() {
+    return sync_dir_at(".");
+}
+
+/* Flush, fsync and close; 0 on success */
+int close_synced(FILE *f) {
+    int rc = fflush(f) == 0 && fsync(fileno(f)) == 0 ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+/* Write a file through a temp copy so a failed write never truncates it */
+FILE *begin_rewrite(const char *tmpname) {
+    metric_add(METRIC_OPENS, 1);
+    return fopen(tmpname, "w");
+}
+
+/* While a snapshot stages its files on the async backend, end_rewrite()
+   only flushes them, and they are fsync'd and closed REWRITE_BATCH at a
+   time as one aio batch instead of one after another; sync_rewrites()
+   finishes the last batch. The blocking backend keeps closing each file
+   as it is written. Saves hold the registry write lock (or run before any
+   other thread exists), so there is one batch at a time. */
+#define REWRITE_BATCH 64
+
+struct {
+    FILE *files[REWRITE_BATCH];
+    size_t count;
+    int active, failed;
+} rewrites;
+
+void defer_rewrites() {
+    rewrites.active = aio_backend != AIO_OFF;
+    rewrites.failed = 0;
+}
+
+/* fsync and close the files staged in the current batch */
+void flush_rewrites() {
+    AioOp ops[REWRITE_BATCH];
+    for (size_t i = 0; i < rewrites.count; i++)
+        ops[i] = (AioOp){ .type = AIO_FSYNC, .fd = fileno(rewrites.files[i]) };
+    if (aio_run(ops, rewrites.count) != 0) rewrites.failed = 1;
+    for (size_t i = 0; i < rewrites.count; i++)
+        if (fclose(rewrites.files[i]) != 0) rewrites.failed = 1;
+    rewrites.count = 0;
+}
+
+/* Finish the files staged since defer_rewrites(); 0 if all are durable */
+int sync_rewrites() {
+    flush_rewrites();
+    rewrites.active = 0;
+    return rewrites.failed ? -1 : 0;
+}
+
+/* Counts the rewritten file's size, then fsyncs and closes it (or stages
+   that for the batch) */
+int end_rewrite(FILE *f) {
+    long size = ftell(f);
+    if (size > 0) metric_add(METRIC_WRITTEN, size);
+    if (!rewrites.active) return close_synced(f);
+    int rc = fflush(f) == 0 ? 0 : -1;
+    rewrites.files[rewrites.count++] = f;
+    if (rewrites.count == REWRITE_BATCH) flush_rewrites();
+    return rc;
+}
+
+int finish_rewrite(FILE *f, const char *fname, const char *tmpname) {
+    if (end_rewrite(f) != 0) { remove(tmpname); return -1; }
+    if (rename(tmpname, fname) != 0) return -1;
+    return sync_dir();
+}
+
+/* Roll an interrupted snapshot commit forward, or clean up after one that
+   never reached its commit record */
+void recover_snapshot() {
+    if (file_exists(SNAPSHOT_COMMIT)) {
+        FILE *f = fopen(SNAPSHOT_COMMIT, "r");
+        char line[MAX_LINE], *fld[2];
+        while (f && fgets(line, sizeof line, f)) {
+            if (split_line(line, fld, 2, ' ') == 2 && file_exists(fld[0])) rename(fld[0], fld[1]);
+        }
+        if (f) fclose(f);
+        sync_dir();
+        remove(SNAPSHOT_COMMIT);
+        printf("Recovered an interrupted save.\n");
+    }
+    for (size_t i = 0; i < CSV_FILE_COUNT; i++) remove(csv_files[i].tmpname);
+}
+
+/* Stage a registrations or waitlist file into tmpname (fsync'd) */
+int write_reg_file(const char *tmpname, int waitlist) {
+    FILE *fw = begin_rewrite(tmpname);
+    if (!fw) return -1;
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        Registration *rows = waitlist ? c->waitlist.rows : c->regs.rows;
+        size_t count = waitlist ? c->waitlist.count : c->regs.count;
+        for (size_t j = 0; j < count; j++) {
+            Registration *r = &rows[j];
+            /* CSV: course,roll,name,email,year */
+            fprintf(fw, "%s,%s,%s,%s,%s\n", c->name, str_of(r->roll), str_of(r->name), str_of(r->email),
+                    str_of(r->year));
+        }
+    }
+    return end_rewrite(fw);
+}
+
+int write_sem_file(const char *tmpname, int grades) {
+    FILE *fw = begin_rewrite(tmpname);
+    if (!fw) return -1;
+    char buf[MAX_FIELD];
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        SemTable *t = sem_table(c, grades);
+        for (size_t j = 0; j < t->count; j++) {
+            SemRecord *r = &t->rows[j];
+            fprintf(fw, "%s,%s,%s,%s\n", c->name, str_of(r->roll), str_of(r->sem),
+                    format_sem_value(grades, r->value, buf));
+        }
+    }
+    return end_rewrite(fw);
+}
+
+/* Whether path is one keep_rejected(which) covers; NULL covers every
+   data file, the journal's records being kept by journal_restart */
+int rejected_match(const RejectedLines *r, const char *which) {
+    return which ? strcmp(r->path, which) == 0 : strcmp(r->path, JOURNAL_FILE) != 0;
+}
+
+/* Append the lines the load rejected from path to REJECTED_FILE, before
+   a rewrite replaces the file without them. A rewrite that cannot keep
+   them does not go ahead. */
+int keep_rejected(const char *path) {
+    int any = 0;
+    for (size_t i = 0; i < nrejected; i++) any |= rejected[i].len > 0 && rejected_match(&rejected[i], path);
+    if (!any) return 0;
+    int existed = file_exists(REJECTED_FILE);
+    FILE *f = fopen(REJECTED_FILE, "a");
+    int ok = f != NULL;
+    for (size_t i = 0; ok && i < nrejected; i++)
+        if (rejected_match(&rejected[i], path))
+            ok = fwrite(rejected[i].text, 1, rejected[i].len, f) == rejected[i].len;
+    if (f && close_synced(f) != 0) ok = 0;
+    if (ok && !existed) ok = sync_dir() == 0;
+    if (!ok) {
+        printf("Could not save the rejected lines to %s; the data files are left as they are.\n", REJECTED_FILE);
+        return -1;
+    }
+    for (size_t i = 0; i < nrejected; i++)
+        if (rejected_match(&rejected[i], path)) rejected[i].len = 0;
+    return 0;
+}
+
+/* Replace one snapshot file on its own */
+int save_reg_file(const char *fname, const char *tmpname, int waitlist) {
+    if (keep_rejected(fname) != 0) return -1;
+    if (write_reg_file(tmpname, waitlist) != 0) { remove(tmpname); return -1; }
+    if (rename(tmpname, fname) != 0) return -1;
+    return sync_dir();
+}
+
+int save_sem_file(const char *fname, const char *tmpname, int grades) {
+    if (keep_rejected(fname) != 0) return -1;
+    if (write_sem_file(tmpname, grades) != 0) { remove(tmpname); return -1; }
+    if (rename(tmpname, fname) != 0) return -1;
+    return sync_dir();
+}
+
+/* Replace all four CSV files as one atomic commit */
+int save_csv_snapshot() {
+    if (keep_rejected(NULL) != 0) return -1;
+    defer_rewrites();
+    int ok = write_reg_file(csv_files[0].tmpname, 0) == 0
+          && write_reg_file(csv_files[1].tmpname, 1) == 0
+          && write_sem_file(csv_files[2].tmpname, 0) == 0
+          && write_sem_file(csv_files[3].tmpname, 1) == 0;
+    ok = sync_rewrites() == 0 && ok;
+    FILE *f = ok ? begin_rewrite(SNAPSHOT_COMMIT ".tmp") : NULL;
+    if (f) {
+        for (size_t i = 0; i < CSV_FILE_COUNT; i++)
+            fprintf(f, "%s %s\n", csv_files[i].tmpname, csv_files[i].fname);
+        ok = end_rewrite(f) == 0 && rename(SNAPSHOT_COMMIT ".tmp", SNAPSHOT_COMMIT) == 0
+          && sync_dir() == 0;
+    } else {
+        ok = 0;
+    }
+    if (!ok) {
+        /* nothing is committed yet: the old files are untouched */
+        remove(SNAPSHOT_COMMIT ".tmp");
+        for (size_t i = 0; i < CSV_FILE_COUNT; i++) remove(csv_files[i].tmpname);
+        return -1;
+    }
+    /* committed: from here on recovery would finish the job */
+    for (size_t i = 0; i < CSV_FILE_COUNT; i++)
+        if (rename(csv_files[i].tmpname, csv_files[i].fname) != 0) return -1;
+    if (sync_dir() != 0) return -1;
+    remove(SNAPSHOT_COMMIT);
+    return 0;
+}
+
+/* ---------- Enrollment counters ----------
+ * Each course keeps atomic enrolled/waiting counts, bumped by the registry
+ * mutators, so the course listing reads them without taking any course
+ * lock. They are also persisted in counts.dat, a small table with one
+ * fixed-size record per course:
+ *   CountsHeader
+ *   ncourses x CountRecord      record i belongs to the course with count_slot i+1
+ * Every enroll/drop rewrites its course's record in place with one
+ * pwrite, so keeping the table current is O(1) whatever the data size.
+ * The records are not fsync'd: the table is derived data, and startup
+ * checks it against the loaded registry and rebuilds it when it is stale
+ * (after a crash, or after the data files changed behind its back).
+ * `crs fill` reads the table alone, without loading any data. */
+
+#define COUNTS_FILE "counts.dat"
+#define COUNTS_VERSION 1
+
+typedef struct {
+    char magic[4];     /* "CRSN" */
+    uint32_t version, ncourses, pad;
+} CountsHeader;
+
+typedef struct {
+    uint32_t enrolled, waiting, capacity, listed;
+    char name[MAX_FIELD];
+} CountRecord;
+
+int counts_fd = -1;
+uint32_t counts_slots;
+pthread_mutex_t counts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void count_record(Course *c, CountRecord *r) {
+    memset(r, 0, sizeof *r);
+    r->enrolled = (uint32_t)atomic_load(&c->enrolled);
+    r->waiting = (uint32_t)atomic_load(&c->waiting);
+    r->capacity = (uint32_t)c->capacity;
+    r->listed = (uint32_t)c->listed;
+    copy_field(r->name, c->name);
+}
+
+/* Rewrite the course's record. Callers hold the course lock, so records
+   for one course are written in the order the changes happen. */
+void counts_store(Course *c) {
+    if (counts_fd < 0) return;
+    if (!c->count_slot) {
+        /* a course new since startup gets the next record */
+        pthread_mutex_lock(&counts_lock);
+        c->count_slot = (int)++counts_slots;
+        CountsHeader h = { { 'C', 'R', 'S', 'N' }, COUNTS_VERSION, counts_slots, 0 };
+        if (pwrite(counts_fd, &h, sizeof h, 0) != (ssize_t)sizeof h) printf("Could not update %s.\n", COUNTS_FILE);
+        pthread_mutex_unlock(&counts_lock);
+    }
+    CountRecord r;
+    count_record(c, &r);
+    off_t off = (off_t)sizeof(CountsHeader) + (off_t)(c->count_slot - 1) * (off_t)sizeof r;
+    metric_add(METRIC_WRITTEN, sizeof r);
+    if (pwrite(counts_fd, &r, sizeof r, off) != (ssize_t)sizeof r) printf("Could not update %s.\n", COUNTS_FILE);
+}
+
+/* Write the whole table from the registry and reopen it for updates */
+int counts_rebuild() {
+    if (counts_fd >= 0) close(counts_fd);
+    counts_fd = -1;
+    FILE *fw = begin_rewrite(COUNTS_FILE ".tmp");
+    if (!fw) return -1;
+    CountsHeader h = { { 'C', 'R', 'S', 'N' }, COUNTS_VERSION, (uint32_t)registry.count, 0 };
+    int ok = fwrite(&h, sizeof h, 1, fw) == 1;
+    for (size_t i = 0; ok && i < registry.count; i++) {
+        CountRecord r;
+        count_record(registry.courses[i], &r);
+        registry.courses[i]->count_slot = (int)i + 1;
+        ok = fwrite(&r, sizeof r, 1, fw) == 1;
+    }
+    counts_slots = (uint32_t)registry.count;
+    if (!ok) { fclose(fw); remove(COUNTS_FILE ".tmp"); return -1; }
+    if (finish_rewrite(fw, COUNTS_FILE, COUNTS_FILE ".tmp") != 0) return -1;
+    counts_fd = open(COUNTS_FILE, O_RDWR);
+    return counts_fd >= 0 ? 0 : -1;
+}
+
+/* Map the table onto the loaded courses and rebuild it if any record is
+   missing, extra or out of date */
+void counts_verify() {
+    if (counts_fd >= 0) close(counts_fd);
+    counts_fd = -1;
+    for (size_t i = 0; i < registry.count; i++) registry.courses[i]->count_slot = 0;
+    CsvScanner sc;
+    int stale = 1;
+    if (scanner_open(&sc, COUNTS_FILE) == 0 && sc.size >= sizeof(CountsHeader)) {
+        CountsHeader h;
+        memcpy(&h, sc.data, sizeof h);
+        stale = memcmp(h.magic, "CRSN", 4) != 0 || h.version != COUNTS_VERSION
+             || h.ncourses != registry.count
+             || sc.size != sizeof h + (size_t)h.ncourses * sizeof(CountRecord);
+        for (uint32_t i = 0; !stale && i < h.ncourses; i++) {
+            CountRecord r, want;
+            memcpy(&r, sc.data + sizeof h + i * sizeof r, sizeof r);
+            r.name[MAX_FIELD - 1] = '\0';
+            Course *c = find_course(r.name);
+            if (!c || c->count_slot) { stale = 1; break; }
+            count_record(c, &want);
+            stale = memcmp(&r, &want, sizeof r) != 0;
+            c->count_slot = (int)i + 1;
+        }
+    }
+    scanner_close(&sc);
+    if (!stale) {
+        counts_slots = (uint32_t)registry.count;
+        counts_fd = open(COUNTS_FILE, O_RDWR);
+        if (counts_fd >= 0) return;
+    }
+    if (file_exists(COUNTS_FILE)) printf("Rebuilding stale enrollment counters.\n");
+    if (counts_rebuild() != 0) printf("Could not write %s.\n", COUNTS_FILE);
+}
+
+/* Capacity and fill rate per listed course, straight from the counter
+   table. Returns -1 if there is no usable table. */
+int fill_report(FILE *out) {
+    CsvScanner sc;
+    if (scanner_open(&sc, COUNTS_FILE) != 0 || sc.size < sizeof(CountsHeader)) { scanner_close(&sc); return -1; }
+    CountsHeader h;
+    memcpy(&h, sc.data, sizeof h);
+    if (memcmp(h.magic, "CRSN", 4) != 0 || h.version != COUNTS_VERSION
+        || sc.size < sizeof h + (size_t)h.ncourses * sizeof(CountRecord)) {
+        scanner_close(&sc);
+        return -1;
+    }
+    long enrolled = 0, waiting = 0, capacity = 0, capped = 0;
+    fprintf(out, "%-24s %9s %9s %7s %9s\n", "course", "enrolled", "capacity", "fill", "waitlist");
+    for (uint32_t i = 0; i < h.ncourses; i++) {
+        CountRecord r;
+        memcpy(&r, sc.data + sizeof h + i * sizeof r, sizeof r);
+        r.name[MAX_FIELD - 1] = '\0';
+        if (!r.listed) continue;
+        enrolled += r.enrolled;
+        waiting += r.waiting;
+        if (r.capacity > 0) {
+            capacity += r.capacity;
+            capped += r.enrolled;
+            fprintf(out, "%-24s %9u %9u %6.1f%% %9u\n", r.name, r.enrolled, r.capacity,
+                    100.0 * r.enrolled / r.capacity, r.waiting);
+        } else {
+            fprintf(out, "%-24s %9u %9s %7s %9u\n", r.name, r.enrolled, "-", "-", r.waiting);
+        }
+    }
+    if (capacity > 0)
+        fprintf(out, "%-24s %9ld %9ld %6.1f%% %9ld\n", "total", enrolled, capacity, 100.0 * capped / capacity, waiting);
+    else
+        fprintf(out, "%-24s %9ld %9s %7s %9ld\n", "total", enrolled, "-", "-", waiting);
+    scanner_close(&sc);
+    return 0;
+}
+
+/* ---------- Binary snapshot ----------
+ * Alternative to the three CSV files: one little-endian file with a
+ * header, two string tables and fixed-width records that refer to strings
+ * by index. Records are grouped under their course, so the course is not
+ * repeated per row. Short labels (semesters, years, grades) get 16-bit ids
+ * and attendance is stored as hundredths of a percent. Selected with
+ * CRS_STORAGE=binary; `crs convert csv|bin` writes the current data in
+ * either format.
+ *
+ *   BinHeader
+ *   nlabels  x (uint16 length, bytes)
+ *   nstrings x (uint16 length, bytes)     course names, rolls, names, emails
+ *   ncourses x (BinCourse, nregs x BinReg, natt x BinAtt, ngrades x BinGrade,
+ *               nwait x BinReg)
+ */
+
+#define BIN_VERSION 2           /* 2 added waitlists; version 1 files still load */
+#define BIN_V1_COURSE_SIZE 20
+#define BIN_MAX_LABELS 65535
+
+typedef struct {
+    char magic[4];     /* "CRSB" */
+    uint32_t version;
+    uint32_t nlabels, nstrings, ncourses;
+} BinHeader;
+
+typedef struct { uint32_t name, listed, nregs, natt, ngrades, nwait; } BinCourse;
+typedef struct { uint32_t roll, name, email; uint16_t year, pad; } BinReg;
+typedef struct { uint32_t roll; uint16_t sem, percent; } BinAtt;
+typedef struct { uint32_t roll; uint16_t sem, grade; } BinGrade;
+
+int storage_mode = STORAGE_CSV;
+
+int write_strtable(FILE *fw, const StrTable *t) {
+    for (size_t i = 0; i < t->count; i++) {
+        const char *str = strtable_get(t, i);
+        size_t n = strlen(str);
+        uint16_t len = n > 65535 ? 65535 : (uint16_t)n;
+        if (fwrite(&len, sizeof len, 1, fw) != 1 || fwrite(str, 1, len, fw) != len) return -1;
+    }
+    return 0;
+}
+
+/* Write the given courses (the registry, or a frozen copy of it) */
+int write_binary_snapshot(Course **courses, size_t count, const char *fname) {
+    char tmpname[MAX_LINE];
+    snprintf(tmpname, sizeof tmpname, "%s.tmp", fname);
+    StrTable labels, strs;
+    strtable_init(&labels);
+    strtable_init(&strs);
+    BinHeader h = { { 'C', 'R', 'S', 'B' }, BIN_VERSION, 0, 0, count };
+    BinCourse *bc = xrealloc(NULL, (count + 1) * sizeof *bc);
+    BinReg *br = NULL; BinAtt *ba = NULL; BinGrade *bg = NULL;
+    size_t rcap = 0, acap = 0, gcap = 0, nr = 0, na = 0, ng = 0;
+
+    /* One pass over the registry builds the records and the string tables */
+    for (size_t i = 0; i < count; i++) {
+        Course *c = courses[i];
+        bc[i] = (BinCourse){ intern(&strs, c->name), c->listed, c->regs.count,
+                             c->attendance.count, c->grades.count, c->waitlist.count };
+        /* each course's waitlist follows its registrations in br[] */
+        br = grow_array(br, &rcap, nr + c->regs.count + c->waitlist.count, sizeof *br);
+        for (size_t j = 0; j < c->regs.count + c->waitlist.count; j++) {
+            Registration *r = j < c->regs.count ? &c->regs.rows[j] : &c->waitlist.rows[j - c->regs.count];
+            br[nr++] = (BinReg){ intern(&strs, str_of(r->roll)), intern(&strs, str_of(r->name)),
+                                 intern(&strs, str_of(r->email)), intern(&labels, str_of(r->year)), 0 };
+        }
+        ba = grow_array(ba, &acap, na + c->attendance.count, sizeof *ba);
+        for (size_t j = 0; j < c->attendance.count; j++) {
+            SemRecord *r = &c->attendance.rows[j];
+            ba[na++] = (BinAtt){ intern(&strs, str_of(r->roll)), intern(&labels, str_of(r->sem)),
+                                 (uint16_t)(r->value.percent * 100 + 0.5f) };
+        }
+        bg = grow_array(bg, &gcap, ng + c->grades.count, sizeof *bg);
+        for (size_t j = 0; j < c->grades.count; j++) {
+            SemRecord *r = &c->grades.rows[j];
+            bg[ng++] = (BinGrade){ intern(&strs, str_of(r->roll)), intern(&labels, str_of(r->sem)),
+                                   intern(&labels, str_of(r->value.grade)) };
+        }
+    }
+    h.nlabels = labels.count;
+    h.nstrings = strs.count;
+
+    int ok = labels.count <= BIN_MAX_LABELS;
+    if (!ok) printf("Too many distinct semester/year/grade labels for the binary format.\n");
+    FILE *fw = ok ? begin_rewrite(tmpname) : NULL;
+    if (fw) {
+        ok = fwrite(&h, sizeof h, 1, fw) == 1
+          && write_strtable(fw, &labels) == 0 && write_strtable(fw, &strs) == 0;
+        size_t r = 0, a = 0, g = 0;
+        for (size_t i = 0; ok && i < count; i++) {
+            ok = fwrite(&bc[i], sizeof *bc, 1, fw) == 1
+              && fwrite(br + r, sizeof *br, bc[i].nregs, fw) == bc[i].nregs
+              && fwrite(ba + a, sizeof *ba, bc[i].natt, fw) == bc[i].natt
+              && fwrite(bg + g, sizeof *bg, bc[i].ngrades, fw) == bc[i].ngrades
+              && fwrite(br + r + bc[i].nregs, sizeof *br, bc[i].nwait, fw) == bc[i].nwait;
+            r += bc[i].nregs + bc[i].nwait; a += bc[i].natt; g += bc[i].ngrades;
+        }
+        if (!ok) { fclose(fw); remove(tmpname); }
+        else ok = finish_rewrite(fw, fname, tmpname) == 0;
+    } else {
+        ok = 0;
+    }
+    free(bc); free(br); free(ba); free(bg);
+    strtable_free(&labels);
+    strtable_free(&strs);
+    return ok ? 0 : -1;
+}
+
+int save_binary_snapshot(const char *fname) {
+    if (keep_rejected(NULL) != 0) return -1;
+    return write_binary_snapshot(registry.courses, registry.count, fname);
+}
+
+/* Read a string table as views into the mapping; NULL if truncated */
+StrView *read_strtable(const char **p, const char *end, uint32_t count) {
+    StrView *sv = xrealloc(NULL, (count + 1) * sizeof *sv);
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t len;
+        if (end - *p < (long)sizeof len) { free(sv); return NULL; }
+        memcpy(&len, *p, sizeof len);
+        *p += sizeof len;
+        if (end - *p < len) { free(sv); return NULL; }
+        sv[i] = (StrView){ *p, len };
+        *p += len;
+    }
+    return sv;
+}
+
+/* Intern a file string through a per-file id cache */
+int bin_intern(const StrView *sv, int *ids, uint32_t i) {
+    if (ids[i] < 0) {
+        char buf[MAX_FIELD];
+        view_copy(buf, sv[i]);
+        ids[i] = intern(&strings, buf);
+    }
+    return ids[i];
+}
+
+/* Load n BinReg records into a course's registrations or waitlist */
+int load_bin_regs(const char *p, uint32_t n, const BinHeader *h, const StrView *sv, int *sid,
+                  const StrView *lv, int *lid, Course *c, int waitlist) {
+    for (uint32_t j = 0; j < n; j++, p += sizeof(BinReg)) {
+        BinReg r;
+        memcpy(&r, p, sizeof r);
+        if (r.roll >= h->nstrings || r.name >= h->nstrings || r.email >= h->nstrings
+            || r.year >= h->nlabels) return -1;
+        int roll = bin_intern(sv, sid, r.roll), year = bin_intern(lv, lid, r.year);
+        int name = bin_intern(sv, sid, r.name), email = bin_intern(sv, sid, r.email);
+        if (waitlist) waitlist_push(c, roll, name, email, year);
+        else add_registration(c, roll, name, email, year);
+    }
+    return 0;
+}
+
+/* Returns 0 on success (a missing file loads as empty), -1 if corrupt */
+int load_binary_snapshot(const char *fname) {
+    CsvScanner sc;   /* used only for the mapping */
+    if (scanner_open(&sc, fname) != 0) return -1;
+    if (sc.size == 0) { scanner_close(&sc); return 0; }
+    const char *p = sc.data, *end = sc.data + sc.size;
+    StrView *lv = NULL, *sv = NULL;
+    int *lid = NULL, *sid = NULL;
+    int ok = 0;
+    BinHeader h;
+    if (sc.size < sizeof h) goto done;
+    memcpy(&h, p, sizeof h);
+    p += sizeof h;
+    if (memcmp(h.magic, "CRSB", 4) != 0 || h.version < 1 || h.version > BIN_VERSION) goto done;
+    size_t course_size = h.version == 1 ? BIN_V1_COURSE_SIZE : sizeof(BinCourse);
+    if (!(lv = read_strtable(&p, end, h.nlabels)) || !(sv = read_strtable(&p, end, h.nstrings))) goto done;
+    lid = xrealloc(NULL, (h.nlabels + 1) * sizeof *lid);
+    sid = xrealloc(NULL, (h.nstrings + 1) * sizeof *sid);
+    for (uint32_t i = 0; i < h.nlabels; i++) lid[i] = -1;
+    for (uint32_t i = 0; i < h.nstrings; i++) sid[i] = -1;
+
+    char name[MAX_FIELD];
+    for (uint32_t i = 0; i < h.ncourses; i++) {
+        BinCourse bc = { 0 };
+        if ((size_t)(end - p) < course_size) goto done;
+        memcpy(&bc, p, course_size);
+        p += course_size;
+        const char *regs = p;
+        const char *att = regs + (size_t)bc.nregs * sizeof(BinReg);
+        const char *grd = att + (size_t)bc.natt * sizeof(BinAtt);
+        const char *wait = grd + (size_t)bc.ngrades * sizeof(BinGrade);
+        p = wait + (size_t)bc.nwait * sizeof(BinReg);
+        if (bc.name >= h.nstrings || p > end) goto done;
+        view_copy(name, sv[bc.name]);
+        Course *c = add_course(name, bc.listed != 0);
+        if (load_bin_regs(regs, bc.nregs, &h, sv, sid, lv, lid, c, 0) != 0) goto done;
+        for (uint32_t j = 0; j < bc.natt; j++, att += sizeof(BinAtt)) {
+            BinAtt r;
+            memcpy(&r, att, sizeof r);
+            if (r.roll >= h.nstrings || r.sem >= h.nlabels) goto done;
+            SemValue v = { .percent = r.percent / 100.0f };
+            upsert_sem_record(&c->attendance, bin_intern(sv, sid, r.roll), bin_intern(lv, lid, r.sem), v);
+        }
+        for (uint32_t j = 0; j < bc.ngrades; j++, grd += sizeof(BinGrade)) {
+            BinGrade r;
+            memcpy(&r, grd, sizeof r);
+            if (r.roll >= h.nstrings || r.sem >= h.nlabels || r.grade >= h.nlabels) goto done;
+            SemValue v = { .grade = bin_intern(lv, lid, r.grade) };
+            upsert_sem_record(&c->grades, bin_intern(sv, sid, r.roll), bin_intern(lv, lid, r.sem), v);
+        }
+        if (load_bin_regs(wait, bc.nwait, &h, sv, sid, lv, lid, c, 1) != 0) goto done;
+    }
+    ok = p == end;
+done:
+    free(lv); free(sv); free(lid); free(sid);
+    scanner_close(&sc);
+    if (!ok) printf("%s is corrupt or from an unsupported version.\n", fname);
+    return ok ? 0 : -1;
+}
+
+/* ---------- Sharded storage ----------
+ * One directory per course under shards/, holding the course's
+ * registrations, its waitlist, and one attendance and one grade file per
+ * semester. Rows leave out the columns the file already implies:
+ *   registrations, waitlist   roll,name,email,year
+ *   attendance, grades        roll,value
+ * shards/manifest.csv names the live file of every shard:
+ *   V,version,generation
+ *   R,course,file              W,course,file
+ *   A,course,sem,file          G,course,sem,file
+ * Changes mark the shards they touch, and a save rewrites only those,
+ * under new names carrying the next generation. The manifest is then
+ * replaced through a temp copy, which is the commit point: a crash before
+ * the rename leaves the old manifest and the old files, and the new files
+ * are swept at the next load because no manifest names them. Superseded
+ * files are removed after the commit.
+ *
+ * Selected with CRS_STORAGE=sharded, or automatically once the manifest
+ * exists. Without a manifest the CSV files are loaded, so the first
+ * compaction migrates them; `crs convert shards` does it right away. */
+
+#define SHARD_VERSION 1
+
+typedef struct {
+    char kind;               /* 'R', 'W', 'A' or 'G', as in the journal */
+    int sem;                 /* interned semester for 'A'/'G', else -1 */
+    int dirty;               /* changed since the last save */
+    char file[MAX_FIELD];    /* live file under SHARD_DIR, "" if none */
+    char next[MAX_FIELD];    /* file written by the save in progress */
+} ShardFile;
+
+struct Shard {
+    char dir[16];            /* "c0001", assigned when a file is first written */
+    int seeded;              /* files[] covers every table and semester */
+    ShardFile *files;
+    size_t count, cap;
+};
+
+long shard_generation;
+int shard_last_id;
+
+struct Shard *shard_of(Course *c) {
+    if (!c->shard) {
+        c->shard = xrealloc(NULL, sizeof *c->shard);
+        memset(c->shard, 0, sizeof *c->shard);
+    }
+    return c->shard;
+}
+
+ShardFile *shard_file(Course *c, char kind, int sem) {
+    struct Shard *s = shard_of(c);
+    for (size_t i = 0; i < s->count; i++)
+        if (s->files[i].kind == kind && s->files[i].sem == sem) return &s->files[i];
+    s->files = grow_array(s->files, &s->cap, s->count + 1, sizeof *s->files);
+    ShardFile *f = &s->files[s->count++];
+    memset(f, 0, sizeof *f);
+    f->kind = kind;
+    f->sem = sem;
+    return f;
+}
+
+/* Mark one shard of a course as changed. Callers hold the course lock;
+   kind is the journal record letter and sem is -1 for 'R' and 'W'. */
+void shard_touch(Course *c, char kind, int sem) {
+    shard_file(c, kind, sem)->dirty = 1;
+}
+
+/* A drop cascades to every semester and may promote from the waitlist */
+void shard_touch_all(Course *c) {
+    shard_touch(c, 'R', -1);
+    shard_touch(c, 'W', -1);
+    for (size_t i = 0; i < c->shard->count; i++) c->shard->files[i].dirty = 1;
+}
+
+/* A course saved for the first time gets a shard for every table and
+   semester it holds */
+void shard_seed(Course *c) {
+    shard_touch(c, 'R', -1);
+    shard_touch(c, 'W', -1);
+    for (int g = 0; g < 2; g++) {
+        SemTable *t = sem_table(c, g);
+        for (size_t j = 0; j < t->count; j++) shard_touch(c, g ? 'G' : 'A', t->rows[j].sem);
+    }
+    c->shard->seeded = 1;
+}
+
+const char *shard_kind_name(char kind) {
+    switch (kind) {
+    case 'R': return "registrations";
+    case 'W': return "waitlist";
+    case 'A': return "attendance";
+    }
+    return "grades";
+}
+
+/* Name f->next for generation gen. Semester names are reduced to
+   [A-Za-z0-9._] for the file name; the manifest keeps the real name. */
+void shard_next_name(struct Shard *s, ShardFile *f, long gen) {
+    char safe[64] = "";
+    if (f->sem >= 0) {
+        size_t n = 0;
+        safe[n++] = '-';
+        for (const char *p = str_of(f->sem); *p && n < sizeof safe - 1; p++)
+            safe[n++] = isalnum((unsigned char)*p) || *p == '.' || *p == '_' ? *p : '_';
+        safe[n] = '\0';
+    }
+    snprintf(f->next, sizeof f->next, "%s/%s%s-%ld.csv", s->dir, shard_kind_name(f->kind), safe, gen);
+    /* two semesters that reduce to the same name are told apart by position */
+    for (ShardFile *o = s->files; o < f; o++) {
+        if (strcmp(o->next, f->next) != 0) continue;
+        snprintf(f->next, sizeof f->next, "%s/%s%s-%ld.%zu.csv", s->dir, shard_kind_name(f->kind),
+                 safe, gen, (size_t)(f - s->files));
+        break;
+    }
+}
+
+/* Write a dirty shard as a new file (f->next, fsync'd). A shard with no
+   rows gets no file. Returns 0 on success. */
+int write_shard_file(Course *c, ShardFile *f, long gen) {
+    struct Shard *s = c->shard;
+    int regs = f->kind == 'R' || f->kind == 'W';
+    SemTable *t = regs ? NULL : sem_table(c, f->kind == 'G');
+    Registration *rows = f->kind == 'W' ? c->waitlist.rows : c->regs.rows;
+    size_t count = regs ? (f->kind == 'W' ? c->waitlist.count : c->regs.count) : t->count;
+    size_t live = 0;
+    for (size_t j = 0; j < count; j++) live += regs || t->rows[j].sem == f->sem;
+    f->next[0] = '\0';
+    if (live == 0) return 0;
+
+    char path[MAX_FIELD + sizeof SHARD_DIR + 1];
+    if (!s->dir[0]) snprintf(s->dir, sizeof s->dir, "c%04d", ++shard_last_id);
+    snprintf(path, sizeof path, "%s/%s", SHARD_DIR, s->dir);
+    mkdir(path, 0755);
+    shard_next_name(s, f, gen);
+    snprintf(path, sizeof path, "%s/%s", SHARD_DIR, f->next);
+    FILE *fw = begin_rewrite(path);
+    if (!fw) { f->next[0] = '\0'; return -1; }
+    char buf[MAX_FIELD];
+    for (size_t j = 0; j < count; j++) {
+        if (regs) {
+            Registration *r = &rows[j];
+            fprintf(fw, "%s,%s,%s,%s\n", str_of(r->roll), str_of(r->name), str_of(r->email), str_of(r->year));
+        } else if (t->rows[j].sem == f->sem) {
+            fprintf(fw, "%s,%s\n", str_of(t->rows[j].roll), format_sem_value(f->kind == 'G', t->rows[j].value, buf));
+        }
+    }
+    return end_rewrite(fw);
+}
+
+/* Undo a failed save: drop the files it wrote, keep the shards dirty */
+void discard_shard_files() {
+    char path[MAX_FIELD + sizeof SHARD_DIR + 1];
+    for (size_t i = 0; i < registry.count; i++) {
+        struct Shard *s = registry.courses[i]->shard;
+        for (size_t j = 0; s && j < s->count; j++) {
+            if (!s->files[j].next[0]) continue;
+            snprintf(path, sizeof path, "%s/%s", SHARD_DIR, s->files[j].next);
+            remove(path);
+            s->files[j].next[0] = '\0';
+        }
+    }
+    remove(SHARD_MANIFEST ".tmp");
+}
+
+/* Rewrite the changed shards and commit them with a new manifest */
+int save_sharded_snapshot() {
+    long gen = shard_generation + 1;
+    char path[MAX_FIELD + sizeof SHARD_DIR + 1];
+    int ok = mkdir(SHARD_DIR, 0755) == 0 || errno == EEXIST;
+    /* the files replaced: dirty shards, and the CSV files on a first save */
+    for (size_t i = 0; ok && i < CSV_FILE_COUNT; i++) ok = keep_rejected(csv_files[i].fname) == 0;
+    for (size_t i = 0; ok && i < registry.count; i++) {
+        struct Shard *s = shard_of(registry.courses[i]);
+        for (size_t j = 0; ok && j < s->count; j++) {
+            if (!s->files[j].dirty || !s->files[j].file[0]) continue;
+            snprintf(path, sizeof path, "%s/%s", SHARD_DIR, s->files[j].file);
+            ok = keep_rejected(path) == 0;
+        }
+    }
+    if (!ok) return -1;
+    defer_rewrites();
+    for (size_t i = 0; ok && i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        struct Shard *s = shard_of(c);
+        if (!s->seeded) shard_seed(c);
+        int wrote = 0;
+        for (size_t j = 0; ok && j < s->count; j++) {
+            if (!s->files[j].dirty) continue;
+            ok = write_shard_file(c, &s->files[j], gen) == 0;
+            wrote = 1;
+        }
+        if (ok && wrote && s->dir[0]) {
+            snprintf(path, sizeof path, "%s/%s", SHARD_DIR, s->dir);
+            ok = sync_dir_at(path) == 0;
+        }
+    }
+    ok = sync_rewrites() == 0 && ok;
+    /* new course directories must be durable before the manifest names them */
+    FILE *fw = ok && sync_dir_at(SHARD_DIR) == 0 ? begin_rewrite(SHARD_MANIFEST ".tmp") : NULL;
+    if (!fw) { discard_shard_files(); return -1; }
+    fprintf(fw, "V,%d,%ld\n", SHARD_VERSION, gen);
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        for (size_t j = 0; j < c->shard->count; j++) {
+            ShardFile *f = &c->shard->files[j];
+            const char *file = f->dirty ? f->next : f->file;
+            if (!file[0]) continue;
+            if (f->sem >= 0) fprintf(fw, "%c,%s,%s,%s\n", f->kind, c->name, str_of(f->sem), file);
+            else fprintf(fw, "%c,%s,%s\n", f->kind, c->name, file);
+        }
+    }
+    if (end_rewrite(fw) != 0 || rename(SHARD_MANIFEST ".tmp", SHARD_MANIFEST) != 0
+        || sync_dir_at(SHARD_DIR) != 0) {
+        discard_shard_files();
+        return -1;
+    }
+    /* committed: retire the superseded files and the empty shards */
+    shard_generation = gen;
+    for (size_t i = 0; i < registry.count; i++) {
+        struct Shard *s = registry.courses[i]->shard;
+        size_t keep = 0;
+        for (size_t j = 0; j < s->count; j++) {
+            ShardFile *f = &s->files[j];
+            if (f->dirty) {
+                if (f->file[0]) {
+                    snprintf(path, sizeof path, "%s/%s", SHARD_DIR, f->file);
+                    remove(path);
+                }
+                memcpy(f->file, f->next, sizeof f->file);
+                f->next[0] = '\0';
+                f->dirty = 0;
+            }
+            if (f->file[0]) s->files[keep++] = *f;
+        }
+        s->count = keep;
+    }
+    return 0;
+}
+
+/* Rows of one shard file; the course and semester come from the manifest */
+void load_shard_file(Course *c, char kind, int sem, const char *file) {
+    char path[MAX_FIELD + sizeof SHARD_DIR + 1];
+    snprintf(path, sizeof path, "%s/%s", SHARD_DIR, file);
+    if (!file_exists(path)) { printf("Missing shard file %s.\n", path); return; }
+    const char *label = kind == 'R' ? "shards (registrations)" : kind == 'W' ? "shards (waitlist)"
+                      : kind == 'A' ? "shards (attendance)" : "shards (grades)";
+    LoadSpec sp = { kind, path, c, sem, load_report(label, kind) };
+    load_rows(&sp);
+}
+
+/* Remove what an interrupted save left under SHARD_DIR: files the
+   manifest does not name, the manifest temp copy, empty directories */
+void sweep_shards(StrTable *live) {
+    DIR *top = opendir(SHARD_DIR);
+    if (!top) return;
+    char path[8 * MAX_FIELD], rel[8 * MAX_FIELD];
+    struct dirent *d;
+    while ((d = readdir(top))) {
+        if (d->d_name[0] == '.' || strcmp(d->d_name, "manifest.csv") == 0) continue;
+        snprintf(path, sizeof path, "%s/%s", SHARD_DIR, d->d_name);
+        DIR *sub = opendir(path);
+        if (!sub) { remove(path); continue; }
+        struct dirent *e;
+        while ((e = readdir(sub))) {
+            if (e->d_name[0] == '.') continue;
+            snprintf(rel, sizeof rel, "%s/%s", d->d_name, e->d_name);
+            if (intern_find(live, rel) >= 0) continue;
+            snprintf(rel, sizeof rel, "%s/%s/%s", SHARD_DIR, d->d_name, e->d_name);
+            remove(rel);
+        }
+        closedir(sub);
+        rmdir(path);   /* only succeeds once empty */
+    }
+    closedir(top);
+}
+
+/* Read ahead every file the manifest names before loading them in turn */
+void prefetch_shards() {
+    CsvScanner sc;
+    if (aio_backend == AIO_OFF || scanner_open(&sc, SHARD_MANIFEST) != 0) return;
+    char **paths = NULL;
+    size_t n = 0, cap = 0;
+    StrView v[4];
+    int k;
+    while ((k = scanner_next(&sc, v, 4, ','))) {
+        if (k < 3 || v[0].len != 1 || !strchr("RWAG", v[0].ptr[0])) continue;
+        paths = grow_array(paths, &cap, n + 1, sizeof *paths);
+        paths[n] = xrealloc(NULL, sizeof SHARD_DIR + 1 + v[k - 1].len);
+        sprintf(paths[n], "%s/%.*s", SHARD_DIR, (int)v[k - 1].len, v[k - 1].ptr);
+        n++;
+    }
+    scanner_close(&sc);
+    aio_prefetch((const char **)paths, n);
+    for (size_t i = 0; i < n; i++) free(paths[i]);
+    free(paths);
+}
+
+int load_sharded_snapshot() {
+    CsvScanner sc;
+    prefetch_shards();
+    if (scanner_open(&sc, SHARD_MANIFEST) != 0) return -1;
+    StrTable live;
+    strtable_init(&live);
+    StrView v[4];
+    char f[4][MAX_FIELD];
+    int n, ok = 1;
+    while (ok && (n = scanner_next(&sc, v, 4, ','))) {
+        views_to_fields(v, n, f, 4);
+        char kind = strlen(f[0]) == 1 ? f[0][0] : '?';
+        if (kind == 'V') {
+            ok = n == 3 && atoi(f[1]) == SHARD_VERSION;
+            shard_generation = atol(f[2]);
+            continue;
+        }
+        int per_sem = kind == 'A' || kind == 'G';
+        if (!strchr("RWAG", kind) || n != (per_sem ? 4 : 3)) { ok = 0; break; }
+        const char *file = f[n - 1];
+        Course *c = add_course(f[1], 0);
+        ShardFile *sf = shard_file(c, kind, per_sem ? intern(&strings, f[2]) : -1);
+        snprintf(sf->file, sizeof sf->file, "%s", file);
+        struct Shard *s = c->shard;
+        s->seeded = 1;
+        /* the course directory is the file's first path component */
+        const char *slash = strchr(file, '/');
+        if (!s->dir[0] && slash && (size_t)(slash - file) < sizeof s->dir) {
+            memcpy(s->dir, file, (size_t)(slash - file));
+            s->dir[slash - file] = '\0';
+            if (s->dir[0] == 'c' && atoi(s->dir + 1) > shard_last_id) shard_last_id = atoi(s->dir + 1);
+        }
+        intern(&live, file);
+        load_shard_file(c, kind, sf->sem, file);
+    }
+    scanner_close(&sc);
+    if (ok) sweep_shards(&live);
+    else printf("%s is corrupt or from an unsupported version.\n", SHARD_MANIFEST);
+    strtable_free(&live);
+    return ok ? 0 : -1;
+}
+
+/* Load courses.txt and the snapshot for the active storage mode */
+void load_courses() {
+    CsvScanner sc;
+    StrView v[5];
+    char f[5][MAX_FIELD];
+    if (scanner_open(&sc, "courses.txt") != 0) return;
+    /* name[,capacity[,credits[,slots[,prerequisites]]]] */
+    int n;
+    while ((n = scanner_next(&sc, v, 5, ','))) {
+        views_to_fields(v, n, f, 5);
+        Course *c = add_course(f[0], 1);
+        c->capacity = atoi(f[1]) > 0 ? atoi(f[1]) : 0;
+        if (n > 2 && set_course_rules(c, f[2], f[3], f[4]) != 0)
+            printf("courses.txt line %ld: bad time slots '%s' for %s.\n", sc.line_no, f[3], c->name);
+    }
+    scanner_close(&sc);
+    for (size_t i = 0; i < registry.count; i++)
+        for (size_t p = 0; p < registry.courses[i]->nprereqs; p++)
+            if (!registry.courses[i]->prereqs[p]->listed)
+                printf("courses.txt: %s requires %s, which is not a listed course.\n",
+                       registry.courses[i]->name, registry.courses[i]->prereqs[p]->name);
+}
+
+int load_registry() {
+    MetricScope m = metric_begin(OP_LOAD);
+    load_reports_reset();
+    load_courses();
+    int rc = 0;
+    if (storage_mode == STORAGE_BINARY) {
+        double start = now_seconds();
+        rc = load_binary_snapshot(DATA_BIN);
+        LoadReport *r = load_report(DATA_BIN, 'R');
+        struct stat st;
+        r->files = 1;
+        r->bytes = stat(DATA_BIN, &st) == 0 ? st.st_size : 0;
+        for (size_t i = 0; i < registry.count; i++) {
+            Course *c = registry.courses[i];
+            r->rows += (long)(c->regs.count + c->waitlist.count + c->attendance.count + c->grades.count);
+        }
+        r->seconds = now_seconds() - start;
+        r->threads = 1;
+        check_orphans(DATA_BIN " (attendance)", DATA_BIN " (grades)");
+    } else if (storage_mode == STORAGE_SHARDED && file_exists(SHARD_MANIFEST)) {
+        rc = load_sharded_snapshot();
+        check_orphans("shards (attendance)", "shards (grades)");
+    } else {
+        load_csv_snapshot();
+        check_orphans("attendance.csv", "grades.csv");
+    }
+    load_warn(stderr);
+    metric_end(&m);
+    return rc;
+}
+
+int save_snapshot() {
+    if (storage_mode == STORAGE_BINARY) return save_binary_snapshot(DATA_BIN);
+    if (storage_mode == STORAGE_SHARDED) return save_sharded_snapshot();
+    return save_csv_snapshot();
+}
+
+/* ---------- Write-ahead journal ----------
+ * Every change is appended to journal.log as one line instead of rewriting
+ * the CSV files:
+ *   R,course,roll,name,email,year   enroll
+ *   W,course,roll,name,email,year   join the waitlist of a full course
+ *   D,course,roll                   drop (cascades to attendance/grades and
+ *                                   promotes the head of the waitlist)
+ *   A,course,roll,sem,percent       attendance upsert
+ *   G,course,roll,sem,grade         grade upsert
+ * The journal is replayed over the snapshot at startup and folded into it
+ * (compacted) once it grows past JOURNAL_COMPACT_THRESHOLD records, and on
+ * exit. Replay is idempotent, so a crash between writing the
+ * snapshots and truncating the journal loses nothing. A record torn by a
+ * crash (no trailing newline) is cut off at startup.
+ *
+ * Records carry sequence numbers that keep counting across compactions:
+ * compaction replaces the journal with one whose first line is
+ *   S,base
+ * the sequence number of its first record, so the state after the
+ * journal's n-th record is position base + n. While ARCHIVE_DIR exists
+ * (a backup has been taken, see Backups) the replaced journal is moved
+ * there as journal-<base>.log instead of being discarded, so deltas since
+ * an older position can still be exported.
+ *
+ * A change is acknowledged only after its record is fsync'd. Commits are
+ * grouped: one thread fsyncs everything appended so far while the others
+ * wait on journal_synced, so a burst of concurrent drops shares a single
+ * fsync instead of paying for one each. CRS_FSYNC=off skips the fsync
+ * (for benchmarks on throwaway data).
+ *
+ * With an async backend (CRS_AIO) an append only formats the record into
+ * an in-memory batch and never touches the file. A flusher thread hands
+ * the batch to aio_run() as a write linked to its fdatasync, and records
+ * appended meanwhile collect in the next batch, so appends are pipelined
+ * behind the I/O in flight and journal_sync() just waits for the flusher.
+ * The batch buffer, journal_fd and journal_size are guarded by
+ * journal_lock like the rest. */
+
+#define JOURNAL_COMPACT_THRESHOLD 4096
+#define ARCHIVE_DIR "archive"
+
+FILE *journal;
+long journal_records;
+long journal_base;         /* sequence number of the journal's first record */
+pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Group commit state, guarded by journal_lock. LSNs number the records
+   appended since startup. */
+long journal_lsn;          /* last record appended */
+long journal_durable;      /* last record known to be on disk */
+int journal_syncing;       /* a thread is inside fdatasync */
+int journal_fsync = 1;
+long journal_fsyncs;       /* fsyncs issued, for reporting */
+pthread_cond_t journal_synced = PTHREAD_COND_INITIALIZER;
+
+/* Async journal state */
+int journal_fd = -1;
+long long journal_size;    /* bytes handed to the flusher so far */
+char *journal_buf;         /* records waiting for the flusher */
+size_t journal_buf_len, journal_buf_cap;
+int journal_flushing;      /* the flusher has a batch in flight */
+int journal_failed;        /* a batch failed; its records are not durable */
+int journal_flusher_started;
+pthread_cond_t journal_pending = PTHREAD_COND_INITIALIZER;
+
+/* Apply one parsed journal record to the registry */
+int apply_journal_record(char **fld, int n) {
+    if (n < 3 || strlen(fld[0]) != 1) return -1;
+    Course *c = add_course(fld[1], 0);
+    int roll = intern(&strings, fld[2]);
+    SemValue v;
+    switch (fld[0][0]) {
+    case 'R':
+        if (n < 6) return -1;
+        shard_touch(c, 'R', -1);
+        return add_registration(c, roll, intern(&strings, fld[3]), intern(&strings, fld[4]),
+                                intern(&strings, fld[5]));
+    case 'W':
+        if (n < 6) return -1;
+        shard_touch(c, 'W', -1);
+        return waitlist_push(c, roll, intern(&strings, fld[3]), intern(&strings, fld[4]),
+                             intern(&strings, fld[5]));
+    case 'D':
+        shard_touch_all(c);
+        return drop_registration(c, roll) < 0 ? -1 : 0;
+    case 'A':
+    case 'G': {
+        if (n < 5 || parse_sem_value(fld[0][0] == 'G', fld[4], &v) != 0) return -1;
+        int sem = intern(&strings, fld[3]);
+        upsert_sem_record(sem_table(c, fld[0][0] == 'G'), roll, sem, v);
+        shard_touch(c, fld[0][0], sem);
+        return 0;
+    }
+    }
+    return -1;
+}
+
+void replay_journal() {
+    CsvScanner sc;
+    MetricScope m = metric_begin(OP_LOAD);
+    /* a compaction that stopped between moving the old journal away and
+       installing the new one */
+    if (!file_exists(JOURNAL_FILE) && file_exists(JOURNAL_FILE ".tmp")) rename(JOURNAL_FILE ".tmp", JOURNAL_FILE);
+    remove(JOURNAL_FILE ".tmp");
+    if (scanner_open(&sc, JOURNAL_FILE) != 0) { metric_end(&m); return; }
+    /* drop a torn last record */
+    const char *tail = sc.end;
+    while (tail > sc.data && tail[-1] != '\n') tail--;
+    if (tail != sc.end) {
+        printf("Discarding an incomplete journal record.\n");
+        sc.end = tail;
+        if (truncate(JOURNAL_FILE, tail - sc.data) != 0) printf("Could not trim %s.\n", JOURNAL_FILE);
+    }
+    StrView v[6];
+    char f[6][MAX_FIELD];
+    char *fld[6] = { f[0], f[1], f[2], f[3], f[4], f[5] };
+    int n;
+    long bad = 0;
+    while ((n = scanner_next(&sc, v, 6, ','))) {
+        views_to_fields(v, n, f, 6);
+        if (strcmp(f[0], "S") == 0) { journal_base = atol(f[1]); continue; }
+        /* a value this version does not accept (say free-text attendance
+           from an older one) is kept for rejected.log, not compacted away */
+        if ((f[0][0] == 'A' || f[0][0] == 'G') && !f[0][1]) {
+            SemValue sv;
+            if (n < 5 || parse_sem_value(f[0][0] == 'G', f[4], &sv) != 0) {
+                size_t len = (size_t)(sc.pos - v[0].ptr) - (sc.pos[-1] == '\n');
+                if (len > 0 && v[0].ptr[len - 1] == '\r') len--;
+                reject_line(JOURNAL_FILE, sc.line_no, v[0].ptr, len);
+                journal_records++;
+                bad++;
+                continue;
+            }
+        }
+        apply_journal_record(fld, n);
+        journal_records++;
+    }
+    if (bad)
+        printf("%s: skipped %ld record%s with a bad value; they go to %s at the next compaction.\n", JOURNAL_FILE,
+               bad, bad == 1 ? "" : "s", REJECTED_FILE);
+    scanner_close(&sc);
+    metric_end(&m);
+}
+
+/* Replace the journal with an empty one starting at sequence `base`,
+   archiving the old one if archiving is on. Called with journal_lock
+   held and nothing in flight; the next append reopens the file. */
+int journal_restart(long base) {
+    if (keep_rejected(JOURNAL_FILE) != 0) return -1;
+    if (journal) fclose(journal);
+    journal = NULL;
+    if (journal_fd >= 0) close(journal_fd);
+    journal_fd = -1;
+    FILE *f = begin_rewrite(JOURNAL_FILE ".tmp");
+    if (!f) return -1;
+    fprintf(f, "S,%ld\n", base);
+    if (end_rewrite(f) != 0) { remove(JOURNAL_FILE ".tmp"); return -1; }
+    if (base > journal_base && file_exists(ARCHIVE_DIR) && file_exists(JOURNAL_FILE)) {
+        char path[MAX_FIELD];
+        snprintf(path, sizeof path, "%s/journal-%ld.log", ARCHIVE_DIR, journal_base);
+        if (rename(JOURNAL_FILE, path) != 0 || sync_dir_at(ARCHIVE_DIR) != 0) printf("Could not archive %s.\n", JOURNAL_FILE);
+    }
+    if (rename(JOURNAL_FILE ".tmp", JOURNAL_FILE) != 0 || sync_dir() != 0) return -1;
+    journal_base = base;
+    journal_records = 0;
+    journal_failed = 0;
+    return 0;
+}
+
+/* Fold the journal into the snapshot and start an empty journal.
+   Takes the registry write lock, so no change can be in flight. */
+int compact_journal() {
+    MetricScope m = metric_begin(OP_COMPACT);
+    pthread_rwlock_wrlock(&registry.lock);
+    /* no writes may land in the journal after it is replaced */
+    journal_drain();
+    int rc = save_snapshot();
+    if (rc == 0) {
+        pthread_mutex_lock(&journal_lock);
+        rc = journal_restart(journal_base + journal_records);
+        /* everything appended so far is in the fsync'd snapshot */
+        journal_durable = journal_lsn;
+        pthread_cond_broadcast(&journal_synced);
+        pthread_mutex_unlock(&journal_lock);
+    }
+    pthread_rwlock_unlock(&registry.lock);
+    metric_end(&m);
+    return rc;
+}
+
+/* Compact once the journal is past the threshold. Called after a change
+   has released its locks, never from inside journal_append. */
+void maybe_compact() {
+    static atomic_int compacting;
+    pthread_mutex_lock(&journal_lock);
+    int due = journal_records >= JOURNAL_COMPACT_THRESHOLD;
+    pthread_mutex_unlock(&journal_lock);
+    /* threads that saw the same full journal must not compact it again
+       one after another */
+    if (due && !atomic_exchange(&compacting, 1)) {
+        compact_journal();
+        atomic_store(&compacting, 0);
+    }
+}
+
+/* Write out batches until the process exits */
+void *journal_flusher(void *arg) {
+    (void)arg;
+    char *batch = NULL;
+    size_t batch_cap = 0;
+    pthread_mutex_lock(&journal_lock);
+    for (;;) {
+        while (journal_buf_len == 0) pthread_cond_wait(&journal_pending, &journal_lock);
+        /* take the batch and leave the empty buffer for the next one */
+        char *full = journal_buf;
+        size_t len = journal_buf_len, cap = journal_buf_cap;
+        journal_buf = batch;
+        journal_buf_cap = batch_cap;
+        journal_buf_len = 0;
+        batch = full;
+        batch_cap = cap;
+        long target = journal_lsn;
+        AioOp ops[2] = {
+            { .type = AIO_WRITE, .fd = journal_fd, .buf = batch, .len = len, .off = journal_size,
+              .link = journal_fsync },
+            { .type = AIO_DATASYNC, .fd = journal_fd },
+        };
+        journal_size += len;
+        journal_flushing = 1;
+        pthread_mutex_unlock(&journal_lock);
+        int ok = aio_run(ops, journal_fsync ? 2 : 1) == 0;
+        pthread_mutex_lock(&journal_lock);
+        journal_flushing = 0;
+        if (journal_fsync) journal_fsyncs++;
+        if (!ok) journal_failed = 1;
+        else if (target > journal_durable) journal_durable = target;
+        pthread_cond_broadcast(&journal_synced);
+    }
+    return NULL;
+}
+
+/* Queue formatted records for the flusher; no I/O on the caller's thread */
+long journal_append_async(const char *rec, size_t len, long count) {
+    pthread_mutex_lock(&journal_lock);
+    if (journal_fd < 0) {
+        journal_fd = open(JOURNAL_FILE, O_WRONLY | O_CREAT, 0644);
+        metric_add(METRIC_OPENS, 1);
+        struct stat st;
+        journal_size = journal_fd >= 0 && fstat(journal_fd, &st) == 0 ? st.st_size : 0;
+    }
+    if (journal_fd >= 0 && !journal_flusher_started) {
+        pthread_t t;
+        journal_flusher_started = pthread_create(&t, NULL, journal_flusher, NULL) == 0;
+        if (journal_flusher_started) pthread_detach(t);
+    }
+    long lsn = -1;
+    if (journal_fd >= 0 && journal_flusher_started) {
+        journal_buf = grow_array(journal_buf, &journal_buf_cap, journal_buf_len + len, 1);
+        memcpy(journal_buf + journal_buf_len, rec, len);
+        journal_buf_len += len;
+        metric_add(METRIC_WRITTEN, (long long)len);
+        journal_records += count;
+        lsn = journal_lsn += count;
+        pthread_cond_signal(&journal_pending);
+    }
+    pthread_mutex_unlock(&journal_lock);
+    return lsn;
+}
+
+/* Wait until the flusher has written everything appended so far */
+void journal_drain() {
+    pthread_mutex_lock(&journal_lock);
+    while (journal_buf_len > 0 || journal_flushing) pthread_cond_wait(&journal_synced, &journal_lock);
+    pthread_mutex_unlock(&journal_lock);
+}
+
+/* Drain and close the journal; the next append reopens it */
+void journal_close() {
+    journal_drain();
+    pthread_mutex_lock(&journal_lock);
+    if (journal) fclose(journal);
+    journal = NULL;
+    if (journal_fd >= 0) close(journal_fd);
+    journal_fd = -1;
+    pthread_mutex_unlock(&journal_lock);
+}
+
+/* Append count formatted records with one write, so either all of them
+   reach the file or none do, and make them visible to other readers.
+   Callers hold the course lock, so records for one course are journaled
+   (and announced on the change feed) in the order they are applied.
+   Returns the last record's LSN for journal_sync(), or -1 on a write
+   error. */
+long journal_append_records(const char *recs, size_t len, long count) {
+    long lsn = -1;
+    if (aio_backend != AIO_OFF) {
+        lsn = journal_append_async(recs, len, count);
+    } else {
+        pthread_mutex_lock(&journal_lock);
+        if (!journal) {
+            journal = fopen(JOURNAL_FILE, "a");
+            metric_add(METRIC_OPENS, 1);
+        }
+        if (journal) {
+            /* the stream is never left holding data, so write its fd directly */
+            int fd = fileno(journal);
+            off_t end = lseek(fd, 0, SEEK_END);
+            size_t done = 0;
+            ssize_t w;
+            while (done < len && (w = write(fd, recs + done, len - done)) > 0) done += (size_t)w;
+            if (done > 0) metric_add(METRIC_WRITTEN, (long long)done);
+            if (done == len) {
+                journal_records += count;
+                lsn = journal_lsn += count;
+            } else if (done > 0 && (end < 0 || ftruncate(fd, end) != 0)) {
+                printf("Could not cut a partial write from %s.\n", JOURNAL_FILE);
+            }
+        }
+        pthread_mutex_unlock(&journal_lock);
+    }
+    for (size_t off = 0; lsn > 0 && off < len;) {
+        const char *nl = memchr(recs + off, '\n', len - off);
+        size_t l = nl ? (size_t)(nl - (recs + off)) + 1 : len - off;
+        feed_record(lsn, recs + off, l);
+        off += l;
+    }
+    return lsn;
+}
+
+long journal_vappend(const char *fmt, va_list ap) {
+    char rec[8 * MAX_FIELD];
+    int len = vsnprintf(rec, sizeof rec, fmt, ap);
+    if (len < 0 || (size_t)len >= sizeof rec) return -1;
+    return journal_append_records(rec, (size_t)len, 1);
+}
+
+long journal_append(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    long lsn = journal_vappend(fmt, ap);
+    va_end(ap);
+    return lsn;
+}
+
+/* Wait until record `lsn` is on disk. Call without holding course locks.
+   Whoever finds no fsync in progress becomes the leader and syncs every
+   record appended so far; the rest wait for that batch (or the next). */
+int journal_sync(long lsn) {
+    if (!journal_fsync) return 0;
+    int rc = 0;
+    pthread_mutex_lock(&journal_lock);
+    if (aio_backend != AIO_OFF) {
+        while (journal_durable < lsn && !journal_failed) pthread_cond_wait(&journal_synced, &journal_lock);
+        rc = journal_durable >= lsn ? 0 : -1;
+        pthread_mutex_unlock(&journal_lock);
+        return rc;
+    }
+    while (journal_durable < lsn) {
+        if (journal_syncing) {
+            pthread_cond_wait(&journal_synced, &journal_lock);
+            continue;
+        }
+        /* leader: the dup keeps the file open even if compaction swaps it */
+        long target = journal_lsn;
+        int fd = journal ? dup(fileno(journal)) : -1;
+        journal_syncing = 1;
+        pthread_mutex_unlock(&journal_lock);
+        int ok = fd >= 0 && fdatasync(fd) == 0;
+        if (fd >= 0) close(fd);
+        pthread_mutex_lock(&journal_lock);
+        journal_syncing = 0;
+        journal_fsyncs++;
+        if (ok && target > journal_durable) journal_durable = target;
+        pthread_cond_broadcast(&journal_synced);
+        if (!ok) { rc = -1; break; }
+    }
+    pthread_mutex_unlock(&journal_lock);
+    return rc;
+}
+
+/* Per-course critical section for the change API below */
+void course_lock(Course *c) {
+    pthread_rwlock_rdlock(&registry.lock);
+    pthread_mutex_lock(&c->lock);
+}
+
+void course_unlock(Course *c) {
+    pthread_mutex_unlock(&c->lock);
+    pthread_rwlock_unlock(&registry.lock);
+}
+
+/* Returns 0 if enrolled, 1 if the course is full and the student was
+   waitlisted, -1 if already enrolled or waiting, -2 on a write error */
+int enroll_student(Course *c, const char *roll, const char *name,
+                   const char *email, const char *year) {
+    MetricScope m = metric_begin(OP_ENROLL);
+    int id = intern(&strings, roll), yid = intern(&strings, year);
+    int nid = intern(&strings, name), eid = intern(&strings, email);
+    /* held until the row is in, so the check cannot go stale */
+    pthread_mutex_t *rl = rule_lock(id);
+    if (rl) pthread_mutex_lock(rl);
+    /* claim the seat before locking; a full course goes to the waitlist */
+    int seat = reserve_seat(c);
+    int rc, rule = RULE_OK;
+    long lsn = 0;
+    course_lock(c);
+    if (find_registration(c, id) || waitlist_find(c, id) >= 0) {
+        rc = -1;
+    } else if (rl && (rule = check_enrollment(c, id, NULL, 0)) != RULE_OK) {
+        rc = -2 - rule;
+    } else if (seat) {
+        rc = (lsn = journal_append("R,%s,%s,%s,%s,%s\n", c->name, roll, name, email, year)) < 0 ? -2
+           : add_registration(c, id, nid, eid, yid);
+    } else {
+        rc = (lsn = journal_append("W,%s,%s,%s,%s,%s\n", c->name, roll, name, email, year)) < 0 ? -2
+           : waitlist_push(c, id, nid, eid, yid) == 0 ? 1 : -1;
+    }
+    if (rc >= 0) {
+        shard_touch(c, rc == 1 ? 'W' : 'R', -1);
+        counts_store(c);
+    }
+    if (seat && rc != 0) release_seat(c);
+    course_unlock(c);
+    if (rl) pthread_mutex_unlock(rl);
+    if (rc >= 0 && lsn > 0 && journal_sync(lsn) != 0) rc = -2;
+    maybe_compact();
+    metric_end(&m);
+    return rc;
+}
+
+/* Drops an enrolled or waitlisted student. Returns 0 on success, 1 if a
+   waitlisted student was promoted into the freed seat, -1 if the roll was
+   neither enrolled nor waiting, -2 on a write error. */
+int drop_student(Course *c, const char *roll) {
+    MetricScope m = metric_begin(OP_DROP);
+    int rc = -1;
+    long lsn = 0;
+    int id = intern_find(&strings, roll);
+    course_lock(c);
+    int enrolled = id >= 0 && find_registration(c, id);
+    if (enrolled || (id >= 0 && waitlist_find(c, id) >= 0)) {
+        rc = (lsn = journal_append("D,%s,%s\n", c->name, roll)) < 0 ? -2 : drop_registration(c, id);
+        /* a promoted student inherits the seat; otherwise it is freed */
+        if (enrolled && rc == 0) release_seat(c);
+        if (rc >= 0) {
+            shard_touch_all(c);
+            counts_store(c);
+        }
+    }
+    course_unlock(c);
+    if (rc >= 0 && journal_sync(lsn) != 0) rc = -2;
+    maybe_compact();
+    metric_end(&m);
+    return rc;
+}
+
+/* Returns 0 on success, -1 if the roll is not enrolled, -2 on a write
+   error, -3 if the value is invalid. Enrollment is checked under the same
+   course lock as the write, so a concurrent drop cannot leave a value
+   behind for a roll that is gone. */
+int set_sem_value(Course *c, int grades, const char *roll, const char *sem, const char *value) {
+    SemValue v;
+    char buf[MAX_FIELD];
+    if (parse_sem_value(grades, value, &v) != 0) return -3;
+    MetricScope m = metric_begin(grades ? OP_GRADE : OP_ATTENDANCE);
+    int rid = intern(&strings, roll), sid = intern(&strings, sem);
+    int rc = 0;
+    long lsn = 0;
+    course_lock(c);
+    if (!find_registration(c, rid)) rc = -1;
+    else if ((lsn = journal_append("%c,%s,%s,%s,%s\n", grades ? 'G' : 'A', c->name, roll, sem,
+                                   format_sem_value(grades, v, buf))) < 0) rc = -2;
+    else {
+        upsert_sem_record(sem_table(c, grades), rid, sid, v);
+        shard_touch(c, grades ? 'G' : 'A', sid);
+    }
+    course_unlock(c);
+    if (rc == 0 && journal_sync(lsn) != 0) rc = -2;
+    maybe_compact();
+    metric_end(&m);
+    return rc;
+}
+
+/* ---------- Change feed ----------
+ * Downstream systems follow changes through feed.log instead of diffing
+ * the data files. Every applied change becomes one line
+ *   seq<TAB>unix-ms<TAB>record
+ * where record is the journal record (R, W, D, A or G, see above) or
+ *   P,course,roll                          a drop gave the roll at the head
+ *                                          of the waitlist its seat
+ *   C,name,capacity,credits,slots,prereqs  course added
+ *   X,position                             the data was replaced by a
+ *                                          restore; re-read it
+ * The exception is an import while backups are off, whose rows are not
+ * journaled and so are not announced either (see import_record).
+ * Sequence numbers start at 1 and go up by one per line, so a consumer
+ * keeps the last one it processed and resumes after it: `crs feed --from`
+ * reads the file, and TAIL on the server socket streams it live.
+ *
+ * Emitting only copies the line into a FEED_BUFFER-byte buffer. A flusher
+ * thread numbers whatever has collected every FEED_FLUSH_MS (sooner once
+ * the buffer is half full) and appends it with one write and fdatasync; a
+ * full buffer blocks emitters until the flusher has taken it, so memory
+ * stays bounded when the disk falls behind. Numbering happens under an
+ * flock on the file, so a crs import running next to the server shares
+ * the sequence. A batch is written only after the journal records in it
+ * are durable, so the feed never announces a change a crash can undo;
+ * when the journal fsync fails (and the changes' callers got an I/O
+ * error) the batch is dropped with a warning rather than written. The
+ * batch still collecting when the process dies is lost from the feed,
+ * though not from the data. The feed starts after the startup replay, so
+ * replayed records are not announced again. CRS_FEED=off turns it off. */
+
+#define FEED_FILE "feed.log"
+#define FEED_BUFFER (1 << 20)
+#define FEED_FLUSH_MS 20
+#define FEED_POLL_MS 200     /* how often a tail in another process rechecks */
+#define FEED_READ 65536
+
+int feed_active;
+int feed_fd = -1;
+long long feed_size;         /* end of the file after our last write, -1 unknown */
+long feed_seq;               /* last sequence number written */
+char *feed_buf, *feed_spare; /* lines collecting, and the batch being written */
+size_t feed_len;
+long feed_lsn;               /* newest journal record in feed_buf */
+int feed_flushing, feed_closing;
+pthread_mutex_t feed_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t feed_pending = PTHREAD_COND_INITIALIZER;  /* lines to write */
+pthread_cond_t feed_room = PTHREAD_COND_INITIALIZER;     /* buffer emptied */
+pthread_cond_t feed_written = PTHREAD_COND_INITIALIZER;  /* a batch is in the file */
+
+/* Absolute CLOCK_REALTIME time ms milliseconds from now, for timed waits */
+void deadline_after(struct timespec *ts, int ms) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Sequence number of the line starting at off */
+long feed_seq_at(int fd, long long off) {
+    char buf[32];
+    ssize_t n = pread(fd, buf, sizeof buf - 1, off);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    return strtol(buf, NULL, 10);
+}
+
+/* Sequence number of the file's last complete line; *end is set just past
+   it, before any line torn by a crash */
+long feed_last_seq(int fd, long long size, long long *end) {
+    char buf[4096];
+    *end = 0;
+    for (long long pos = size; pos > 0 && *end == 0;) {
+        size_t n = pos < (long long)sizeof buf ? (size_t)pos : sizeof buf;
+        pos -= (long long)n;
+        if (pread(fd, buf, n, pos) != (ssize_t)n) return 0;
+        for (size_t i = n; i > 0; i--)
+            if (buf[i - 1] == '\n') { *end = pos + (long long)i; break; }
+    }
+    if (*end == 0) return 0;
+    /* lines are far shorter than buf, so its start is in the last block */
+    long long from = *end - 1 > (long long)sizeof buf ? *end - 1 - (long long)sizeof buf : 0;
+    size_t n = (size_t)(*end - 1 - from);
+    if (pread(fd, buf, n, from) != (ssize_t)n) return 0;
+    long long start = from;
+    for (size_t i = n; i > 0; i--)
+        if (buf[i - 1] == '\n') { start = from + (long long)i; break; }
+    return feed_seq_at(fd, start);
+}
+
+/* Offset of the first line starting at or after pos */
+long long feed_line_start(int fd, long long pos, long long size) {
+    char buf[512];
+    if (pos == 0) return 0;
+    for (pos--; pos < size;) {
+        ssize_t n = pread(fd, buf, sizeof buf, pos);
+        if (n <= 0) break;
+        char *nl = memchr(buf, '\n', (size_t)n);
+        if (nl) return pos + (nl - buf) + 1;
+        pos += n;
+    }
+    return size;
+}
+
+/* Binary search for a line at or before the first one numbered `from` */
+long long feed_find(int fd, long long size, long from) {
+    long long lo = 0, hi = size;
+    while (hi - lo > 4096) {
+        long long p = feed_line_start(fd, lo + (hi - lo) / 2, size);
+        if (p >= hi) break;
+        if (feed_seq_at(fd, p) < from) lo = p;
+        else hi = p;
+    }
+    return lo;
+}
+
+/* Number a batch's lines and append them under the file lock. Returns the
+   last sequence number written, or 0 if the batch was not written. */
+long feed_write(const char *batch, size_t len, long lsn, char **out, size_t *cap) {
+    if (lsn > 0 && journal_sync(lsn) != 0) {
+        size_t lines = 0;
+        for (const char *p = batch; (p = memchr(p, '\n', (size_t)(batch + len - p))); p++) lines++;
+        fprintf(stderr, "Journal sync failed; dropped %zu change feed lines.\n", lines);
+        return 0;
+    }
+    flock(feed_fd, LOCK_EX);
+    struct stat st;
+    if (fstat(feed_fd, &st) != 0) {
+        flock(feed_fd, LOCK_UN);
+        return 0;
+    }
+    long long end;
+    /* another process appended since our last batch */
+    long seq = st.st_size == feed_size ? feed_seq : feed_last_seq(feed_fd, st.st_size, &end);
+    size_t n = 0;
+    for (const char *p = batch, *e = batch + len; p < e;) {
+        const char *nl = memchr(p, '\n', (size_t)(e - p));
+        size_t l = (size_t)(nl - p) + 1;
+        *out = grow_array(*out, cap, n + l + 24, 1);
+        n += (size_t)sprintf(*out + n, "%ld\t", ++seq);
+        memcpy(*out + n, p, l);
+        n += l;
+        p += l;
+    }
+    ssize_t w = write(feed_fd, *out, n);
+    int ok = w == (ssize_t)n && (!journal_fsync || fdatasync(feed_fd) == 0);
+    if (w > 0) metric_add(METRIC_WRITTEN, (long long)w);
+    feed_size = ok ? st.st_size + (long long)n : -1;
+    flock(feed_fd, LOCK_UN);
+    return ok ? seq : 0;
+}
+
+/* Write out batches until the process exits */
+void *feed_flusher(void *arg) {
+    (void)arg;
+    char *out = NULL;
+    size_t out_cap = 0;
+    pthread_mutex_lock(&feed_lock);
+    for (;;) {
+        while (feed_len == 0) pthread_cond_wait(&feed_pending, &feed_lock);
+        /* let the batch grow unless it is already large */
+        struct timespec until;
+        deadline_after(&until, FEED_FLUSH_MS);
+        while (!feed_closing && feed_len < FEED_BUFFER / 2
+               && pthread_cond_timedwait(&feed_pending, &feed_lock, &until) != ETIMEDOUT)
+            ;
+        char *batch = feed_buf;
+        size_t len = feed_len;
+        long lsn = feed_lsn;
+        feed_buf = feed_spare;
+        feed_spare = batch;
+        feed_len = 0;
+        feed_flushing = 1;
+        pthread_cond_broadcast(&feed_room);
+        pthread_mutex_unlock(&feed_lock);
+        long last = feed_write(batch, len, lsn, &out, &out_cap);
+        pthread_mutex_lock(&feed_lock);
+        feed_flushing = 0;
+        if (last > 0) feed_seq = last;
+        pthread_cond_broadcast(&feed_written);
+    }
+    return NULL;
+}
+
+/* Start announcing changes (once the data is loaded). Returns 0, also
+   with CRS_FEED=off, or -1 if feed.log cannot be opened. */
+int feed_open() {
+    const char *mode = getenv("CRS_FEED");
+    if (feed_active || (mode && strcmp(mode, "off") == 0)) return 0;
+    feed_fd = open(FEED_FILE, O_RDWR | O_CREAT | O_APPEND, 0644);
+    metric_add(METRIC_OPENS, 1);
+    if (feed_fd < 0) return -1;
+    flock(feed_fd, LOCK_EX);
+    struct stat st;
+    long long end = 0;
+    if (fstat(feed_fd, &st) == 0) {
+        feed_seq = feed_last_seq(feed_fd, st.st_size, &end);
+        if (end < st.st_size && ftruncate(feed_fd, end) != 0) end = -1;
+    }
+    feed_size = end;
+    flock(feed_fd, LOCK_UN);
+    feed_buf = xrealloc(NULL, FEED_BUFFER);
+    feed_spare = xrealloc(NULL, FEED_BUFFER);
+    pthread_t t;
+    if (pthread_create(&t, NULL, feed_flusher, NULL) != 0) {
+        close(feed_fd);
+        feed_fd = -1;
+        return -1;
+    }
+    pthread_detach(t);
+    atexit(feed_drain);
+    feed_active = 1;
+    return 0;
+}
+
+/* Queue one record (newline included) for the feed. lsn is its journal
+   LSN, or 0 for changes that are not journaled. Blocks while the buffer
+   is full. */
+void feed_record(long lsn, const char *rec, size_t len) {
+    if (!feed_active) return;
+    char head[24];
+    pthread_mutex_lock(&feed_lock);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    size_t hl = (size_t)snprintf(head, sizeof head, "%lld\t", (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    while (feed_len + hl + len > FEED_BUFFER) pthread_cond_wait(&feed_room, &feed_lock);
+    memcpy(feed_buf + feed_len, head, hl);
+    memcpy(feed_buf + feed_len + hl, rec, len);
+    feed_len += hl + len;
+    if (lsn > feed_lsn) feed_lsn = lsn;
+    pthread_cond_signal(&feed_pending);
+    pthread_mutex_unlock(&feed_lock);
+}
+
+/* Announce a change that has no journal record of its own */
+void feed_emit(const char *fmt, ...) {
+    if (!feed_active) return;
+    char rec[8 * MAX_FIELD];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(rec, sizeof rec, fmt, ap);
+    va_end(ap);
+    if (len > 0 && (size_t)len < sizeof rec) feed_record(0, rec, (size_t)len);
+}
+
+/* Wait until the flusher has written everything emitted so far */
+void feed_drain() {
+    if (!feed_active) return;
+    pthread_mutex_lock(&feed_lock);
+    feed_closing = 1;
+    pthread_cond_signal(&feed_pending);
+    while (feed_len > 0 || feed_flushing) pthread_cond_wait(&feed_written, &feed_lock);
+    feed_closing = 0;
+    pthread_mutex_unlock(&feed_lock);
+}
+
+/* Wait up to ms milliseconds for this process to write past line seq.
+   Returns the last sequence number it has written. */
+long feed_wait(long seq, int ms) {
+    struct timespec until;
+    deadline_after(&until, ms);
+    pthread_mutex_lock(&feed_lock);
+    while (feed_seq <= seq && pthread_cond_timedwait(&feed_written, &feed_lock, &until) != ETIMEDOUT)
+        ;
+    long last = feed_seq;
+    pthread_mutex_unlock(&feed_lock);
+    return last;
+}
+
+/* Pass fn the feed's lines from sequence number `from` on, and a NULL
+   line each time it has caught up, so it can send what it holds or give
+   up. With follow, wait for more instead of stopping at the end; lines
+   written by other processes are picked up within FEED_POLL_MS. Returns
+   0, or -1 if the feed cannot be read. */
+int feed_tail(long from, int follow, feed_fn fn, void *arg) {
+    int fd = open(FEED_FILE, O_RDONLY);
+    metric_add(METRIC_OPENS, 1);
+    if (fd < 0 && !follow) return errno == ENOENT ? 0 : -1;
+    char *buf = xrealloc(NULL, FEED_READ);
+    long long off = -1;
+    long last = from - 1;
+    for (int stop = 0; !stop;) {
+        if (fd < 0) fd = open(FEED_FILE, O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && off < 0 && fstat(fd, &st) == 0) off = feed_find(fd, st.st_size, from);
+        ssize_t got = off >= 0 ? pread(fd, buf, FEED_READ, off) : 0;
+        size_t used = 0;
+        while (!stop && got > 0) {
+            char *line = buf + used, *nl = memchr(line, '\n', (size_t)got - used);
+            if (!nl) break;
+            size_t l = (size_t)(nl - line) + 1;
+            long seq = strtol(line, NULL, 10);
+            if (seq >= from) {
+                last = seq;
+                stop = fn(seq, line, l, arg);
+            }
+            used += l;
+        }
+        if (used > 0) {
+            metric_add(METRIC_READ, (long long)used);
+            off += (long long)used;
+            continue;
+        }
+        stop = fn(0, NULL, 0, arg);
+        if (!stop && follow) feed_wait(last, FEED_POLL_MS);
+        else break;
+    }
+    free(buf);
+    if (fd >= 0) close(fd);
+    return 0;
+}
+
+/* ---------- Section sheets ----------
+ * A faculty member's sheet of values for one course: one row per student,
+ *   roll,value            (the semester given for the whole sheet)
+ *   roll,semester,value
+ * comma or tab separated. apply_sheet() checks every roll against the
+ * course's registration index and every value before changing anything,
+ * so a sheet is saved whole or not at all. The rows are journaled under
+ * one hold of the course lock and made durable by a single journal_sync(),
+ * and the target file (or the course's shard for that semester) is
+ * rewritten once, at the next compaction, rather than once per value. */
+
+const char *sheet_status_text(int status) {
+    switch (status) {
+    case SHEET_NOT_ENROLLED: return "roll is not enrolled in the course";
+    case SHEET_BAD_VALUE: return "invalid value";
+    case SHEET_NO_SEMESTER: return "no semester given";
+    case SHEET_MALFORMED: return "expected roll,value or roll,semester,value";
+    }
+    return "ok";
+}
+
+/* Parse one line into a new row; blank lines are skipped */
+void sheet_add(Sheet *s, char *line, const char *sem, long line_no) {
+    char *fld[4];
+    trim_newline(line);
+    int n = split_line(line, fld, 4, strchr(line, '\t') ? '\t' : ',');
+    if (n == 0 || (n == 1 && fld[0][0] == '\0')) return;
+    s->rows = grow_array(s->rows, &s->cap, s->count + 1, sizeof *s->rows);
+    SheetRow *r = &s->rows[s->count++];
+    memset(r, 0, sizeof *r);
+    r->line = line_no;
+    if (n < 2 || n > 3 || fld[0][0] == '\0') { r->status = SHEET_MALFORMED; return; }
+    snprintf(r->roll, sizeof r->roll, "%s", fld[0]);
+    snprintf(r->sem, sizeof r->sem, "%s", n == 3 ? fld[1] : sem ? sem : "");
+    snprintf(r->value, sizeof r->value, "%s", fld[n - 1]);
+    if (r->sem[0] == '\0') r->status = SHEET_NO_SEMESTER;
+    /* a tab-separated sheet can carry a comma the records cannot */
+    else if (bad_field(r->sem) || bad_field(r->value)) r->status = SHEET_BAD_VALUE;
+}
+
+/* Read a whole sheet file; -1 if it cannot be opened */
+int sheet_load(Sheet *s, const char *path, const char *sem) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    metric_add(METRIC_OPENS, 1);
+    char line[MAX_LINE];
+    long line_no = 0;
+    while (fgets(line, sizeof line, f)) sheet_add(s, line, sem, ++line_no);
+    fclose(f);
+    return 0;
+}
+
+void sheet_free(Sheet *s) {
+    free(s->rows);
+    memset(s, 0, sizeof *s);
+}
+
+/* Returns the number of values saved, -1 if any row was rejected (see
+   each row's status; nothing is saved), -2 on a write error (nothing is
+   applied unless only the final fsync failed) */
+long apply_sheet(Course *c, int grades, Sheet *s) {
+    MetricScope m = metric_begin(grades ? OP_GRADE : OP_ATTENDANCE);
+    SemValue *vals = xrealloc(NULL, (s->count + 1) * sizeof *vals);
+    char buf[MAX_FIELD];
+    long bad = 0, lsn = 0;
+    int rc = 0;
+    course_lock(c);
+    for (size_t i = 0; i < s->count; i++) {
+        SheetRow *r = &s->rows[i];
+        if (r->status != SHEET_OK) ;
+        else if (!lookup_registration(c, r->roll)) r->status = SHEET_NOT_ENROLLED;
+        else if (parse_sem_value(grades, r->value, &vals[i]) != 0) r->status = SHEET_BAD_VALUE;
+        bad += r->status != SHEET_OK;
+        metric_add(METRIC_ROWS, 1);
+    }
+    /* the whole sheet is journaled with one write, then applied */
+    char *recs = NULL;
+    size_t len = 0, cap = 0;
+    for (size_t i = 0; bad == 0 && i < s->count; i++) {
+        SheetRow *r = &s->rows[i];
+        recs = grow_array(recs, &cap, len + 8 * MAX_FIELD, 1);
+        len += (size_t)snprintf(recs + len, 8 * MAX_FIELD, "%c,%s,%s,%s,%s\n", grades ? 'G' : 'A', c->name,
+                                r->roll, r->sem, format_sem_value(grades, vals[i], buf));
+    }
+    if (bad == 0 && s->count > 0 && (lsn = journal_append_records(recs, len, (long)s->count)) < 0) rc = -2;
+    for (size_t i = 0; bad == 0 && rc == 0 && i < s->count; i++) {
+        SheetRow *r = &s->rows[i];
+        int sid = intern(&strings, r->sem);
+        upsert_sem_record(sem_table(c, grades), intern(&strings, r->roll), sid, vals[i]);
+        shard_touch(c, grades ? 'G' : 'A', sid);
+    }
+    course_unlock(c);
+    if (bad > 0) rc = -1;
+    /* one group commit covers every row */
+    if (rc == 0 && lsn > 0 && journal_sync(lsn) != 0) rc = -2;
+    free(recs);
+    free(vals);
+    maybe_compact();
+    metric_end(&m);
+    return rc == 0 ? (long)s->count : rc;
+}
+
+/* ---------- Queries ----------
+ * Read-only views used by the menus, the server and the benchmark. Each
+ * takes the same locks as the change API, so they are safe to call while
+ * the server is running. */
+
+/* Enrollment counts for every listed course, in listing order, from the
+   atomic counters (no course lock is taken). Returns the number of
+   entries; *out is malloc'd and owned by the caller. */
+size_t course_counts(CourseCount **out) {
+    MetricScope m = metric_begin(OP_LIST);
+    pthread_rwlock_rdlock(&registry.lock);
+    CourseCount *cc = xrealloc(NULL, (registry.count + 1) * sizeof *cc);
+    size_t n = 0;
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        if (!c->listed) continue;
+        cc[n++] = (CourseCount){ c, (size_t)atomic_load(&c->enrolled), (size_t)atomic_load(&c->waiting),
+                                 c->capacity };
+    }
+    metric_add(METRIC_ROWS, (long long)registry.count);
+    pthread_rwlock_unlock(&registry.lock);
+    *out = cc;
+    metric_end(&m);
+    return n;
+}
+
+/* Call fn for each enrolled student, then for each waitlisted one with its
+   1-based position. Returns the number of enrolled students. */
+size_t course_roster(Course *c, roster_fn fn, void *arg) {
+    MetricScope m = metric_begin(OP_AGGREGATE);
+    course_lock(c);
+    size_t n = c->regs.count;
+    for (size_t j = 0; j < c->regs.count; j++) fn(&c->regs.rows[j], 0, arg);
+    for (size_t j = 0; j < c->waitlist.count; j++) fn(&c->waitlist.rows[j], j + 1, arg);
+    metric_add(METRIC_ROWS, (long long)(n + c->waitlist.count));
+    course_unlock(c);
+    metric_end(&m);
+    return n;
+}
+
+/* Sort key for one enrolled row */
+typedef struct {
+    const char *key;
+    const char *roll;
+    size_t row;
+} RosterKey;
+
+/* Rolls compare with digit runs taken as numbers, so "CS2" < "CS10" */
+int compare_rolls(const char *a, const char *b) {
+    while (*a && *b) {
+        if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+            while (*a == '0') a++;
+            while (*b == '0') b++;
+            size_t la = strspn(a, "0123456789"), lb = strspn(b, "0123456789");
+            if (la != lb) return la < lb ? -1 : 1;
+            int d = strncmp(a, b, la);
+            if (d) return d;
+            a += la; b += lb;
+        } else {
+            if (*a != *b) return (unsigned char)*a < (unsigned char)*b ? -1 : 1;
+            a++; b++;
+        }
+    }
+    return *a ? 1 : *b ? -1 : 0;
+}
+
+/* "007" and "7" tie in natural order; byte order keeps pages stable */
+int cmp_roster_roll(const void *a, const void *b) {
+    const RosterKey *x = a, *y = b;
+    int d = compare_rolls(x->roll, y->roll);
+    return d ? d : strcmp(x->roll, y->roll);
+}
+
+int cmp_roster_name(const void *a, const void *b) {
+    const RosterKey *x = a, *y = b;
+    int d = strcasecmp(x->key, y->key);
+    return d ? d : cmp_roster_roll(a, b);
+}
+
+/* One page of a course listing: the enrolled students in the given order,
+   followed by the waitlist in queue order. Rows [offset, offset + limit)
+   are passed to fn (limit 0 means the rest). Returns the total number of
+   rows, so callers can tell whether another page exists. */
+size_t course_roster_page(Course *c, int order, size_t offset, size_t limit,
+                          roster_fn fn, void *arg) {
+    MetricScope m = metric_begin(OP_AGGREGATE);
+    course_lock(c);
+    size_t nregs = c->regs.count, total = nregs + c->waitlist.count;
+    size_t end = limit == 0 || offset + limit > total ? total : offset + limit;
+    RosterKey *keys = NULL;
+    if (order != ROSTER_ENROLLED && offset < nregs) {
+        keys = xrealloc(NULL, (nregs + 1) * sizeof *keys);
+        for (size_t j = 0; j < nregs; j++) {
+            Registration *r = &c->regs.rows[j];
+            keys[j] = (RosterKey){ str_of(r->name), str_of(r->roll), j };
+        }
+        qsort(keys, nregs, sizeof *keys, order == ROSTER_BY_NAME ? cmp_roster_name : cmp_roster_roll);
+    }
+    for (size_t j = offset; j < end; j++) {
+        if (j < nregs) fn(&c->regs.rows[keys ? keys[j].row : j], 0, arg);
+        else fn(&c->waitlist.rows[j - nregs], j - nregs + 1, arg);
+    }
+    /* sorting touches every enrolled row, not just the page */
+    metric_add(METRIC_ROWS, (long long)(keys ? nregs : 0) + (long long)(end > offset ? end - offset : 0));
+    course_unlock(c);
+    free(keys);
+    metric_end(&m);
+    return total;
+}
+
+/* Attendance and grade of one student for one semester. att and grade
+   (MAX_FIELD each) are left empty when there is no record. Returns 1 if
+   the student is enrolled, 0 if not. */
+int query_student(Course *c, const char *roll, const char *sem, char *att, char *grade) {
+    char buf[MAX_FIELD];
+    MetricScope m = metric_begin(OP_QUERY);
+    att[0] = grade[0] = '\0';
+    course_lock(c);
+    int enrolled = lookup_registration(c, roll) != NULL;
+    SemRecord *r = lookup_sem_record(&c->attendance, roll, sem);
+    if (r) copy_field(att, format_sem_value(0, r->value, buf));
+    r = lookup_sem_record(&c->grades, roll, sem);
+    if (r) copy_field(grade, format_sem_value(1, r->value, buf));
+    course_unlock(c);
+    metric_end(&m);
+    return enrolled;
+}
+
+/* ---------- Memory accounting ----------
+ * `crs memstats` (and `crs-bench run`) report what the loaded data costs:
+ * the bytes allocated for each table and index, and the process's
+ * resident set size, each divided by the number of records held. */
+
+size_t hindex_bytes(const HashIndex *ix) {
+    return ix->cap * (sizeof *ix->slot + sizeof *ix->hash);
+}
+
+size_t sem_table_bytes(const SemTable *t) {
+    return t->cap * sizeof *t->rows + hindex_bytes(&t->index);
+}
+
+void memory_line(FILE *out, const char *what, size_t records, size_t bytes, size_t per) {
+    fprintf(out, "%-22s %12zu %14zu %10.1f\n", what, records, bytes, per ? (double)bytes / per : 0.0);
+}
+
+void memory_report(FILE *out) {
+    pthread_rwlock_rdlock(&registry.lock);
+    size_t nregs = 0, nwait = 0, natt = 0, ngrades = 0;
+    size_t regs = 0, wait = 0, att = 0, grades = 0, courses = registry.cap * sizeof *registry.courses;
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i];
+        pthread_mutex_lock(&c->lock);
+        nregs += c->regs.count;
+        nwait += c->waitlist.count;
+        natt += c->attendance.count;
+        ngrades += c->grades.count;
+        regs += c->regs.cap * sizeof *c->regs.rows + hindex_bytes(&c->regs.index);
+        wait += c->waitlist.cap * sizeof *c->waitlist.rows;
+        att += sem_table_bytes(&c->attendance);
+        grades += sem_table_bytes(&c->grades);
+        courses += sizeof *c;
+        pthread_mutex_unlock(&c->lock);
+    }
+    courses += hindex_bytes(&registry.index);
+    pthread_rwlock_unlock(&registry.lock);
+
+    pthread_mutex_lock(&strings.lock);
+    size_t nstrings = strings.count, chunks = (strings.count + STR_CHUNK - 1) / STR_CHUNK;
+    size_t strbytes = strings.arena.bytes + hindex_bytes(&strings.index)
+                    + (strings.chunks ? STR_MAX_CHUNKS * sizeof *strings.chunks : 0)
+                    + chunks * STR_CHUNK * sizeof **strings.chunks;
+    pthread_mutex_unlock(&strings.lock);
+
+    pthread_mutex_lock(&students.lock);
+    size_t nstudents = students.count;
+    size_t stubytes = students.cap * sizeof *students.rows + hindex_bytes(&students.by_roll)
+                    + hindex_bytes(&students.by_email)
+                    + (students.emails_cap + students.names_cap) * sizeof(StudentKey);
+    for (size_t i = 0; i < students.count; i++) stubytes += students.rows[i].cap * sizeof(StudentCourse);
+    pthread_mutex_unlock(&students.lock);
+
+    size_t records = nregs + nwait + natt + ngrades;
+    size_t total = regs + wait + att + grades + courses + strbytes + stubytes;
+    fprintf(out, "%-22s %12s %14s %10s\n", "table", "records", "bytes", "per record");
+    memory_line(out, "registrations", nregs, regs, nregs);
+    memory_line(out, "waitlists", nwait, wait, nwait);
+    memory_line(out, "attendance", natt, att, natt);
+    memory_line(out, "grades", ngrades, grades, ngrades);
+    memory_line(out, "strings", nstrings, strbytes, nstrings);
+    memory_line(out, "student index", nstudents, stubytes, nstudents);
+    memory_line(out, "courses", registry.count, courses, registry.count);
+    memory_line(out, "total allocated", records, total, records);
+    /* resident pages are the second field of statm */
+    FILE *f = fopen("/proc/self/statm", "r");
+    long pages = 0;
+    if (f) {
+        if (fscanf(f, "%*d %ld", &pages) != 1) pages = 0;
+        fclose(f);
+    }
+    if (pages > 0) memory_line(out, "resident set", records, (size_t)pages * (size_t)sysconf(_SC_PAGESIZE), records);
+}
+
+/* ---------- Batch import ----------
+ * Bulk-load registrations, attendance or grades from a CSV or TSV file
+ * (delimiter taken from the first line). Duplicates are detected against
+ * the registry's hash indexes in the same pass, then the result is written
+ * once: new registrations as a single batched append, attendance/grades as
+ * one merged rewrite of the target file (one snapshot rewrite in binary
+ * storage mode, a rewrite of the touched shards in sharded mode). Rows naming a course that is not
+ * in courses.txt, attendance/grades for a roll not enrolled in the
+ * course, and TSV rows with a comma in a field are rejected, and so are
+ * registrations that break a course's timetable, credit or prerequisite
+ * rules (checked against everything before them, earlier rows of the
+ * same file included). While backups are
+ * on (ARCHIVE_DIR exists) the rows are journaled as well, so the next
+ * delta and the change feed carry them; otherwise neither does. */
+
+/* Journal an imported row while archiving, which also puts it on the
+   change feed. Otherwise the row goes only into the data files and the
+   feed does not carry it: a feed line is only written once its journal
+   record is durable. Returns the journal LSN, or 0 if not journaled. */
+long import_record(int archiving, const char *fmt, ...) {
+    if (!archiving) return 0;
+    va_list ap;
+    va_start(ap, fmt);
+    long lsn = journal_vappend(fmt, ap);
+    va_end(ap);
+    return lsn;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* kind is "registrations", "attendance" or "grades" */
+int import_rows(const char *kind, const char *path) {
+    int regs = strcmp(kind, "registrations") == 0;
+    int grades = strcmp(kind, "grades") == 0;
+    if (!regs && !grades && strcmp(kind, "attendance") != 0) {
+        printf("Unknown import kind '%s'.\n", kind);
+        return -1;
+    }
+    CsvScanner in;
+    if (!file_exists(path) || scanner_open(&in, path) != 0) { printf("Could not open %s.\n", path); return -1; }
+
+    /* The snapshot is about to be written directly, so pending journal
+       records must be folded in first to keep replay order correct. */
+    if (journal_records > 0 && compact_journal() != 0) {
+        printf("Could not compact journal.\n");
+        scanner_close(&in);
+        return -1;
+    }
+    FILE *out = NULL;
+    if (regs && storage_mode == STORAGE_CSV) {
+        out = fopen("registrations.csv", "a");
+        metric_add(METRIC_OPENS, 1);
+        if (!out) { printf("Could not open registrations file to write.\n"); scanner_close(&in); return -1; }
+    }
+
+    double start = now_seconds();
+    long added = 0, dups = 0, rejected = 0, waited = 0;
+    long conflicts[RULE_PREREQ + 1] = { 0 };
+    /* with backups on, the rows are journaled too so deltas carry them */
+    int archiving = file_exists(ARCHIVE_DIR);
+    long lsn = 0;
+    char buf[MAX_FIELD];
+    /* TSV if the first line has a tab */
+    const char *nl = memchr(in.pos, '\n', in.size);
+    char delim = memchr(in.pos, '\t', nl ? (size_t)(nl - in.pos) : in.size) ? '\t' : ',';
+    StrView v[5];
+    char f[5][MAX_FIELD];
+    char *fld[5] = { f[0], f[1], f[2], f[3], f[4] };
+    int n;
+    while ((n = scanner_next(&in, v, 5, delim))) {
+        views_to_fields(v, n, f, 5);
+        Course *c = n >= 2 ? find_course(fld[0]) : NULL;
+        if (!c || !c->listed || strlen(fld[1]) == 0 || (!regs && n < 4)) { rejected++; continue; }
+        if (regs) {
+            const char *name = fld[2], *email = fld[3], *year = fld[4];
+            /* a TSV field may hold the comma the records are split on */
+            if (bad_field(fld[1]) || bad_field(name) || bad_field(email) || bad_field(year)) { rejected++; continue; }
+            int id = intern(&strings, fld[1]);
+            if (find_registration(c, id) || waitlist_find(c, id) >= 0) { dups++; continue; }
+            int rule = check_enrollment(c, id, NULL, 0);
+            if (rule != RULE_OK) { conflicts[rule]++; continue; }
+            /* rows beyond the course capacity queue up in file order */
+            if (!reserve_seat(c)) {
+                waitlist_push(c, id, intern(&strings, name), intern(&strings, email), intern(&strings, year));
+                shard_touch(c, 'W', -1);
+                lsn = import_record(archiving, "W,%s,%s,%s,%s,%s\n", c->name, fld[1], name, email, year);
+                waited++;
+                continue;
+            }
+            add_registration(c, id, intern(&strings, name), intern(&strings, email), intern(&strings, year));
+            shard_touch(c, 'R', -1);
+            lsn = import_record(archiving, "R,%s,%s,%s,%s,%s\n", c->name, fld[1], name, email, year);
+            /* CSV: course,roll,name,email,year */
+            if (out) metric_add(METRIC_WRITTEN, fprintf(out, "%s,%s,%s,%s,%s\n", c->name, fld[1], name, email, year));
+        } else {
+            Registration *r = lookup_registration(c, fld[1]);
+            SemValue val;
+            if (!r || bad_field(fld[2]) || bad_field(fld[3]) || parse_sem_value(grades, fld[3], &val) != 0) {
+                rejected++;
+                continue;
+            }
+            int sem = intern(&strings, fld[2]);
+            if (find_sem_record(sem_table(c, grades), r->roll, sem)) dups++;
+            upsert_sem_record(sem_table(c, grades), r->roll, sem, val);
+            shard_touch(c, grades ? 'G' : 'A', sem);
+            lsn = import_record(archiving, "%c,%s,%s,%s,%s\n", grades ? 'G' : 'A', c->name, fld[1], fld[2],
+                                format_sem_value(grades, val, buf));
+        }
+        added++;
+    }
+    scanner_close(&in);
+
+    int rc;
+    if (storage_mode != STORAGE_CSV) rc = save_snapshot();
+    else if (regs) rc = close_synced(out) != 0 || (waited > 0 && save_reg_file("waitlist.csv", "waitlist.tmp", 1) != 0);
+    else if (grades) rc = save_sem_file("grades.csv", "grades.tmp", 1);
+    else rc = save_sem_file("attendance.csv", "attendance.tmp", 0);
+    if (lsn != 0 && journal_sync(lsn) != 0) rc = -1;
+    if (rc != 0) { printf("Could not write %s.\n", kind); return -1; }
+    if (regs)
+        for (size_t i = 0; i < registry.count; i++) counts_store(registry.courses[i]);
+
+    if (regs) {
+        printf("Imported %ld registrations (%ld waitlisted, %ld duplicates skipped, %ld rejected) in %.3fs\n",
+               added, waited, dups, rejected, now_seconds() - start);
+        if (conflicts[RULE_SLOT_CLASH] + conflicts[RULE_CREDIT_CAP] + conflicts[RULE_PREREQ] > 0)
+            printf("Refused %ld for clashing time slots, %ld over the credit cap, %ld missing prerequisites\n",
+                   conflicts[RULE_SLOT_CLASH], conflicts[RULE_CREDIT_CAP], conflicts[RULE_PREREQ]);
+    } else
+        printf("Imported %ld %s rows (%ld replaced existing, %ld rejected) in %.3fs\n",
+               added, kind, dups, rejected, now_seconds() - start);
+    return 0;
+}
+
+int import_file(const char *kind, const char *path) {
+    MetricScope m = metric_begin(OP_IMPORT);
+    int rc = import_rows(kind, path);
+    metric_end(&m);
+    return rc;
+}
+
+
+/* ---------- Backups ----------
+ * A backup directory holds a point-in-time snapshot and the deltas taken
+ * after it:
+ *   snapshot-<pos>.bin        the registry at position pos, binary format
+ *   delta-<from>-<to>.log     journal records from .. to-1
+ *   courses.txt               refreshed by every snapshot and delta
+ * A snapshot holds the registry write lock only while it copies each
+ * course's row arrays (interned strings never change, so the ids are a
+ * complete copy), then writes the copy while changes carry on. Taking one
+ * turns on journal archiving, which keeps compacted journals in
+ * ARCHIVE_DIR until a delta has exported them. A delta copies the records
+ * since the directory's position out of the archive and the live journal.
+ *
+ * restore_backup() rebuilds the data from the newest snapshot and the
+ * deltas after it, then writes it in the active storage mode. It records
+ * what it restored in RESTORE_STATE; when the local data is still exactly
+ * that (no local changes since), the next restore from the same directory
+ * only applies the new deltas, which keeps a standby copy current. */
+
+#define RESTORE_STATE "restore.state"
+
+typedef struct {
+    long from, to;          /* a snapshot or archived journal has to == from */
+    char name[256];         /* as in struct dirent */
+} BackupFile;
+
+int cmp_backup_files(const void *a, const void *b) {
+    long x = ((const BackupFile *)a)->from, y = ((const BackupFile *)b)->from;
+    return x < y ? -1 : x > y;
+}
+
+/* Snapshots ('s'), deltas ('d') or archived journals ('j') in dir, oldest
+   first */
+size_t list_backup_files(const char *dir, char kind, BackupFile **out) {
+    size_t n = 0, cap = 0;
+    *out = NULL;
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        BackupFile f;
+        int len = 0, got;
+        if (kind == 'd') got = sscanf(e->d_name, "delta-%ld-%ld.log%n", &f.from, &f.to, &len) == 2;
+        else if (kind == 's') got = sscanf(e->d_name, "snapshot-%ld.bin%n", &f.from, &len) == 1;
+        else got = sscanf(e->d_name, "journal-%ld.log%n", &f.from, &len) == 1;
+        /* len stays 0 unless the whole pattern matched; temp copies have a tail */
+        if (!got || len == 0 || e->d_name[len] != '\0') continue;
+        if (kind != 'd') f.to = f.from;
+        snprintf(f.name, sizeof f.name, "%s", e->d_name);
+        *out = grow_array(*out, &cap, n + 1, sizeof **out);
+        (*out)[n++] = f;
+    }
+    closedir(d);
+    if (n > 0) qsort(*out, n, sizeof **out, cmp_backup_files);
+    return n;
+}
+
+/* Position a backup directory has reached: its newest snapshot followed
+   by the unbroken chain of deltas after it. -1 if it has no snapshot. */
+long backup_position(const char *dir, long *snapshot) {
+    BackupFile *f;
+    size_t n = list_backup_files(dir, 's', &f);
+    long pos = n > 0 ? f[n - 1].from : -1;
+    free(f);
+    if (snapshot) *snapshot = pos;
+    n = list_backup_files(dir, 'd', &f);
+    for (size_t i = 0; pos >= 0 && i < n; i++)
+        if (f[i].from <= pos && f[i].to > pos) pos = f[i].to;
+    free(f);
+    return pos;
+}
+
+/* Copy src to dst through a synced temp file; a missing src copies as empty */
+int copy_file_synced(const char *src, const char *dst) {
+    char tmp[MAX_LINE + 8], buf[1 << 16];
+    snprintf(tmp, sizeof tmp, "%s.tmp", dst);
+    FILE *in = fopen(src, "r");
+    FILE *fw = begin_rewrite(tmp);
+    int ok = fw != NULL;
+    size_t n;
+    while (ok && in && (n = fread(buf, 1, sizeof buf, in)) > 0) ok = fwrite(buf, 1, n, fw) == n;
+    if (in) fclose(in);
+    if (fw && end_rewrite(fw) != 0) ok = 0;
+    if (ok) ok = rename(tmp, dst) == 0;
+    else remove(tmp);
+    return ok ? 0 : -1;
+}
+
+/* Copy the records of a journal whose first record is `base` and whose
+   sequence numbers fall in [from, to) */
+long copy_journal_records(const char *path, long base, long from, long to, FILE *out) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    metric_add(METRIC_OPENS, 1);
+    char line[8 * MAX_FIELD];
+    long seq = base, copied = 0;
+    while (seq < to && fgets(line, sizeof line, f)) {
+        if (strncmp(line, "S,", 2) == 0) continue;
+        if (!strchr(line, '\n')) break;   /* a record still being written */
+        if (seq >= from) {
+            fputs(line, out);
+            copied++;
+        }
+        seq++;
+    }
+    fclose(f);
+    return copied;
+}
+
+/* Drop archived journals whose records are all before pos. Call with the
+   registry lock held so compaction cannot add one meanwhile. */
+void prune_archive(long pos) {
+    BackupFile *f;
+    size_t n = list_backup_files(ARCHIVE_DIR, 'j', &f);
+    char path[512];
+    for (size_t i = 0; i < n; i++) {
+        long next = i + 1 < n ? f[i + 1].from : journal_base;
+        if (next > pos) break;
+        snprintf(path, sizeof path, "%s/%s", ARCHIVE_DIR, f[i].name);
+        remove(path);
+    }
+    free(f);
+}
+
+void *dup_rows(const void *rows, size_t n, size_t size) {
+    void *p = xrealloc(NULL, n * size + 1);
+    if (n > 0) memcpy(p, rows, n * size);
+    return p;
+}
+
+/* Copy every course's rows; call with the registry write lock held */
+Course **freeze_registry(size_t *count) {
+    Course **frozen = xrealloc(NULL, (registry.count + 1) * sizeof *frozen);
+    for (size_t i = 0; i < registry.count; i++) {
+        Course *c = registry.courses[i], *f = xrealloc(NULL, sizeof *f);
+        memset(f, 0, sizeof *f);
+        memcpy(f->name, c->name, sizeof f->name);
+        f->listed = c->listed;
+        f->capacity = c->capacity;
+        f->regs.rows = dup_rows(c->regs.rows, f->regs.count = c->regs.count, sizeof *c->regs.rows);
+        f->waitlist.rows = dup_rows(c->waitlist.rows, f->waitlist.count = c->waitlist.count, sizeof *c->waitlist.rows);
+        f->attendance.rows = dup_rows(c->attendance.rows, f->attendance.count = c->attendance.count,
+                                      sizeof *c->attendance.rows);
+        f->grades.rows = dup_rows(c->grades.rows, f->grades.count = c->grades.count, sizeof *c->grades.rows);
+        frozen[i] = f;
+    }
+    *count = registry.count;
+    return frozen;
+}
+
+void free_frozen(Course **frozen, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(frozen[i]->regs.rows);
+        free(frozen[i]->waitlist.rows);
+        free(frozen[i]->attendance.rows);
+        free(frozen[i]->grades.rows);
+        free(frozen[i]);
+    }
+    free(frozen);
+}
+
+/* Write a point-in-time snapshot into dir without holding up changes for
+   longer than the copy */
+int backup_snapshot(const char *dir, FILE *out) {
+    char path[MAX_LINE + MAX_FIELD];
+    if ((mkdir(dir, 0755) != 0 && errno != EEXIST) || (mkdir(ARCHIVE_DIR, 0755) != 0 && errno != EEXIST)) {
+        fprintf(out, "Could not create %s.\n", dir);
+        return -1;
+    }
+    double start = now_seconds();
+    pthread_rwlock_wrlock(&registry.lock);
+    journal_drain();
+    long pos = journal_base + journal_records;
+    size_t count;
+    Course **frozen = freeze_registry(&count);
+    pthread_rwlock_unlock(&registry.lock);
+    double paused = now_seconds() - start;
+
+    snprintf(path, sizeof path, "%s/snapshot-%ld.bin", dir, pos);
+    int rc = write_binary_snapshot(frozen, count, path);
+    free_frozen(frozen, count);
+    snprintf(path, sizeof path, "%s/courses.txt", dir);
+    if (rc == 0) rc = copy_file_synced("courses.txt", path);
+    if (rc == 0) rc = sync_dir_at(dir);
+    if (rc != 0) { fprintf(out, "Could not write the snapshot to %s.\n", dir); return -1; }
+
+    /* the new snapshot supersedes the older ones and their deltas */
+    BackupFile *f;
+    size_t n = list_backup_files(dir, 's', &f);
+    for (size_t i = 0; i < n; i++) {
+        if (f[i].from >= pos) continue;
+        snprintf(path, sizeof path, "%s/%s", dir, f[i].name);
+        remove(path);
+    }
+    free(f);
+    n = list_backup_files(dir, 'd', &f);
+    for (size_t i = 0; i < n; i++) {
+        if (f[i].to > pos) continue;
+        snprintf(path, sizeof path, "%s/%s", dir, f[i].name);
+        remove(path);
+    }
+    free(f);
+    pthread_rwlock_rdlock(&registry.lock);
+    prune_archive(pos);
+    pthread_rwlock_unlock(&registry.lock);
+    fprintf(out, "Snapshot at position %ld written to %s in %.3fs (changes held for %.1f ms).\n", pos, dir,
+            now_seconds() - start, paused * 1e3);
+    return 0;
+}
+
+/* Export the records since dir's position as one delta file */
+int backup_delta(const char *dir, FILE *out) {
+    char path[MAX_LINE + MAX_FIELD], tmp[MAX_LINE + MAX_FIELD + 8];
+    long from = backup_position(dir, NULL);
+    if (from < 0) {
+        fprintf(out, "No snapshot in %s; take one with `crs backup snapshot` first.\n", dir);
+        return -1;
+    }
+    double start = now_seconds();
+    /* the read lock holds off compaction (so no journal moves) but not changes */
+    pthread_rwlock_rdlock(&registry.lock);
+    pthread_mutex_lock(&journal_lock);
+    while (journal_buf_len > 0 || journal_flushing) pthread_cond_wait(&journal_synced, &journal_lock);
+    long base = journal_base, to = journal_base + journal_records;
+    pthread_mutex_unlock(&journal_lock);
+    BackupFile *seg;
+    size_t nseg = list_backup_files(ARCHIVE_DIR, 'j', &seg);
+    long oldest = nseg > 0 ? seg[0].from : base;
+    const char *problem = to < from ? "is ahead of this data" : from < oldest ? "is older than the archived journals" : NULL;
+    if (problem || to == from) {
+        pthread_rwlock_unlock(&registry.lock);
+        free(seg);
+        if (!problem) { fprintf(out, "%s is up to date at position %ld.\n", dir, from); return 0; }
+        fprintf(out, "%s (position %ld) %s; take a new snapshot.\n", dir, from, problem);
+        return -1;
+    }
+    snprintf(path, sizeof path, "%s/delta-%ld-%ld.log", dir, from, to);
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    FILE *fw = begin_rewrite(tmp);
+    long copied = 0;
+    for (size_t i = 0; fw && i < nseg; i++) {
+        if ((i + 1 < nseg ? seg[i + 1].from : base) <= from) continue;
+        char seg_path[512];
+        snprintf(seg_path, sizeof seg_path, "%s/%s", ARCHIVE_DIR, seg[i].name);
+        copied += copy_journal_records(seg_path, seg[i].from, from, to, fw);
+    }
+    if (fw) copied += copy_journal_records(JOURNAL_FILE, base, from, to, fw);
+    pthread_rwlock_unlock(&registry.lock);
+    free(seg);
+    int ok = fw && end_rewrite(fw) == 0 && copied == to - from && rename(tmp, path) == 0;
+    if (!ok) {
+        remove(tmp);
+        fprintf(out, "Could not write the delta to %s (%ld of %ld records found).\n", dir, copied, to - from);
+        return -1;
+    }
+    snprintf(path, sizeof path, "%s/courses.txt", dir);
+    if (copy_file_synced("courses.txt", path) != 0 || sync_dir_at(dir) != 0) {
+        fprintf(out, "Could not sync %s.\n", dir);
+        return -1;
+    }
+    pthread_rwlock_rdlock(&registry.lock);
+    prune_archive(to);
+    pthread_rwlock_unlock(&registry.lock);
+    fprintf(out, "Delta %ld..%ld (%ld records) written to %s in %.3fs.\n", from, to, copied, dir,
+            now_seconds() - start);
+    return 0;
+}
+
+/* Position of the local data according to journal.log, without loading */
+long local_position() {
+    CsvScanner sc;
+    if (scanner_open(&sc, JOURNAL_FILE) != 0) return 0;
+    StrView v[2];
+    long pos = 0;
+    int n;
+    char f[2][MAX_FIELD];
+    while ((n = scanner_next(&sc, v, 2, ','))) {
+        views_to_fields(v, n, f, 2);
+        if (strcmp(f[0], "S") == 0) pos = atol(f[1]);
+        else pos++;
+    }
+    scanner_close(&sc);
+    return pos;
+}
+
+/* Apply the records of one delta file from sequence number `pos` on */
+long apply_delta(const char *path, long from, long pos) {
+    CsvScanner sc;
+    if (scanner_open(&sc, path) != 0) return -1;
+    StrView v[6];
+    char f[6][MAX_FIELD];
+    char *fld[6] = { f[0], f[1], f[2], f[3], f[4], f[5] };
+    long seq = from, applied = 0;
+    int n;
+    while ((n = scanner_next(&sc, v, 6, ','))) {
+        if (seq++ < pos) continue;
+        views_to_fields(v, n, f, 6);
+        apply_journal_record(fld, n);
+        applied++;
+    }
+    scanner_close(&sc);
+    return applied;
+}
+
+/* Rebuild the local data from a backup directory. Runs instead of the
+   normal startup, with nothing loaded yet. */
+int restore_backup(const char *dir, FILE *out) {
+    char path[MAX_LINE + MAX_FIELD], state[MAX_LINE + 32];
+    long snapshot, end = backup_position(dir, &snapshot);
+    if (end < 0) { fprintf(out, "No snapshot in %s.\n", dir); return -1; }
+    double start = now_seconds();
+
+    /* incremental if the local data is what the last restore from dir left */
+    long pos = local_position();
+    FILE *sf = fopen(RESTORE_STATE, "r");
+    snprintf(path, sizeof path, "%ld\t%s\n", pos, dir);
+    int incremental = sf && fgets(state, sizeof state, sf) && strcmp(state, path) == 0
+                   && pos >= snapshot && pos <= end;
+    if (sf) fclose(sf);
+
+    snprintf(path, sizeof path, "%s/courses.txt", dir);
+    if (file_exists(path) && copy_file_synced(path, "courses.txt") != 0) {
+        fprintf(out, "Could not copy %s.\n", path);
+        return -1;
+    }
+    if (incremental) {
+        if (load_registry() != 0) return -1;
+        replay_journal();
+    } else {
+        load_courses();
+        snprintf(path, sizeof path, "%s/snapshot-%ld.bin", dir, snapshot);
+        if (load_binary_snapshot(path) != 0) return -1;
+        pos = snapshot;
+    }
+    long from = pos, applied = 0;
+    BackupFile *f;
+    size_t n = list_backup_files(dir, 'd', &f);
+    for (size_t i = 0; i < n && pos < end; i++) {
+        if (f[i].to <= pos || f[i].from > pos) continue;
+        snprintf(path, sizeof path, "%s/%s", dir, f[i].name);
+        long k = apply_delta(path, f[i].from, pos);
+        if (k < 0) break;
+        applied += k;
+        pos = f[i].to;
+    }
+    free(f);
+    if (pos < end) fprintf(out, "Could not read every delta; restored up to position %ld.\n", pos);
+
+    if (!incremental) {
+        /* the local files are replaced wholesale; old shards would collide
+           with the new generation's names */
+        StrTable none;
+        strtable_init(&none);
+        sweep_shards(&none);
+        strtable_free(&none);
+        remove(SHARD_MANIFEST);
+        remove(JOURNAL_FILE);
+    }
+    sync_seat_counters();
+    int rc = save_snapshot();
+    if (rc == 0) {
+        pthread_mutex_lock(&journal_lock);
+        journal_base = pos;   /* the old journal is folded in, never archived */
+        rc = journal_restart(pos);
+        pthread_mutex_unlock(&journal_lock);
+    }
+    if (rc == 0) {
+        sf = fopen(RESTORE_STATE ".tmp", "w");
+        rc = sf ? 0 : -1;
+        if (sf) fprintf(sf, "%ld\t%s\n", pos, dir);
+        if (sf && close_synced(sf) != 0) rc = -1;
+        if (rc == 0) rc = rename(RESTORE_STATE ".tmp", RESTORE_STATE) == 0 && sync_dir() == 0 ? 0 : -1;
+    }
+    if (rc != 0) { fprintf(out, "Could not write the restored data.\n"); return -1; }
+    if (feed_open() == 0) feed_emit("X,%ld\n", pos);
+    fprintf(out, "Restored position %ld (%s %ld + %ld delta records) in %.3fs.\n", pos,
+            incremental ? "local data at" : "snapshot", from, applied, now_seconds() - start);
+    return 0;
+}
+
+/* ---------- Reports ----------
+ * `crs report` computes institution-wide views in one pass over the loaded
+ * attendance and grade tables instead of one lookup per student:
+ *   transcripts   every student's grades and attendance, with a GPA
+ *   averages      mean attendance per course and semester
+ *   defaulters    students whose attendance is below a threshold
+ * Courses are split across worker threads. Each course's output is built
+ * in its own buffer (averages, defaulters) or as a sorted run of rows
+ * (transcripts), and the main thread writes them out in listing order, so
+ * the result does not depend on the thread count. */
+
+/* Grade points on a 10-point scale; numeric grades are marks out of 100.
+   Returns -1 for labels that carry no points. */
+double grade_points(const char *g) {
+    static const char *labels[] = { "O", "A+", "A", "B+", "B", "C", "P", "F" };
+    static const double points[] = { 10, 9, 8, 7, 6, 5, 4, 0 };
+    for (size_t i = 0; i < sizeof labels / sizeof *labels; i++)
+        if (strcasecmp(g, labels[i]) == 0) return points[i];
+    char *end;
+    double marks = strtod(g, &end);
+    if (end == g || *end != '\0' || !(marks >= 0 && marks <= 100)) return -1;
+    return marks / 10;
+}
+
+typedef struct {
+    Course *course;
+    const char *name;
+    int roll, sem;
+    int grade;          /* interned label, -1 if none */
+    float percent;      /* -1 if no attendance */
+} TranscriptRow;
+
+typedef struct {
+    int kind;           /* REPORT_* */
+    double threshold;
+    Course **courses;
+    size_t ncourses, first, stride;
+    char **text;        /* per course: averages and defaulters */
+    size_t *textlen;
+    TranscriptRow *rows;   /* transcripts: this worker's sorted run */
+    size_t nrows, cap;
+} ReportWorker;
+
+enum { REPORT_TRANSCRIPTS, REPORT_AVERAGES, REPORT_DEFAULTERS };
+
+/* Natural order, then byte order for "007" against "7", so two rolls
+   (or semesters) never compare equal and their rows never interleave */
+int cmp_report_keys(int x, int y) {
+    if (x == y) return 0;
+    int d = compare_rolls(str_of(x), str_of(y));
+    return d ? d : strcmp(str_of(x), str_of(y));
+}
+
+int cmp_transcript_rows(const void *a, const void *b) {
+    const TranscriptRow *x = a, *y = b;
+    int d = cmp_report_keys(x->roll, y->roll);
+    if (d == 0) d = cmp_report_keys(x->sem, y->sem);
+    return d ? d : strcmp(x->course->name, y->course->name);
+}
+
+int cmp_sem_records(const void *a, const void *b) {
+    const SemRecord *x = a, *y = b;
+    int d = cmp_report_keys(x->sem, y->sem);
+    return d ? d : cmp_report_keys(x->roll, y->roll);
+}
+
+void report_transcript_rows(ReportWorker *w, Course *c) {
+    SemTable *g = &c->grades, *a = &c->attendance;
+    w->rows = grow_array(w->rows, &w->cap, w->nrows + g->count + a->count, sizeof *w->rows);
+    for (size_t j = 0; j < g->count; j++) {
+        SemRecord *r = &g->rows[j], *att = find_sem_record(a, r->roll, r->sem);
+        Registration *reg = find_registration(c, r->roll);
+        w->rows[w->nrows++] = (TranscriptRow){ c, reg ? str_of(reg->name) : "", r->roll, r->sem,
+                                               r->value.grade, att ? att->value.percent : -1 };
+    }
+    for (size_t j = 0; j < a->count; j++) {
+        SemRecord *r = &a->rows[j];
+        if (find_sem_record(g, r->roll, r->sem)) continue;
+        Registration *reg = find_registration(c, r->roll);
+        w->rows[w->nrows++] = (TranscriptRow){ c, reg ? str_of(reg->name) : "", r->roll, r->sem,
+                                               -1, r->value.percent };
+    }
+}
+
+/* Attendance rows of one course, ordered by semester then roll */
+SemRecord *sorted_attendance(Course *c) {
+    SemRecord *rows = xrealloc(NULL, (c->attendance.count + 1) * sizeof *rows);
+    memcpy(rows, c->attendance.rows, c->attendance.count * sizeof *rows);
+    qsort(rows, c->attendance.count, sizeof *rows, cmp_sem_records);
+    return rows;
+}
+
+void report_course_text(ReportWorker *w, Course *c, FILE *out) {
+    SemRecord *rows = sorted_attendance(c);
+    size_t n = c->attendance.count;
+    for (size_t j = 0; j < n; ) {
+        size_t k = j;
+        double sum = 0;
+        for (; k < n && rows[k].sem == rows[j].sem; k++) {
+            sum += rows[k].value.percent;
+            if (w->kind == REPORT_DEFAULTERS && rows[k].value.percent < w->threshold) {
+                Registration *reg = find_registration(c, rows[k].roll);
+                fprintf(out, "%-16s %-8s %-14s %-24s %6.1f%%\n", c->name, str_of(rows[k].sem),
+                        str_of(rows[k].roll), reg ? str_of(reg->name) : "", rows[k].value.percent);
+            }
+        }
+        if (w->kind == REPORT_AVERAGES)
+            fprintf(out, "%-16s %-8s %9zu %9.1f%%\n", c->name, str_of(rows[j].sem), k - j, sum / (k - j));
+        j = k;
+    }
+    free(rows);
+}
+
+void *report_worker(void *arg) {
+    ReportWorker *w = arg;
+    metric_current = OP_REPORT;
+    for (size_t i = w->first; i < w->ncourses; i += w->stride) {
+        Course *c = w->courses[i];
+        course_lock(c);
+        metric_add(METRIC_ROWS, (long long)(c->attendance.count + c->grades.count));
+        if (w->kind == REPORT_TRANSCRIPTS) {
+            report_transcript_rows(w, c);
+        } else {
+            FILE *out = open_memstream(&w->text[i], &w->textlen[i]);
+            if (out) {
+                report_course_text(w, c, out);
+                fclose(out);
+            }
+        }
+        course_unlock(c);
+    }
+    if (w->kind == REPORT_TRANSCRIPTS) qsort(w->rows, w->nrows, sizeof *w->rows, cmp_transcript_rows);
+    return NULL;
+}
+
+/* Merge the workers' sorted runs and print one block per student */
+void write_transcripts(ReportWorker *w, int threads, FILE *out) {
+    size_t *pos = xrealloc(NULL, threads * sizeof *pos);
+    memset(pos, 0, threads * sizeof *pos);
+    int cur = -1;
+    double points = 0;
+    int graded = 0;
+    char buf[MAX_FIELD];
+    for (;;) {
+        int best = -1;
+        for (int t = 0; t < threads; t++)
+            if (pos[t] < w[t].nrows
+                && (best < 0 || cmp_transcript_rows(&w[t].rows[pos[t]], &w[best].rows[pos[best]]) < 0))
+                best = t;
+        TranscriptRow *r = best < 0 ? NULL : &w[best].rows[pos[best]++];
+        if (cur >= 0 && (!r || r->roll != cur)) {
+            if (graded) fprintf(out, "  GPA %.2f over %d graded course-semesters\n", points / graded, graded);
+            else fprintf(out, "  GPA -\n");
+        }
+        if (!r) break;
+        if (r->roll != cur) {
+            fprintf(out, "\n%s  %s\n", str_of(r->roll), r->name);
+            cur = r->roll;
+            points = 0;
+            graded = 0;
+        }
+        const char *grade = r->grade >= 0 ? str_of(r->grade) : "-";
+        double p = r->grade >= 0 ? grade_points(grade) : -1;
+        if (p >= 0) { points += p; graded++; }
+        if (r->percent >= 0) snprintf(buf, sizeof buf, "%.1f%%", r->percent);
+        else copy_field(buf, "-");
+        fprintf(out, "  %-16s %-8s grade %-4s attendance %s\n", r->course->name, str_of(r->sem), grade, buf);
+    }
+    free(pos);
+}
+
+/* kind is "transcripts", "averages" or "defaulters" */
+int run_report(const char *kind, double threshold, int threads, FILE *out) {
+    int k = strcmp(kind, "transcripts") == 0 ? REPORT_TRANSCRIPTS
+          : strcmp(kind, "averages") == 0 ? REPORT_AVERAGES
+          : strcmp(kind, "defaulters") == 0 ? REPORT_DEFAULTERS : -1;
+    if (k < 0) { printf("Unknown report '%s'.\n", kind); return -1; }
+    if (threads <= 0) threads = 1;
+    MetricScope m = metric_begin(OP_REPORT);
+    double start = now_seconds();
+
+    pthread_rwlock_rdlock(&registry.lock);
+    size_t n = registry.count;
+    Course **courses = xrealloc(NULL, (n + 1) * sizeof *courses);
+    memcpy(courses, registry.courses, n * sizeof *courses);
+    pthread_rwlock_unlock(&registry.lock);
+    char **text = xrealloc(NULL, (n + 1) * sizeof *text);
+    size_t *textlen = xrealloc(NULL, (n + 1) * sizeof *textlen);
+    memset(text, 0, (n + 1) * sizeof *text);
+
+    ReportWorker *w = xrealloc(NULL, threads * sizeof *w);
+    pthread_t *tids = xrealloc(NULL, threads * sizeof *tids);
+    for (int t = 0; t < threads; t++) {
+        w[t] = (ReportWorker){ k, threshold, courses, n, (size_t)t, (size_t)threads, text, textlen, NULL, 0, 0 };
+        pthread_create(&tids[t], NULL, report_worker, &w[t]);
+    }
+    for (int t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+
+    if (k == REPORT_AVERAGES) fprintf(out, "%-16s %-8s %9s %10s\n", "course", "semester", "students", "average");
+    if (k == REPORT_DEFAULTERS)
+        fprintf(out, "%-16s %-8s %-14s %-24s %7s  (below %g%%)\n", "course", "semester", "roll", "name",
+                "attend", threshold);
+    if (k == REPORT_TRANSCRIPTS) {
+        write_transcripts(w, threads, out);
+    } else {
+        for (size_t i = 0; i < n; i++)
+            if (text[i]) fwrite(text[i], 1, textlen[i], out);
+    }
+    int rc = fflush(out) == 0 ? 0 : -1;
+    for (size_t i = 0; i < n; i++) free(text[i]);
+    for (int t = 0; t < threads; t++) free(w[t].rows);
+    free(w); free(tids); free(text); free(textlen); free(courses);
+    fprintf(stderr, "Report '%s' over %zu courses with %d threads in %.3fs\n", kind, n, threads,
+            now_seconds() - start);
+    metric_end(&m);
+    return rc;
+}
+
+/* ---------- Library API ----------
+ * The entry points for programs embedding the registry (the crs CLI is
+ * one). Courses are named rather than passed as Course pointers, and
+ * every call returns a CRS_* code that crs_strerror turns into the token
+ * the server protocol uses. The calls are thread-safe once crs_init has
+ * returned. */
+
+/* Storage mode, fsync and async I/O settings from the environment
+   (CRS_STORAGE, CRS_FSYNC, CRS_AIO). Runs once; crs_init calls it. */
+void crs_configure() {
+    static int done;
+    if (done) return;
+    done = 1;
+    const char *mode = getenv("CRS_STORAGE");
+    if (mode && strcmp(mode, "binary") == 0) storage_mode = STORAGE_BINARY;
+    else if (mode && strcmp(mode, "sharded") == 0) storage_mode = STORAGE_SHARDED;
+    else if (!mode && file_exists(SHARD_MANIFEST)) storage_mode = STORAGE_SHARDED;
+    const char *sync = getenv("CRS_FSYNC");
+    if (sync && strcmp(sync, "off") == 0) journal_fsync = 0;
+    aio_init(getenv("CRS_AIO"));
+}
+
+/* Load the data in dir (NULL for the current directory) and replay the
+   journal over it. Every file is opened by a relative name, so dir becomes
+   the process's working directory (see crs.h). */
+int crs_init(const char *dir) {
+    if (dir && chdir(dir) != 0) return CRS_EIO;
+    crs_configure();
+    ensure_base_files();
+    if (load_registry() != 0) return CRS_EIO;
+    replay_journal();
+    sync_seat_counters();
+    if (feed_open() != 0) fprintf(stderr, "Could not open %s; changes will not be announced.\n", FEED_FILE);
+    return CRS_OK;
+}
+
+/* Fold the journal into the data files and write out the change feed */
+int crs_close() {
+    int rc = compact_journal() == 0 ? CRS_OK : CRS_EIO;
+    journal_drain();
+    feed_drain();
+    return rc;
+}
+
+const char *crs_strerror(int rc) {
+    static const char *names[] = { "ok", "duplicate", "io", "slot-clash", "credit-cap", "prerequisite",
+                                   "no-such-course", "not-enrolled", "bad-value", "exists" };
+    if (rc == CRS_WAITLISTED) return "waitlisted";
+    return rc <= 0 && rc >= CRS_EEXISTS ? names[-rc] : "unknown";
+}
+
+Course *crs_course(const char *name) {
+    pthread_rwlock_rdlock(&registry.lock);
+    Course *c = find_course(name);
+    pthread_rwlock_unlock(&registry.lock);
+    return c && c->listed ? c : NULL;
+}
+
+int crs_enroll(const char *course, const char *roll, const char *name,
+               const char *email, const char *year) {
+    Course *c = crs_course(course);
+    if (!c) return CRS_ENOCOURSE;
+    if (!roll[0] || !name[0] || bad_field(roll) || bad_field(name) || bad_field(email) || bad_field(year))
+        return CRS_EBADVALUE;
+    /* enroll_student's rule codes line up with CRS_ESLOT_CLASH.. */
+    return enroll_student(c, roll, name, email ? email : "", year ? year : "");
+}
+
+int crs_drop(const char *course, const char *roll) {
+    Course *c = crs_course(course);
+    if (!c) return CRS_ENOCOURSE;
+    int rc = drop_student(c, roll);
+    return rc == -1 ? CRS_ENOTENROLLED : rc < 0 ? CRS_EIO : CRS_OK;
+}
+
+/* Attendance (grades = 0) or grade upsert for an enrolled roll */
+int crs_upsert(const char *course, int grades, const char *roll, const char *sem, const char *value) {
+    Course *c = crs_course(course);
+    if (!c) return CRS_ENOCOURSE;
+    if (!sem[0] || bad_field(roll) || bad_field(sem) || bad_field(value)) return CRS_EBADVALUE;
+    int rc = set_sem_value(c, grades, roll, sem, value);
+    return rc == -1 ? CRS_ENOTENROLLED : rc == -3 ? CRS_EBADVALUE : rc < 0 ? CRS_EIO : CRS_OK;
+}
+
+/* att and grade (MAX_FIELD bytes each) get the roll's values for sem, or
+   "" when there are none. Returns 1 if the roll is enrolled, else 0. */
+int crs_query(const char *course, const char *roll, const char *sem, char *att, char *grade) {
+    Course *c = crs_course(course);
+    if (!c) return CRS_ENOCOURSE;
+    return query_student(c, roll, sem, att, grade);
+}
+
+/* Listed courses in listing order; returns how many */
+size_t crs_courses(crs_course_fn fn, void *arg) {
+    CourseCount *cc;
+    size_t n = course_counts(&cc);
+    for (size_t i = 0; i < n; i++) fn(cc[i].course->name, cc[i].enrolled, cc[i].capacity, cc[i].waiting, arg);
+    free(cc);
+    return n;
+}
+
+typedef struct {
+    crs_student_fn fn;
+    void *arg;
+} StudentVisit;
+
+void visit_student(const Registration *r, size_t waitpos, void *arg) {
+    StudentVisit *v = arg;
+    v->fn(str_of(r->roll), str_of(r->name), str_of(r->email), str_of(r->year), waitpos, v->arg);
+}
+
+/* A course's students, enrolled first then the waitlist in order;
+   returns the number enrolled */
+int crs_students(const char *course, crs_student_fn fn, void *arg) {
+    Course *c = crs_course(course);
+    if (!c) return CRS_ENOCOURSE;
+    StudentVisit v = { fn, arg };
+    return (int)course_roster(c, visit_student, &v);
+}
+
+/* Add a course to courses.txt and the registry. capacity 0 is unlimited;
+   credits, slots and prereqs may be NULL or "". */
+int crs_add_course(const char *name, int capacity, int credits, const char *slots, const char *prereqs) {
+    uint64_t mask[SLOT_WORDS];
+    slots = slots ? slots : "";
+    prereqs = prereqs ? prereqs : "";
+    if (!name[0] || bad_field(name) || bad_field(prereqs) || parse_slots(slots, mask) != 0)
+        return CRS_EBADVALUE;
+    /* the check and the append happen under the write lock, so two
+       concurrent adds of one name cannot both get through */
+    pthread_rwlock_wrlock(&registry.lock);
+    Course *c = find_course(name);
+    int rc = c && c->listed ? CRS_EEXISTS : CRS_OK;
+    /* an unlisted course the data already has students for cannot take
+       rules now: set_course_rules must run before anyone is linked */
+    if (rc == CRS_OK && c) {
+        course_lock(c);
+        if (c->regs.count || c->waitlist.count) rc = CRS_EEXISTS;
+        course_unlock(c);
+    }
+    char cap[16] = "", cred[16] = "";
+    if (capacity > 0) snprintf(cap, sizeof cap, "%d", capacity);
+    if (credits > 0) snprintf(cred, sizeof cred, "%d", credits);
+    FILE *fw = rc == CRS_OK ? fopen("courses.txt", "a") : NULL;
+    if (rc == CRS_OK && !fw) rc = CRS_EIO;
+    if (fw) {
+        if (cred[0] || slots[0] || prereqs[0]) fprintf(fw, "%s,%s,%s,%s,%s\n", name, cap, cred, slots, prereqs);
+        else if (cap[0]) fprintf(fw, "%s,%s\n", name, cap);
+        else fprintf(fw, "%s\n", name);
+        if (close_synced(fw) != 0) rc = CRS_EIO;
+    }
+    if (rc == CRS_OK) {
+        c = add_course(name, 1);
+        c->capacity = capacity > 0 ? capacity : 0;
+        if (set_course_rules(c, cred, slots, prereqs) != 0) rc = CRS_EBADVALUE;
+    }
+    pthread_rwlock_unlock(&registry.lock);
+    if (rc != CRS_OK) return rc;
+    counts_store(c);
+    feed_emit("C,%s,%s,%s,%s,%s\n", name, cap, cred, slots, prereqs);
+    return CRS_OK;
+}
@@ -0,0 +1,62 @@
+/* Course registration library: the API libcrs.a and libcrs.so export.
+   Programs embedding the registry include only this header; the rest of
+   crs.c is internal (crs_internal.h) and hidden from them. */
+
+#ifndef CRS_H
+#define CRS_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define CRS_API __attribute__((visibility("default")))
+#else
+#define CRS_API
+#endif
+
+/* Longest field value, terminator included */
+#define CRS_VALUE_MAX 128
+
+/* Result codes; crs_strerror names them */
+enum {
+    CRS_OK = 0, CRS_WAITLISTED = 1, CRS_EDUPLICATE = -1, CRS_EIO = -2,
+    CRS_ESLOT_CLASH = -3, CRS_ECREDIT_CAP = -4, CRS_EPREREQ = -5,
+    CRS_ENOCOURSE = -6, CRS_ENOTENROLLED = -7, CRS_EBADVALUE = -8, CRS_EEXISTS = -9
+};
+
+typedef void (*crs_course_fn)(const char *name, size_t enrolled, int capacity, size_t waiting, void *arg);
+/* waitpos is 0 for enrolled students, else the 1-based waitlist position */
+typedef void (*crs_student_fn)(const char *roll, const char *name, const char *email,
+                               const char *year, size_t waitpos, void *arg);
+
+/* Storage, fsync and async I/O settings from CRS_STORAGE, CRS_FSYNC and
+   CRS_AIO; crs_init calls it */
+CRS_API void crs_configure();
+/* Load the data in dir (NULL for the current directory).
+   NOTE: a non-NULL dir is made the working directory of the whole process,
+   and stays so: the library opens every data file by a relative name, then
+   and in its background threads for as long as it runs. A program that
+   uses relative paths of its own should open them by absolute path, or
+   pass NULL and keep the data directory as its working directory. */
+CRS_API int crs_init(const char *dir);
+/* Fold the journal into the data files */
+CRS_API int crs_close();
+CRS_API const char *crs_strerror(int rc);
+
+CRS_API int crs_enroll(const char *course, const char *roll, const char *name,
+                       const char *email, const char *year);
+CRS_API int crs_drop(const char *course, const char *roll);
+/* Attendance (grades = 0) or grade for an enrolled roll */
+CRS_API int crs_upsert(const char *course, int grades, const char *roll, const char *sem, const char *value);
+/* att and grade (CRS_VALUE_MAX bytes each) get the roll's values for sem,
+   or "" when there are none. Returns 1 if the roll is enrolled, else 0. */
+CRS_API int crs_query(const char *course, const char *roll, const char *sem, char *att, char *grade);
+/* Listed courses in listing order; returns how many */
+CRS_API size_t crs_courses(crs_course_fn fn, void *arg);
+/* Enrolled students, then the waitlist in order; returns the number enrolled */
+CRS_API int crs_students(const char *course, crs_student_fn fn, void *arg);
+/* capacity 0 is unlimited; credits, slots and prereqs may be 0, NULL or "".
+   CRS_EEXISTS if the course is listed already, or if the data has students
+   registered or waiting under that name without a courses.txt line. */
+CRS_API int crs_add_course(const char *name, int capacity, int credits, const char *slots, const char *prereqs);
+
+#endif
@@ -0,0 +1,427 @@
+/* Course registration core. The interactive menus (code.c), the server
+   and the benchmark (bench.c) all link against crs.c through this header;
+   crs.h is the public subset that libcrs exports. */
+
+#ifndef CRS_INTERNAL_H
+#define CRS_INTERNAL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "crs.h"
+
+#define MAX_LINE 512
+#define MAX_FIELD CRS_VALUE_MAX
+
+/* ---------- Types ---------- */
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} StrView;
+
+typedef struct {
+    char *data;
+    size_t size;
+    const char *pos, *end;
+    long line_no;
+} CsvScanner;
+
+/* Open-addressing hash index mapping a key hash to a record position.
+   The caller supplies the equality test since records live elsewhere. */
+typedef struct {
+    int *slot;
+    unsigned *hash;
+    size_t cap;   /* always a power of two */
+    size_t used;  /* live + deleted slots */
+    size_t live;
+} HashIndex;
+
+typedef int (*match_fn)(const void *table, int idx, const void *key);
+
+/* Bump allocator: memory is handed out from large blocks and only
+   released all at once */
+typedef struct {
+    char **blocks;
+    size_t nblocks, cap;
+    size_t used;       /* bytes used in the last block */
+    size_t bytes;      /* total block bytes allocated */
+} Arena;
+
+typedef struct {
+    char ***chunks;    /* directory of STR_MAX_CHUNKS chunk pointers */
+    size_t count;
+    HashIndex index;   /* string -> id */
+    Arena arena;       /* the string bytes, packed */
+    pthread_mutex_t lock;
+} StrTable;
+
+/* Every field is an interned string id, so a row is 16 bytes however
+   long the name and email are, and a student's name and email are stored
+   once across all their courses */
+typedef struct {
+    int roll, year, name, email;
+} Registration;
+
+typedef struct {
+    Registration *rows;
+    size_t count, cap;
+    HashIndex index;   /* roll -> rows[] */
+} RegTable;
+
+/* Attendance is numeric; a grade is an interned label ("A", "85", ...) */
+typedef union {
+    float percent;
+    int grade;
+} SemValue;
+
+/* One attendance or grade value for a (roll, semester) pair */
+typedef struct {
+    int roll, sem;     /* interned */
+    SemValue value;
+} SemRecord;
+
+typedef struct {
+    SemRecord *rows;
+    size_t count, cap;
+    HashIndex index;   /* (roll, sem) -> rows[] */
+} SemTable;
+
+/* Students waiting for a seat, oldest first */
+typedef struct {
+    Registration *rows;
+    size_t count, cap;
+} Waitlist;
+
+struct Shard;
+
+/* A weekly timetable: one bit per hour, Monday 00:00 first */
+#define SLOT_WORDS 3   /* 7 days x 24 hours */
+
+typedef struct Course {
+    char name[MAX_FIELD];
+    int listed;        /* present in courses.txt (orphan rows are kept but not shown) */
+    int capacity;      /* seat limit from courses.txt, 0 = unlimited */
+    atomic_int seats;  /* seats claimed, including enrollments still in flight */
+    atomic_int enrolled, waiting;   /* row counts, readable without the lock */
+    int count_slot;    /* 1-based record in the counter table, 0 = none yet */
+    int credits;       /* from courses.txt, 0 = none */
+    uint64_t slots[SLOT_WORDS];   /* hours the course meets */
+    struct Course **prereqs;
+    size_t nprereqs;
+    RegTable regs;
+    SemTable attendance;
+    SemTable grades;
+    Waitlist waitlist;
+    pthread_mutex_t lock;   /* guards the tables, the waitlist and the shard */
+    struct Shard *shard;    /* shard files and what changed since the last save */
+} Course;
+
+/* Courses are allocated individually so a Course never moves once created.
+   `lock` is held for reading by every per-course operation and for writing
+   when the course list changes or the whole registry is snapshotted. */
+typedef struct {
+    Course **courses;
+    size_t count, cap;
+    HashIndex index;   /* name -> courses[] */
+    pthread_rwlock_t lock;
+} Registry;
+
+/* A course a student is enrolled in or waiting for */
+typedef struct {
+    Course *course;
+    int waiting;
+} StudentCourse;
+
+/* One student across all courses. Name and email come from the latest
+   registration; lname/lemail are their interned lowercase forms. */
+typedef struct {
+    int roll, name, email, lname, lemail;   /* interned */
+    StudentCourse *courses;
+    size_t count, cap;
+    uint64_t slots[SLOT_WORDS];   /* hours taken by all of the courses */
+    int credits;
+} Student;
+
+/* A lowercase name or email pointing at a student; stale once the
+   student's key changes */
+typedef struct {
+    int key, student;
+    int next;          /* email chains: next entry with the same key, -1 at the end */
+} StudentKey;
+
+/* Student-first indexes over the registry: roll -> student, email ->
+   students, and lowercase names kept sorted for prefix search (with an
+   unsorted tail of recent additions). */
+typedef struct {
+    Student *rows;
+    size_t count, cap;
+    HashIndex by_roll;
+    StudentKey *emails;
+    size_t nemails, emails_cap;
+    HashIndex by_email;   /* lemail -> head of its chain in emails[] */
+    StudentKey *names;
+    size_t nnames, names_cap, sorted;
+    pthread_mutex_t lock;
+} StudentIndex;
+
+typedef void (*student_fn)(const Student *s, void *arg);
+
+/* One line of the course listing */
+typedef struct {
+    Course *course;
+    size_t enrolled, waiting;
+    int capacity;
+} CourseCount;
+
+/* One row of a section sheet; status is a SHEET_* code */
+typedef struct {
+    char roll[MAX_FIELD], sem[MAX_FIELD], value[MAX_FIELD];
+    long line;
+    int status;
+} SheetRow;
+
+enum { SHEET_OK, SHEET_NOT_ENROLLED, SHEET_BAD_VALUE, SHEET_NO_SEMESTER, SHEET_MALFORMED };
+
+typedef struct {
+    SheetRow *rows;
+    size_t count, cap;
+} Sheet;
+
+/* Roster visitor: waitpos is 0 for enrolled students, else the 1-based
+   waitlist position */
+typedef void (*roster_fn)(const Registration *r, size_t waitpos, void *arg);
+
+/* Orders for course_roster_page */
+enum { ROSTER_ENROLLED, ROSTER_BY_ROLL, ROSTER_BY_NAME };
+
+/* Enrollment checks against the course metadata */
+enum { RULE_OK, RULE_SLOT_CLASH, RULE_CREDIT_CAP, RULE_PREREQ };
+
+/* Problems the loader checks for */
+enum { LOAD_LONG_LINE, LOAD_MALFORMED, LOAD_DUPLICATE, LOAD_ORPHAN, LOAD_ISSUES };
+#define LOAD_SAMPLES 5
+
+/* What loading one data file (or one kind of shard file) found and how
+   long it took */
+typedef struct {
+    char file[MAX_FIELD];
+    char kind;         /* R, W, A or G */
+    long files, rows;
+    long long bytes;
+    double seconds;
+    int threads;
+    long issues[LOAD_ISSUES];
+    char samples[LOAD_ISSUES][LOAD_SAMPLES][MAX_LINE];   /* the first few, "file:line: what" */
+} LoadReport;
+
+/* Operations timed by the metrics layer */
+enum {
+    OP_OTHER, OP_LOAD, OP_ENROLL, OP_DROP, OP_ATTENDANCE, OP_GRADE, OP_LIST,
+    OP_AGGREGATE, OP_QUERY, OP_COMPACT, OP_IMPORT, OP_REPORT, OP_COUNT
+};
+/* Per-operation I/O counters */
+enum { METRIC_OPENS, METRIC_READ, METRIC_WRITTEN, METRIC_ROWS, METRIC_KINDS };
+#define METRIC_BUCKETS 25
+
+typedef struct {
+    int op, outer;
+    double start;
+} MetricScope;
+
+/* Async I/O backends (CRS_AIO) and the ops they run */
+enum { AIO_OFF, AIO_THREADS, AIO_URING };
+enum { AIO_WRITE, AIO_FSYNC, AIO_DATASYNC, AIO_FADVISE };
+
+typedef struct {
+    int type, fd;
+    const void *buf;   /* AIO_WRITE */
+    size_t len;
+    long long off;
+    int link;          /* the next op starts only after this one succeeds */
+    int result;        /* bytes written or 0; -errno on failure */
+} AioOp;
+
+/* Change feed subscriber: one feed line (seq<TAB>ms<TAB>record, newline
+   included) at a time, or line NULL whenever the tail has caught up.
+   Returns nonzero to stop the tail. */
+typedef int (*feed_fn)(long seq, const char *line, size_t len, void *arg);
+
+#define DATA_BIN "data.bin"
+#define SHARD_DIR "shards"
+#define SHARD_MANIFEST SHARD_DIR "/manifest.csv"
+#define JOURNAL_FILE "journal.log"
+enum { STORAGE_CSV, STORAGE_BINARY, STORAGE_SHARDED };
+
+extern StrTable strings;
+extern Registry registry;
+extern StudentIndex students;
+extern int storage_mode;
+extern int aio_backend;
+extern int credit_cap;
+extern int course_rules;
+extern LoadReport *load_reports;
+extern size_t nload_reports;
+extern long journal_records;
+extern int journal_fsync;
+extern long journal_fsyncs;
+extern int feed_active;
+
+/* ---------- Utilities ---------- */
+void trim_newline(char *s);
+int file_exists(const char *fname);
+void ensure_base_files();
+void copy_field(char *dst, const char *src);
+int bad_field(const char *s);
+void *xrealloc(void *p, size_t size);
+void *grow_array(void *p, size_t *cap, size_t need, size_t elem);
+const char *opt_value(int argc, char **argv, const char *name, const char *def);
+int split_line(char *line, char **fields, int max, char delim);
+double now_seconds();
+int cmp_double(const void *a, const void *b);
+
+/* ---------- Metrics ---------- */
+MetricScope metric_begin(int op);
+void metric_end(MetricScope *m);
+void metric_add(int kind, long long n);
+void metrics_write(FILE *out);
+int metrics_dump(const char *fname);
+void metrics_print_summary(FILE *out);
+
+/* ---------- Scanner ---------- */
+int scanner_open(CsvScanner *s, const char *path);
+void scanner_close(CsvScanner *s);
+int scanner_next(CsvScanner *s, StrView *fields, int max, char delim);
+void view_copy(char *dst, StrView v);
+void views_to_fields(const StrView *v, int n, char out[][MAX_FIELD], int want);
+
+/* ---------- Async I/O ---------- */
+int aio_init(const char *mode);
+const char *aio_backend_name(int backend);
+int aio_run(AioOp *ops, size_t n);
+void aio_prefetch(const char **paths, size_t n);
+
+/* ---------- Arena ---------- */
+void *arena_alloc(Arena *a, size_t n, size_t align);
+void arena_free(Arena *a);
+
+/* ---------- Strings ---------- */
+int intern_find(StrTable *t, const char *s);
+int intern(StrTable *t, const char *s);
+const char *str_of(int id);
+
+/* ---------- Registry ---------- */
+Course *find_course(const char *name);
+Course *add_course(const char *name, int listed);
+Course *course_by_number(int number);
+Registration *find_registration(Course *c, int roll);
+Registration *lookup_registration(Course *c, const char *roll);
+int add_registration(Course *c, int roll, int name, int email, int year);
+SemRecord *find_sem_record(SemTable *t, int roll, int sem);
+SemRecord *lookup_sem_record(SemTable *t, const char *roll, const char *sem);
+void upsert_sem_record(SemTable *t, int roll, int sem, SemValue value);
+int remove_registration(Course *c, int roll);
+int reserve_seat(Course *c);
+void release_seat(Course *c);
+long waitlist_find(Course *c, int roll);
+int waitlist_push(Course *c, int roll, int name, int email, int year);
+int drop_registration(Course *c, int roll);
+void sync_seat_counters();
+void counts_store(Course *c);
+void counts_verify();
+int fill_report(FILE *out);
+SemTable *sem_table(Course *c, int grades);
+int parse_percent(const char *s, float *out);
+int parse_sem_value(int grades, const char *s, SemValue *out);
+const char *format_sem_value(int grades, SemValue v, char *buf);
+
+/* ---------- Timetables and prerequisites ---------- */
+int parse_slots(const char *text, uint64_t *mask);
+char *format_slots(const uint64_t *mask, char *buf, size_t len);
+int set_course_rules(Course *c, const char *credits, const char *slots, const char *prereqs);
+int check_enrollment(Course *c, int roll, char *why, size_t len);
+const char *rule_name(int rule);
+
+/* ---------- Parallel loading ---------- */
+int load_thread_count();
+void load_reports_reset();
+LoadReport *load_report(const char *label, char kind);
+void check_orphans(const char *label_att, const char *label_grades);
+long load_issue_total();
+void load_warn(FILE *out);
+long verify_report(FILE *out);
+
+/* ---------- Storage and journal ---------- */
+void load_courses();
+int load_registry();
+int save_snapshot();
+int save_csv_snapshot();
+int save_binary_snapshot(const char *fname);
+int write_binary_snapshot(Course **courses, size_t count, const char *fname);
+int save_sharded_snapshot();
+void shard_touch(Course *c, char kind, int sem);
+void shard_touch_all(Course *c);
+void recover_snapshot();
+void replay_journal();
+int compact_journal();
+long journal_append(const char *fmt, ...);
+long journal_append_records(const char *recs, size_t len, long count);
+int journal_sync(long lsn);
+void journal_drain();
+void journal_close();
+void course_lock(Course *c);
+void course_unlock(Course *c);
+
+/* ---------- Change feed ---------- */
+int feed_open();
+void feed_record(long lsn, const char *rec, size_t len);
+void feed_emit(const char *fmt, ...);
+void feed_drain();
+long feed_wait(long seq, int ms);
+int feed_tail(long from, int follow, feed_fn fn, void *arg);
+
+/* ---------- Change API ---------- */
+/* 0 enrolled, 1 waitlisted, -1 duplicate, -2 I/O error, -2 - rule when a
+   RULE_* check fails */
+int enroll_student(Course *c, const char *roll, const char *name,
+                   const char *email, const char *year);
+int drop_student(Course *c, const char *roll);
+int set_sem_value(Course *c, int grades, const char *roll, const char *sem, const char *value);
+int import_file(const char *kind, const char *path);
+
+/* ---------- Section sheets ---------- */
+void sheet_add(Sheet *s, char *line, const char *sem, long line_no);
+int sheet_load(Sheet *s, const char *path, const char *sem);
+void sheet_free(Sheet *s);
+const char *sheet_status_text(int status);
+long apply_sheet(Course *c, int grades, Sheet *s);
+
+/* ---------- Queries ---------- */
+size_t course_counts(CourseCount **out);
+size_t course_roster(Course *c, roster_fn fn, void *arg);
+size_t course_roster_page(Course *c, int order, size_t offset, size_t limit,
+                          roster_fn fn, void *arg);
+int compare_rolls(const char *a, const char *b);
+int query_student(Course *c, const char *roll, const char *sem, char *att, char *grade);
+int find_student(const char *roll, student_fn fn, void *arg);
+size_t find_students_by_name(const char *prefix, size_t limit, student_fn fn, void *arg);
+size_t find_students_by_email(const char *email, student_fn fn, void *arg);
+
+/* ---------- Backups ---------- */
+int backup_snapshot(const char *dir, FILE *out);
+int backup_delta(const char *dir, FILE *out);
+int restore_backup(const char *dir, FILE *out);
+
+/* ---------- Memory ---------- */
+void memory_report(FILE *out);
+
+/* ---------- Reports ---------- */
+double grade_points(const char *g);
+int run_report(const char *kind, double threshold, int threads, FILE *out);
+
+/* ---------- Library API ---------- */
+Course *crs_course(const char *name);
+
+#endif